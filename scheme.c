@@ -16,73 +16,425 @@
  * <http://www.gnu.org/licenses/>.
  */
 
+/* for mmap, memory streams and threads, where there are */
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define HAVE_MMAP
+#define HAVE_MEMSTREAM
+#ifndef NO_THREADS
+#define HAVE_PTHREADS
+#endif
+#endif
+
+/* for --serve, where there is epoll */
+#ifdef __linux__
+#define HAVE_EPOLL
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <setjmp.h>
+#ifdef HAVE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+#if defined(HAVE_PTHREADS) || defined(HAVE_EPOLL)
+/* for sysconf and close, but its read and write are not the ones
+ * here */
+#define read posix_read
+#define write posix_write
+#include <unistd.h>
+#undef read
+#undef write
+#define HAVE_GETPID
+#define HAVE_ISATTY
+#endif
+#ifdef HAVE_EPOLL
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#endif
+
+/* AVX2 kernels for s64vectors, unless built with -DNO_SIMD_KERNELS */
+#if defined(__GNUC__) && !defined(NO_SIMD_KERNELS) && \
+    defined(__x86_64__) && LONG_MAX > 0x7fffffffL
+#define USE_SIMD_KERNELS
+#include <immintrin.h>
+#endif
+
+/* vector scanning in the reader, unless built with -DNO_SIMD_SCAN */
+#if defined(__GNUC__) && !defined(NO_SIMD_SCAN) && \
+    (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define USE_SIMD_SCAN
+#include <immintrin.h>
+#endif
 
 /**************************** MODEL ******************************/
 
+/* Integers that outgrow a fixnum become bignums: a sign and a
+ * magnitude of digits, least significant first, with no leading
+ * zero digits. Arithmetic always hands back a fixnum when the result
+ * fits in one, so a bignum is never a small number. A digit is half
+ * an unsigned long, so a product of two digits plus two more always
+ * fits in one. */
+#if ULONG_MAX / 0xffffffffUL > 0xffffffffUL
+typedef unsigned int bignum_digit;
+#define BIGNUM_DIGIT_BITS 32
+#define BIGNUM_DECIMAL_BASE 1000000000UL
+#define BIGNUM_DECIMAL_DIGITS 9
+#else
+typedef unsigned short bignum_digit;
+#define BIGNUM_DIGIT_BITS 16
+#define BIGNUM_DECIMAL_BASE 10000UL
+#define BIGNUM_DECIMAL_DIGITS 4
+#endif
+#define BIGNUM_DIGIT_MASK ((1UL << BIGNUM_DIGIT_BITS) - 1)
+#define BIGNUM_LONG_DIGITS \
+    ((sizeof(long) * CHAR_BIT + BIGNUM_DIGIT_BITS - 1) / BIGNUM_DIGIT_BITS)
+
+
 typedef enum {THE_EMPTY_LIST, BOOLEAN, SYMBOL, FIXNUM,
               CHARACTER, STRING, PAIR, PRIMITIVE_PROC,
               COMPOUND_PROC, INPUT_PORT, OUTPUT_PORT,
-              EOF_OBJECT} object_type;
+              EOF_OBJECT, VECTOR, BYTEVECTOR, S64VECTOR, HASH_TABLE,
+              PROMISE, RECORD_TYPE, RECORD, BIGNUM, BOX, CALL_CACHE,
+              CODE} object_type;
 
 typedef struct object {
     object_type type;
+    char mark; /* how often write_fasl has met it, 0 outside of that */
     union {
         struct {
             char value;
         } boolean;
         struct {
             char *value;
+            char is_bound_locally; /* ever a parameter or internal
+                                      definition */
+            char is_assumed; /* threaded code assumes its binding */
+            unsigned long hash; /* of the name */
         } symbol;
         struct {
             long value;
         } fixnum;
+        struct {
+            bignum_digit *digits;
+            long length;
+            char is_negative;
+        } bignum;
         struct {
             char value;
         } character;
         struct {
             char *value;
+            size_t length; /* not counting the '\0' */
+            unsigned long hash; /* 0 until hash_string needs it */
         } string;
         struct {
             struct object *car;
             struct object *cdr;
+            struct object *annotation; /* cached analysis, see eval */
         } pair;
+        struct {
+            struct object **elements;
+            long length;
+        } vector;
+        struct {
+            unsigned char *bytes;
+            long length;
+        } bytevector;
+        struct {
+            long *elements; /* fixnums, unboxed */
+            long length;
+        } s64vector;
+        struct {
+            struct hash_table *table;
+        } hash_table;
+        struct {
+            struct promise_box *box; /* shared along a delay-force
+                                        chain, see force */
+        } promise;
+        struct {
+            struct object *name;
+            long field_count;
+        } record_type;
+        struct {
+            struct object *type;
+            struct object **slots; /* right after the object */
+        } record;
         struct {
             struct object *(*fn)(struct object *arguments);
         } primitive_proc;
         struct {
-            struct object *parameters;
-            struct object *body;
             struct object *env;
+            struct object *info;
         } compound_proc;
         struct {
-            FILE *stream;
+            struct reader *reader;
         } input_port;
         struct {
             FILE *stream;
+            char *string; /* what a string port holds, as of the
+                             last flush */
+            size_t length;
         } output_port;
+        struct {
+            struct object *value;
+        } box;
+        struct {
+            struct cached_call *call;
+        } call_cache;
+        struct {
+            struct threaded_code *code; /* NULL if it cannot be made */
+        } code;
     } data;
 } object;
 
-/* no GC so truely "unlimited extent" */
-object *alloc_object(void) {
-    object *obj;
+FILE *stderr_stream; /* where errors are reported */
+
+/* where an error goes instead of ending the program, if set */
+jmp_buf *error_recovery = NULL;
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+void end_with_error(void);
+
+/* Ends the program once an error has been reported to stderr_stream,
+ * unless something has set error_recovery to carry on after it. */
+void end_with_error(void) {
+    if (error_recovery != NULL) {
+        longjmp(*error_recovery, 1);
+    }
+    exit(1);
+}
 
-    obj = malloc(sizeof(object));
-    if (obj == NULL) {
+/* What malloc, calloc or realloc gave back, unless it ran out of
+ * memory, which ends the program even with error_recovery set: the
+ * allocation may have been made holding the symbol table lock. */
+void *check_alloc(void *memory) {
+    if (memory == NULL) {
         fprintf(stderr, "out of memory\n");
         exit(1);
     }
+    return memory;
+}
+
+/* no GC so truely "unlimited extent" */
+object *alloc_object(void) {
+    object *obj;
+
+    obj = check_alloc(malloc(sizeof(object)));
+    obj->mark = 0;
     return obj;
 }
 
+/* Frames and argument lists that provably never outlive the eval
+ * activation that made them are carved out of this stack instead of
+ * the heap. Each eval activation pops the stack back on return. */
+#define REGION_CHUNK_SIZE 4096
+
+typedef struct region_chunk {
+    struct region_chunk *next;
+    int used;
+    object objects[REGION_CHUNK_SIZE];
+} region_chunk;
+
+typedef struct region_mark {
+    region_chunk *chunk;
+    int used;
+} region_mark;
+
+region_chunk *region_top = NULL;
+
+region_chunk *alloc_region_chunk(void) {
+    region_chunk *chunk;
+
+    chunk = check_alloc(malloc(sizeof(region_chunk)));
+    chunk->next = NULL;
+    chunk->used = 0;
+    return chunk;
+}
+
+object *alloc_region_object(void) {
+    if (region_top->used == REGION_CHUNK_SIZE) {
+        /* chunks are kept when popped so a deep recursion pays the
+         * malloc only once */
+        if (region_top->next == NULL) {
+            region_top->next = alloc_region_chunk();
+        }
+        region_top = region_top->next;
+        region_top->used = 0;
+    }
+    region_top->objects[region_top->used].mark = 0;
+    return &region_top->objects[region_top->used++];
+}
+
+region_mark current_region_mark(void) {
+    region_mark mark;
+
+    mark.chunk = region_top;
+    mark.used = region_top->used;
+    return mark;
+}
+
+void release_region(region_mark mark) {
+    region_top = mark.chunk;
+    region_top->used = mark.used;
+}
+
+/* Input is read out of a buffer rather than a character at a time
+ * through stdio. A regular file is mapped whole. A terminal is read a
+ * line at a time so the REPL still answers each line as it is typed,
+ * and anything else, like a pipe, a buffer full at a time. Where
+ * there is no telling a terminal, every stream is read by lines. The
+ * character before the next one is always kept in the buffer so one
+ * character can be put back. */
+#define READER_BUFFER_SIZE 4096
+
+typedef struct reader {
+    FILE *stream;
+    char *buffer;
+    char *next;
+    char *end;
+    size_t size;            /* of the buffer */
+    char is_mapped;
+    char is_interactive;    /* so read a line at a time */
+    char *token;            /* symbols and strings are gathered here */
+    size_t token_size;
+    struct read_ahead *ahead; /* if reading on a thread for a load */
+    jmp_buf *fasl_recovery; /* where a bad fasl record goes, if set */
+} reader;
+
+reader *stdin_reader;
+FILE *stdout_stream; /* where output goes when no port is given */
+
+reader *make_reader(FILE *stream) {
+    reader *in;
+#ifdef HAVE_MMAP
+    struct stat status;
+    long offset;
+    void *map;
+#endif
+    
+    in = check_alloc(malloc(sizeof(reader)));
+    in->stream = stream;
+    in->token = NULL;
+    in->token_size = 0;
+    in->ahead = NULL;
+    in->fasl_recovery = NULL;
+#ifdef HAVE_MMAP
+    if (fstat(fileno(stream), &status) == 0 && S_ISREG(status.st_mode) &&
+        status.st_size > 0 && (offset = ftell(stream)) >= 0) {
+        map = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE,
+                   fileno(stream), 0);
+        if (map != MAP_FAILED) {
+            in->buffer = map;
+            in->next = in->buffer + offset;
+            in->end = in->buffer + status.st_size;
+            in->size = status.st_size;
+            in->is_mapped = 1;
+            in->is_interactive = 0;
+            return in;
+        }
+    }
+#endif
+    in->buffer = check_alloc(malloc(READER_BUFFER_SIZE));
+    in->next = in->buffer;
+    in->end = in->buffer;
+    in->size = READER_BUFFER_SIZE;
+    in->is_mapped = 0;
+#ifdef HAVE_ISATTY
+    in->is_interactive = isatty(fileno(stream));
+#else
+    in->is_interactive = 1;
+#endif
+    return in;
+}
+
+/* A string port reads the characters of the string in place. With no
+ * stream behind it, the buffer is never refilled. */
+reader *make_string_reader(char *chars, size_t length) {
+    reader *in;
+    
+    in = check_alloc(malloc(sizeof(reader)));
+    in->stream = NULL;
+    in->buffer = chars;
+    in->next = chars;
+    in->end = chars + length;
+    in->size = length;
+    in->is_mapped = 0;
+    in->is_interactive = 0;
+    in->token = NULL;
+    in->token_size = 0;
+    in->ahead = NULL;
+    in->fasl_recovery = NULL;
+    return in;
+}
+
+/* the next character once the buffer is used up, or EOF. A line is
+ * read with getc rather than fgets as a fasl record may hold '\0'. */
+int refill_reader(reader *in) {
+    int kept;
+    int c;
+    char *limit;
+    
+    if (in->is_mapped || in->stream == NULL) {
+        return EOF;
+    }
+    kept = (in->next > in->buffer) ? 1 : 0;
+    if (kept) {
+        in->buffer[0] = in->next[-1];
+    }
+    in->next = in->buffer + kept;
+    in->end = in->next;
+    limit = in->buffer + in->size;
+    if (!in->is_interactive) {
+        in->end += fread(in->end, 1, limit - in->end, in->stream);
+    }
+    else {
+        while (in->end < limit && (c = getc(in->stream)) != EOF) {
+            *in->end++ = c;
+            if (c == '\n') {
+                break;
+            }
+        }
+    }
+    return (in->end > in->next) ? (unsigned char)*in->next : EOF;
+}
+
+int close_reader(reader *in) {
+    if (in->stream == NULL) {
+        free(in->token);
+        return 0;
+    }
+#ifdef HAVE_MMAP
+    if (in->is_mapped) {
+        munmap(in->buffer, in->size);
+    }
+#endif
+    if (!in->is_mapped) {
+        free(in->buffer);
+    }
+    free(in->token);
+    return fclose(in->stream);
+}
+
 object *the_empty_list;
 object *false;
 object *true;
-object *symbol_table;
+object **symbol_table;     /* of lists of symbols, by hash of name */
+unsigned long symbol_table_size; /* a power of two */
+unsigned long symbol_count;
 object *quote_symbol;
 object *define_symbol;
 object *set_symbol;
@@ -95,13 +447,28 @@ object *else_symbol;
 object *let_symbol;
 object *and_symbol;
 object *or_symbol;
+object *delay_symbol;
+object *delay_force_symbol;
+object *cons_stream_symbol;
+object *delay_procedure;
+object *delay_force_procedure;
+object *cons_procedure;
+object *define_record_type_symbol;
+object *record_variable;
+object *value_variable;
+object *record_procedure;
+object *is_record_procedure;
+object *record_ref_procedure;
+object *record_set_procedure;
 object *eof_object;
+object *unassigned;
 object *the_empty_environment;
 object *the_global_environment;
 
 object *cons(object *car, object *cdr);
 object *car(object *pair);
 object *cdr(object *pair);
+void set_cdr(object *obj, object* value);
 
 char is_the_empty_list(object *obj) {
     return obj == the_empty_list;
@@ -119,14 +486,76 @@ char is_true(object *obj) {
     return !is_false(obj);
 }
 
+#ifdef HAVE_PTHREADS
+/* a load interns the symbols it reads on a thread of its own */
+pthread_mutex_t symbol_table_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+unsigned long hash_symbol_name(char *value) {
+    unsigned long hash;
+    
+    hash = 2166136261UL;
+    while (*value != '\0') {
+        hash = (hash ^ (unsigned char)*value++) * 16777619UL;
+    }
+    return hash;
+}
+
+object **alloc_symbol_table(unsigned long size) {
+    object **table;
+    unsigned long i;
+    
+    table = check_alloc(malloc(size * sizeof(object *)));
+    for (i = 0; i < size; i++) {
+        table[i] = the_empty_list;
+    }
+    return table;
+}
+
+/* doubles the lists, moving the pairs of the old ones over */
+void grow_symbol_table(void) {
+    object **old;
+    unsigned long old_size;
+    object *element;
+    object *next;
+    object **bucket;
+    unsigned long i;
+    
+    old = symbol_table;
+    old_size = symbol_table_size;
+    symbol_table_size *= 2;
+    symbol_table = alloc_symbol_table(symbol_table_size);
+    for (i = 0; i < old_size; i++) {
+        for (element = old[i]; !is_the_empty_list(element);
+             element = next) {
+            next = cdr(element);
+            bucket = &symbol_table[car(element)->data.symbol.hash &
+                                   (symbol_table_size - 1)];
+            set_cdr(element, *bucket);
+            *bucket = element;
+        }
+    }
+    free(old);
+}
+
 object *make_symbol(char *value) {
     object *obj;
     object *element;
+    object **bucket;
+    unsigned long hash;
     
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&symbol_table_lock);
+#endif
     /* search for they symbol in the symbol table */
-    element = symbol_table;
+    hash = hash_symbol_name(value);
+    bucket = &symbol_table[hash & (symbol_table_size - 1)];
+    element = *bucket;
     while (!is_the_empty_list(element)) {
         if (strcmp(car(element)->data.symbol.value, value) == 0) {
+#ifdef HAVE_PTHREADS
+            pthread_mutex_unlock(&symbol_table_lock);
+#endif
             return car(element);
         }
         element = cdr(element);
@@ -135,13 +564,18 @@ object *make_symbol(char *value) {
     /* create the symbol and add it to the symbol table */
     obj = alloc_object();
     obj->type = SYMBOL;
-    obj->data.symbol.value = malloc(strlen(value) + 1);
-    if (obj->data.symbol.value == NULL) {
-        fprintf(stderr, "out of memory\n");
-        exit(1);
-    }
+    obj->data.symbol.value = check_alloc(malloc(strlen(value) + 1));
     strcpy(obj->data.symbol.value, value);
-    symbol_table = cons(obj, symbol_table);
+    obj->data.symbol.is_bound_locally = 0;
+    obj->data.symbol.is_assumed = 0;
+    obj->data.symbol.hash = hash;
+    *bucket = cons(obj, *bucket);
+    if (++symbol_count > 2 * symbol_table_size) {
+        grow_symbol_table();
+    }
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&symbol_table_lock);
+#endif
     return obj;
 }
 
@@ -161,760 +595,4021 @@ object *make_fixnum(long value) {
 char is_fixnum(object *obj) {
     return obj->type == FIXNUM;
 }
+/* below this many digits Karatsuba costs more than it saves */
+#define KARATSUBA_CUTOFF 32
 
-object *make_character(char value) {
-    object *obj;
-
-    obj = alloc_object();
-    obj->type = CHARACTER;
-    obj->data.character.value = value;
-    return obj;
-}
+#if (defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)
+#define HAVE_OVERFLOW_BUILTINS
+#endif
 
-char is_character(object *obj) {
-    return obj->type == CHARACTER;
+char add_overflows(long a, long b, long *result) {
+#ifdef HAVE_OVERFLOW_BUILTINS
+    return __builtin_add_overflow(a, b, result);
+#else
+    if ((b > 0 && a > LONG_MAX - b) || (b < 0 && a < LONG_MIN - b)) {
+        return 1;
+    }
+    *result = a + b;
+    return 0;
+#endif
 }
 
-object *make_string(char *value) {
-    object *obj;
-
-    obj = alloc_object();
-    obj->type = STRING;
-    obj->data.string.value = malloc(strlen(value) + 1);
-    if (obj->data.string.value == NULL) {
-        fprintf(stderr, "out of memory\n");
-        exit(1);
+char sub_overflows(long a, long b, long *result) {
+#ifdef HAVE_OVERFLOW_BUILTINS
+    return __builtin_sub_overflow(a, b, result);
+#else
+    if ((b < 0 && a > LONG_MAX + b) || (b > 0 && a < LONG_MIN + b)) {
+        return 1;
     }
-    strcpy(obj->data.string.value, value);
-    return obj;
+    *result = a - b;
+    return 0;
+#endif
 }
 
-char is_string(object *obj) {
-    return obj->type == STRING;
+char mul_overflows(long a, long b, long *result) {
+#ifdef HAVE_OVERFLOW_BUILTINS
+    return __builtin_mul_overflow(a, b, result);
+#else
+    if (a > 0 ? (b > 0 ? a > LONG_MAX / b : b < LONG_MIN / a) :
+                (b > 0 ? a < LONG_MIN / b : a != 0 && b < LONG_MAX / a)) {
+        return 1;
+    }
+    *result = a * b;
+    return 0;
+#endif
 }
 
-object *cons(object *car, object *cdr) {
+object *make_bignum(long length, char is_negative) {
     object *obj;
-    
+
     obj = alloc_object();
-    obj->type = PAIR;
-    obj->data.pair.car = car;
-    obj->data.pair.cdr = cdr;
+    obj->type = BIGNUM;
+    obj->data.bignum.digits =
+        check_alloc(malloc((length > 0 ? length : 1) * sizeof(bignum_digit)));
+    obj->data.bignum.length = length;
+    obj->data.bignum.is_negative = is_negative;
     return obj;
 }
 
-char is_pair(object *obj) {
-    return obj->type == PAIR;
+char is_bignum(object *obj) {
+    return obj->type == BIGNUM;
 }
 
-object *car(object *pair) {
-    return pair->data.pair.car;
+char is_integer(object *obj) {
+    return is_fixnum(obj) || is_bignum(obj);
 }
 
-void set_car(object *obj, object* value) {
-    obj->data.pair.car = value;
+object *integer_argument(object *obj) {
+    if (!is_integer(obj)) {
+        fprintf(stderr_stream, "integer expected\n");
+        end_with_error();
+    }
+    return obj;
 }
 
-object *cdr(object *pair) {
-    return pair->data.pair.cdr;
-}
+/* strips leading zero digits and makes a fixnum of what fits */
+object *normalize_bignum(object *obj) {
+    bignum_digit *digits;
+    long length;
+    unsigned long magnitude;
+    long i;
 
-void set_cdr(object *obj, object* value) {
-    obj->data.pair.cdr = value;
+    digits = obj->data.bignum.digits;
+    length = obj->data.bignum.length;
+    while (length > 0 && digits[length - 1] == 0) {
+        length--;
+    }
+    obj->data.bignum.length = length;
+    if (length <= (long)BIGNUM_LONG_DIGITS) {
+        magnitude = 0;
+        for (i = length - 1; i >= 0; i--) {
+            magnitude = (magnitude << (BIGNUM_DIGIT_BITS - 1) << 1) |
+                        digits[i];
+        }
+        if (magnitude <= (unsigned long)LONG_MAX ||
+            (obj->data.bignum.is_negative &&
+             magnitude == (unsigned long)LONG_MAX + 1)) {
+            free(digits);
+            obj->type = FIXNUM;
+            obj->data.fixnum.value = obj->data.bignum.is_negative ?
+                                         (long)(0 - magnitude) :
+                                         (long)magnitude;
+            return obj;
+        }
+    }
+    return obj;
 }
 
-#define caar(obj)   car(car(obj))
-#define cadr(obj)   car(cdr(obj))
-#define cdar(obj)   cdr(car(obj))
-#define cddr(obj)   cdr(cdr(obj))
-#define caaar(obj)  car(car(car(obj)))
-#define caadr(obj)  car(car(cdr(obj)))
-#define cadar(obj)  car(cdr(car(obj)))
-#define caddr(obj)  car(cdr(cdr(obj)))
-#define cdaar(obj)  cdr(car(car(obj)))
-#define cdadr(obj)  cdr(car(cdr(obj)))
-#define cddar(obj)  cdr(cdr(car(obj)))
-#define cdddr(obj)  cdr(cdr(cdr(obj)))
-#define caaaar(obj) car(car(car(car(obj))))
-#define caaadr(obj) car(car(car(cdr(obj))))
-#define caadar(obj) car(car(cdr(car(obj))))
-#define caaddr(obj) car(car(cdr(cdr(obj))))
-#define cadaar(obj) car(cdr(car(car(obj))))
-#define cadadr(obj) car(cdr(car(cdr(obj))))
-#define caddar(obj) car(cdr(cdr(car(obj))))
-#define cadddr(obj) car(cdr(cdr(cdr(obj))))
-#define cdaaar(obj) cdr(car(car(car(obj))))
-#define cdaadr(obj) cdr(car(car(cdr(obj))))
-#define cdadar(obj) cdr(car(cdr(car(obj))))
-#define cdaddr(obj) cdr(car(cdr(cdr(obj))))
-#define cddaar(obj) cdr(cdr(car(car(obj))))
-#define cddadr(obj) cdr(cdr(car(cdr(obj))))
-#define cdddar(obj) cdr(cdr(cdr(car(obj))))
-#define cddddr(obj) cdr(cdr(cdr(cdr(obj))))
+/* the digits of an integer, which for a fixnum are made in the
+ * view's own buffer */
+typedef struct integer_view {
+    bignum_digit *digits;
+    long length;
+    char is_negative;
+    bignum_digit buffer[BIGNUM_LONG_DIGITS];
+} integer_view;
 
-object *make_primitive_proc(
-           object *(*fn)(struct object *arguments)) {
-    object *obj;
+void view_integer(object *obj, integer_view *view) {
+    unsigned long magnitude;
 
-    obj = alloc_object();
-    obj->type = PRIMITIVE_PROC;
-    obj->data.primitive_proc.fn = fn;
-    return obj;
+    if (is_bignum(obj)) {
+        view->digits = obj->data.bignum.digits;
+        view->length = obj->data.bignum.length;
+        view->is_negative = obj->data.bignum.is_negative;
+        return;
+    }
+    view->is_negative = obj->data.fixnum.value < 0;
+    magnitude = view->is_negative ?
+                    -(unsigned long)obj->data.fixnum.value :
+                    (unsigned long)obj->data.fixnum.value;
+    view->digits = view->buffer;
+    view->length = 0;
+    while (magnitude != 0) {
+        view->buffer[view->length++] = magnitude & BIGNUM_DIGIT_MASK;
+        magnitude = magnitude >> (BIGNUM_DIGIT_BITS - 1) >> 1;
+    }
 }
 
-char is_primitive_proc(object *obj) {
-    return obj->type == PRIMITIVE_PROC;
-}
+int compare_digits(bignum_digit *a, long na, bignum_digit *b, long nb) {
+    long i;
 
-object *is_null_proc(object *arguments) {
-    return is_the_empty_list(car(arguments)) ? true : false;
+    if (na != nb) {
+        return (na < nb) ? -1 : 1;
+    }
+    for (i = na - 1; i >= 0; i--) {
+        if (a[i] != b[i]) {
+            return (a[i] < b[i]) ? -1 : 1;
+        }
+    }
+    return 0;
 }
 
-object *is_boolean_proc(object *arguments) {
-    return is_boolean(car(arguments)) ? true : false;
-}
+/* adds a into r, which is at least as long, and returns the carry */
+bignum_digit add_digits(bignum_digit *r, long nr,
+                        bignum_digit *a, long na) {
+    unsigned long sum;
+    bignum_digit carry;
+    long i;
 
-object *is_symbol_proc(object *arguments) {
-    return is_symbol(car(arguments)) ? true : false;
+    carry = 0;
+    for (i = 0; i < na; i++) {
+        sum = (unsigned long)r[i] + a[i] + carry;
+        r[i] = sum & BIGNUM_DIGIT_MASK;
+        carry = sum >> BIGNUM_DIGIT_BITS;
+    }
+    for (; carry != 0 && i < nr; i++) {
+        sum = (unsigned long)r[i] + carry;
+        r[i] = sum & BIGNUM_DIGIT_MASK;
+        carry = sum >> BIGNUM_DIGIT_BITS;
+    }
+    return carry;
 }
 
-object *is_integer_proc(object *arguments) {
-    return is_fixnum(car(arguments)) ? true : false;
-}
+/* subtracts a from r, which must hold at least as much */
+void subtract_digits(bignum_digit *r, long nr, bignum_digit *a, long na) {
+    unsigned long borrow;
+    unsigned long digit;
+    long i;
 
-object *is_char_proc(object *arguments) {
-    return is_character(car(arguments)) ? true : false;
+    borrow = 0;
+    for (i = 0; i < nr && (i < na || borrow != 0); i++) {
+        digit = (i < na) ? a[i] + borrow : borrow;
+        borrow = (r[i] < digit) ? 1 : 0;
+        r[i] = (r[i] + (borrow << BIGNUM_DIGIT_BITS) - digit) &
+               BIGNUM_DIGIT_MASK;
+    }
 }
 
-object *is_string_proc(object *arguments) {
-    return is_string(car(arguments)) ? true : false;
+void multiply_digits(bignum_digit *a, long na, bignum_digit *b, long nb,
+                     bignum_digit *r);
+
+void multiply_digits_schoolbook(bignum_digit *a, long na,
+                                bignum_digit *b, long nb,
+                                bignum_digit *r) {
+    unsigned long product;
+    unsigned long carry;
+    long i;
+    long j;
+
+    memset(r, 0, (na + nb) * sizeof(bignum_digit));
+    for (i = 0; i < na; i++) {
+        carry = 0;
+        for (j = 0; j < nb; j++) {
+            product = (unsigned long)a[i] * b[j] + r[i + j] + carry;
+            r[i + j] = product & BIGNUM_DIGIT_MASK;
+            carry = product >> BIGNUM_DIGIT_BITS;
+        }
+        r[i + nb] = carry;
+    }
 }
 
-object *is_pair_proc(object *arguments) {
-    return is_pair(car(arguments)) ? true : false;
+bignum_digit *alloc_digits(long length) {
+    return check_alloc(malloc((length > 0 ? length : 1) *
+                              sizeof(bignum_digit)));
+}
+
+/* Karatsuba splits both at half the longer, a = a1 B + a0 and
+ * b = b1 B + b0, and gets the middle product a0 b1 + a1 b0 from one
+ * multiplication as (a0 + a1)(b0 + b1) - a0 b0 - a1 b1. A much
+ * shorter b is multiplied by a in pieces as long as b. */
+void multiply_digits_karatsuba(bignum_digit *a, long na,
+                               bignum_digit *b, long nb,
+                               bignum_digit *r) {
+    bignum_digit *sums;
+    bignum_digit *middle;
+    long m;
+    long nsa;
+    long nsb;
+    long i;
+    long n;
+
+    if (2 * nb <= na) {
+        middle = alloc_digits(2 * nb);
+        memset(r, 0, (na + nb) * sizeof(bignum_digit));
+        for (i = 0; i < na; i += nb) {
+            n = (na - i < nb) ? na - i : nb;
+            multiply_digits(a + i, n, b, nb, middle);
+            add_digits(r + i, na + nb - i, middle, n + nb);
+        }
+        free(middle);
+        return;
+    }
+    m = na / 2;
+    nsa = na - m + 1;
+    nsb = ((nb - m > m) ? nb - m : m) + 1;
+    sums = alloc_digits(nsa + nsb);
+    middle = alloc_digits(nsa + nsb);
+    memset(sums, 0, (nsa + nsb) * sizeof(bignum_digit));
+    memcpy(sums, a + m, (na - m) * sizeof(bignum_digit));
+    add_digits(sums, nsa, a, m);
+    memcpy(sums + nsa, b, m * sizeof(bignum_digit));
+    add_digits(sums + nsa, nsb, b + m, nb - m);
+    multiply_digits(a, m, b, m, r);
+    multiply_digits(a + m, na - m, b + m, nb - m, r + 2 * m);
+    multiply_digits(sums, nsa, sums + nsa, nsb, middle);
+    subtract_digits(middle, nsa + nsb, r, 2 * m);
+    subtract_digits(middle, nsa + nsb, r + 2 * m, na + nb - 2 * m);
+    n = nsa + nsb;
+    while (n > 0 && middle[n - 1] == 0) {
+        n--;
+    }
+    add_digits(r + m, na + nb - m, middle, n);
+    free(sums);
+    free(middle);
 }
 
-char is_compound_proc(object *obj);
-
-object *is_procedure_proc(object *arguments) {
-    object *obj;
-    
-    obj = car(arguments);
-    return (is_primitive_proc(obj) ||
-            is_compound_proc(obj)) ?
-                true :
-                false;
+/* r gets the na + nb digits of a times b */
+void multiply_digits(bignum_digit *a, long na, bignum_digit *b, long nb,
+                     bignum_digit *r) {
+    if (na < nb) {
+        multiply_digits(b, nb, a, na, r);
+    }
+    else if (nb < KARATSUBA_CUTOFF) {
+        multiply_digits_schoolbook(a, na, b, nb, r);
+    }
+    else {
+        multiply_digits_karatsuba(a, na, b, nb, r);
+    }
 }
 
-object *char_to_integer_proc(object *arguments) {
-    return make_fixnum((car(arguments))->data.character.value);
-}
+/* divides the digits by a single digit in place and returns the
+ * remainder */
+bignum_digit divide_digits_short(bignum_digit *digits, long length,
+                                 bignum_digit divisor) {
+    unsigned long remainder;
+    long i;
 
-object *integer_to_char_proc(object *arguments) {
-    return make_character((car(arguments))->data.fixnum.value);
+    remainder = 0;
+    for (i = length - 1; i >= 0; i--) {
+        remainder = (remainder << BIGNUM_DIGIT_BITS) | digits[i];
+        digits[i] = remainder / divisor;
+        remainder %= divisor;
+    }
+    return remainder;
+}
+
+/* Knuth's algorithm D: q gets the nu - nv + 1 digits of u over v and
+ * r the nv digits of the remainder. v has at least two digits, the
+ * most significant not zero. */
+void divide_digits(bignum_digit *u, long nu, bignum_digit *v, long nv,
+                   bignum_digit *q, bignum_digit *r) {
+    bignum_digit *un;
+    bignum_digit *vn;
+    unsigned long base;
+    unsigned long numerator;
+    unsigned long qhat;
+    unsigned long rhat;
+    unsigned long product;
+    unsigned long carry;
+    long difference;
+    long borrow;
+    int shift;
+    long i;
+    long j;
+
+    base = 1UL << BIGNUM_DIGIT_BITS;
+    shift = 0;
+    while (((v[nv - 1] << shift) & (1UL << (BIGNUM_DIGIT_BITS - 1))) == 0) {
+        shift++;
+    }
+    vn = alloc_digits(nv);
+    un = alloc_digits(nu + 1);
+    for (i = nv - 1; i > 0; i--) {
+        vn[i] = ((unsigned long)v[i] << shift |
+                 (shift == 0 ? 0 :
+                     (unsigned long)v[i - 1] >> (BIGNUM_DIGIT_BITS - shift))) &
+                BIGNUM_DIGIT_MASK;
+    }
+    vn[0] = ((unsigned long)v[0] << shift) & BIGNUM_DIGIT_MASK;
+    un[nu] = (shift == 0) ? 0 :
+                 (unsigned long)u[nu - 1] >> (BIGNUM_DIGIT_BITS - shift);
+    for (i = nu - 1; i > 0; i--) {
+        un[i] = ((unsigned long)u[i] << shift |
+                 (shift == 0 ? 0 :
+                     (unsigned long)u[i - 1] >> (BIGNUM_DIGIT_BITS - shift))) &
+                BIGNUM_DIGIT_MASK;
+    }
+    un[0] = ((unsigned long)u[0] << shift) & BIGNUM_DIGIT_MASK;
+
+    for (j = nu - nv; j >= 0; j--) {
+        numerator = ((unsigned long)un[j + nv] << BIGNUM_DIGIT_BITS) |
+                    un[j + nv - 1];
+        qhat = numerator / vn[nv - 1];
+        rhat = numerator % vn[nv - 1];
+        while (qhat >= base ||
+               qhat * vn[nv - 2] > ((rhat << BIGNUM_DIGIT_BITS) |
+                                    un[j + nv - 2])) {
+            qhat--;
+            rhat += vn[nv - 1];
+            if (rhat >= base) {
+                break;
+            }
+        }
+        borrow = 0;
+        carry = 0;
+        for (i = 0; i < nv; i++) {
+            product = qhat * vn[i] + carry;
+            carry = product >> BIGNUM_DIGIT_BITS;
+            difference = (long)un[i + j] -
+                         (long)(product & BIGNUM_DIGIT_MASK) - borrow;
+            borrow = (difference < 0) ? 1 : 0;
+            un[i + j] = difference & BIGNUM_DIGIT_MASK;
+        }
+        difference = (long)un[j + nv] - (long)carry - borrow;
+        un[j + nv] = difference & BIGNUM_DIGIT_MASK;
+        if (difference < 0) {
+            /* qhat was one too many, which is rare */
+            qhat--;
+            un[j + nv] += add_digits(un + j, nv, vn, nv);
+        }
+        q[j] = qhat;
+    }
+    for (i = 0; i < nv; i++) {
+        r[i] = ((unsigned long)un[i] >> shift |
+                (shift == 0 ? 0 :
+                    (unsigned long)un[i + 1] << (BIGNUM_DIGIT_BITS - shift))) &
+               BIGNUM_DIGIT_MASK;
+    }
+    free(un);
+    free(vn);
 }
 
-object *number_to_string_proc(object *arguments) {
-    char buffer[100];
-
-    sprintf(buffer, "%ld", (car(arguments))->data.fixnum.value);
-    return make_string(buffer);
+/* adds b, or subtracts it if is_subtraction, to a */
+object *add_integer_views(integer_view *a, integer_view *b,
+                          char is_subtraction) {
+    object *result;
+    integer_view *larger;
+    integer_view *smaller;
+    char b_is_negative;
+
+    b_is_negative = b->is_negative != is_subtraction;
+    if (a->is_negative == b_is_negative) {
+        larger = (a->length >= b->length) ? a : b;
+        smaller = (larger == a) ? b : a;
+        result = make_bignum(larger->length + 1, a->is_negative);
+        memcpy(result->data.bignum.digits, larger->digits,
+               larger->length * sizeof(bignum_digit));
+        result->data.bignum.digits[larger->length] = 0;
+        add_digits(result->data.bignum.digits, larger->length + 1,
+                   smaller->digits, smaller->length);
+        return normalize_bignum(result);
+    }
+    if (compare_digits(a->digits, a->length,
+                       b->digits, b->length) >= 0) {
+        larger = a;
+        smaller = b;
+        result = make_bignum(a->length, a->is_negative);
+    }
+    else {
+        larger = b;
+        smaller = a;
+        result = make_bignum(b->length, b_is_negative);
+    }
+    memcpy(result->data.bignum.digits, larger->digits,
+           larger->length * sizeof(bignum_digit));
+    subtract_digits(result->data.bignum.digits, larger->length,
+                    smaller->digits, smaller->length);
+    return normalize_bignum(result);
 }
 
-object *string_to_number_proc(object *arguments) {
-    return make_fixnum(atoi((car(arguments))->data.string.value));
-}
+object *add_integers(object *a, object *b) {
+    integer_view va;
+    integer_view vb;
+    long sum;
 
-object *symbol_to_string_proc(object *arguments) {
-    return make_string((car(arguments))->data.symbol.value);
+    if (is_fixnum(a) && is_fixnum(b) &&
+        !add_overflows(a->data.fixnum.value, b->data.fixnum.value, &sum)) {
+        return make_fixnum(sum);
+    }
+    view_integer(integer_argument(a), &va);
+    view_integer(integer_argument(b), &vb);
+    return add_integer_views(&va, &vb, 0);
 }
 
-object *string_to_symbol_proc(object *arguments) {
-    return make_symbol((car(arguments))->data.string.value);
-}
+object *subtract_integers(object *a, object *b) {
+    integer_view va;
+    integer_view vb;
+    long difference;
 
-object *add_proc(object *arguments) {
-    long result = 0;
-    
-    while (!is_the_empty_list(arguments)) {
-        result += (car(arguments))->data.fixnum.value;
-        arguments = cdr(arguments);
+    if (is_fixnum(a) && is_fixnum(b) &&
+        !sub_overflows(a->data.fixnum.value, b->data.fixnum.value,
+                       &difference)) {
+        return make_fixnum(difference);
     }
-    return make_fixnum(result);
+    view_integer(integer_argument(a), &va);
+    view_integer(integer_argument(b), &vb);
+    return add_integer_views(&va, &vb, 1);
 }
 
-object *sub_proc(object *arguments) {
-    long result;
-    
-    result = (car(arguments))->data.fixnum.value;
-    while (!is_the_empty_list(arguments = cdr(arguments))) {
-        result -= (car(arguments))->data.fixnum.value;
-    }
-    return make_fixnum(result);
-}
+object *multiply_integers(object *a, object *b) {
+    integer_view va;
+    integer_view vb;
+    object *result;
+    long product;
 
-object *mul_proc(object *arguments) {
-    long result = 1;
-    
-    while (!is_the_empty_list(arguments)) {
-        result *= (car(arguments))->data.fixnum.value;
-        arguments = cdr(arguments);
+    if (is_fixnum(a) && is_fixnum(b) &&
+        !mul_overflows(a->data.fixnum.value, b->data.fixnum.value,
+                       &product)) {
+        return make_fixnum(product);
     }
-    return make_fixnum(result);
-}
-
-object *quotient_proc(object *arguments) {
-    return make_fixnum(
-        ((car(arguments) )->data.fixnum.value)/
-        ((cadr(arguments))->data.fixnum.value));
-}
-
-object *remainder_proc(object *arguments) {
-    return make_fixnum(
-        ((car(arguments) )->data.fixnum.value)%
-        ((cadr(arguments))->data.fixnum.value));
-}
-
-object *is_number_equal_proc(object *arguments) {
-    long value;
-    
-    value = (car(arguments))->data.fixnum.value;
-    while (!is_the_empty_list(arguments = cdr(arguments))) {
-        if (value != ((car(arguments))->data.fixnum.value)) {
-            return false;
-        }
+    view_integer(integer_argument(a), &va);
+    view_integer(integer_argument(b), &vb);
+    if (va.length == 0 || vb.length == 0) {
+        return make_fixnum(0);
     }
-    return true;
-}
-
-object *is_less_than_proc(object *arguments) {
-    long previous;
-    long next;
-    
-    previous = (car(arguments))->data.fixnum.value;
-    while (!is_the_empty_list(arguments = cdr(arguments))) {
-        next = (car(arguments))->data.fixnum.value;
-        if (previous < next) {
-            previous = next;
+    result = make_bignum(va.length + vb.length,
+                         va.is_negative != vb.is_negative);
+    multiply_digits(va.digits, va.length, vb.digits, vb.length,
+                    result->data.bignum.digits);
+    return normalize_bignum(result);
+}
+
+/* truncates the quotient toward zero, so the remainder takes the
+ * sign of a; either result may be left out */
+void divide_integers(object *a, object *b,
+                     object **quotient, object **remainder) {
+    integer_view va;
+    integer_view vb;
+    object *q;
+    object *r;
+
+    if (is_fixnum(b) && b->data.fixnum.value == 0) {
+        fprintf(stderr_stream, "division by zero\n");
+        end_with_error();
+    }
+    if (is_fixnum(a) && is_fixnum(b) &&
+        !(a->data.fixnum.value == LONG_MIN &&
+          b->data.fixnum.value == -1)) {
+        if (quotient != NULL) {
+            *quotient = make_fixnum(a->data.fixnum.value /
+                                    b->data.fixnum.value);
         }
-        else {
-            return false;
+        if (remainder != NULL) {
+            *remainder = make_fixnum(a->data.fixnum.value %
+                                     b->data.fixnum.value);
         }
+        return;
     }
-    return true;
-}
-
-object *is_greater_than_proc(object *arguments) {
-    long previous;
-    long next;
-    
-    previous = (car(arguments))->data.fixnum.value;
-    while (!is_the_empty_list(arguments = cdr(arguments))) {
-        next = (car(arguments))->data.fixnum.value;
-        if (previous > next) {
-            previous = next;
+    view_integer(integer_argument(a), &va);
+    view_integer(integer_argument(b), &vb);
+    if (compare_digits(va.digits, va.length, vb.digits, vb.length) < 0) {
+        q = make_fixnum(0);
+        r = a;
+    }
+    else {
+        q = make_bignum(va.length - vb.length + 1,
+                        va.is_negative != vb.is_negative);
+        r = make_bignum(vb.length, va.is_negative);
+        if (vb.length == 1) {
+            memcpy(q->data.bignum.digits, va.digits,
+                   va.length * sizeof(bignum_digit));
+            q->data.bignum.length = va.length;
+            r->data.bignum.digits[0] =
+                divide_digits_short(q->data.bignum.digits, va.length,
+                                    vb.digits[0]);
         }
         else {
-            return false;
+            divide_digits(va.digits, va.length, vb.digits, vb.length,
+                          q->data.bignum.digits, r->data.bignum.digits);
         }
+        q = normalize_bignum(q);
+        r = normalize_bignum(r);
     }
-    return true;
-}
-
-object *cons_proc(object *arguments) {
-    return cons(car(arguments), cadr(arguments));
-}
-
-object *car_proc(object *arguments) {
-    return caar(arguments);
-}
-
-object *cdr_proc(object *arguments) {
-    return cdar(arguments);
-}
-
-object *set_car_proc(object *arguments) {
-    set_car(car(arguments), cadr(arguments));
-    return ok_symbol;
-}
-
-object *set_cdr_proc(object *arguments) {
-    set_cdr(car(arguments), cadr(arguments));
-    return ok_symbol;
-}
-
-object *list_proc(object *arguments) {
-    return arguments;
-}
-
-object *is_eq_proc(object *arguments) {
-    object *obj1;
-    object *obj2;
-    
-    obj1 = car(arguments);
-    obj2 = cadr(arguments);
-    
-    if (obj1->type != obj2->type) {
-        return false;
+    if (quotient != NULL) {
+        *quotient = q;
     }
-    switch (obj1->type) {
-        case FIXNUM:
-            return (obj1->data.fixnum.value == 
-                    obj2->data.fixnum.value) ?
-                        true : false;
-            break;
-        case CHARACTER:
-            return (obj1->data.character.value == 
-                    obj2->data.character.value) ?
-                        true : false;
-            break;
-        case STRING:
-            return (strcmp(obj1->data.string.value, 
-                           obj2->data.string.value) == 0) ?
-                        true : false;
-            break;
-        default:
-            return (obj1 == obj2) ? true : false;
+    if (remainder != NULL) {
+        *remainder = r;
     }
 }
 
-object *apply_proc(object *arguments) {
-    fprintf(stderr, "illegal state: The body of the apply "
-            "primitive procedure should not execute.\n");
-    exit(1);
-}
-
-object *interaction_environment_proc(object *arguments) {
-    return the_global_environment;
-}
-
-object *setup_environment(void);
+int compare_integers(object *a, object *b) {
+    integer_view va;
+    integer_view vb;
+    int order;
 
-object *null_environment_proc(object *arguments) {
-    return setup_environment();
+    if (is_fixnum(a) && is_fixnum(b)) {
+        return (a->data.fixnum.value < b->data.fixnum.value) ? -1 :
+               (a->data.fixnum.value > b->data.fixnum.value) ? 1 : 0;
+    }
+    view_integer(integer_argument(a), &va);
+    view_integer(integer_argument(b), &vb);
+    if (va.is_negative != vb.is_negative) {
+        return va.is_negative ? -1 : 1;
+    }
+    order = compare_digits(va.digits, va.length, vb.digits, vb.length);
+    return va.is_negative ? -order : order;
 }
 
-object *make_environment(void);
-
-object *environment_proc(object *arguments) {
-    return make_environment();
-}
+/* the decimal digits of an integer, in a malloc'd string */
+char *integer_to_string(object *obj) {
+    integer_view view;
+    bignum_digit *digits;
+    char *str;
+    char *p;
+    long length;
+    unsigned long chunk;
+    int i;
 
-object *eval_proc(object *arguments) {
-    fprintf(stderr, "illegal state: The body of the eval "
-            "primitive procedure should not execute.\n");
-    exit(1);
+    view_integer(obj, &view);
+    length = view.length;
+    /* each digit needs at most ten decimal digits for 32 bits */
+    str = check_alloc(malloc(length * (BIGNUM_DIGIT_BITS / 3 + 1) + 3));
+    digits = alloc_digits(length);
+    memcpy(digits, view.digits, length * sizeof(bignum_digit));
+    p = str + length * (BIGNUM_DIGIT_BITS / 3 + 1) + 2;
+    *p = '\0';
+    do {
+        chunk = divide_digits_short(digits, length, BIGNUM_DECIMAL_BASE);
+        while (length > 0 && digits[length - 1] == 0) {
+            length--;
+        }
+        for (i = 0; i < BIGNUM_DECIMAL_DIGITS &&
+                    (length > 0 || chunk != 0 || i == 0); i++) {
+            *--p = '0' + chunk % 10;
+            chunk /= 10;
+        }
+    } while (length > 0);
+    if (view.is_negative) {
+        *--p = '-';
+    }
+    free(digits);
+    memmove(str, p, strlen(p) + 1);
+    return str;
 }
 
-object *read(FILE *in);
-object *eval(object *exp, object *env);
-
-object *load_proc(object *arguments) {
-    char *filename;
-    FILE *in;
-    object *exp;
+/* the integer written in decimal, with an optional sign, in the
+ * length characters of str, or NULL if that is not what they are */
+object *string_to_integer(char *str, size_t length) {
     object *result;
-    
-    filename = car(arguments)->data.string.value;
-    in = fopen(filename, "r");
-    if (in == NULL) {
-        fprintf(stderr, "could not load file \"%s\"", filename);
-        exit(1);
+    bignum_digit *digits;
+    char is_negative;
+    unsigned long chunk;
+    unsigned long scale;
+    unsigned long carry;
+    long count;
+    long i;
+    size_t start;
+
+    is_negative = 0;
+    start = 0;
+    if (length > 0 && (str[0] == '-' || str[0] == '+')) {
+        is_negative = str[0] == '-';
+        start = 1;
     }
-    while ((exp = read(in)) != NULL) {
-        result = eval(exp, the_global_environment);
+    if (start == length) {
+        return NULL;
     }
-    fclose(in);
-    return result;
+    for (i = start; i < (long)length; i++) {
+        if (!isdigit((unsigned char)str[i])) {
+            return NULL;
+        }
+    }
+    /* enough digits for every decimal digit to take four bits */
+    result = make_bignum((length * 4) / BIGNUM_DIGIT_BITS + 2,
+                         is_negative);
+    digits = result->data.bignum.digits;
+    count = 0;
+    while (start < length) {
+        chunk = 0;
+        scale = 1;
+        for (i = 0; i < BIGNUM_DECIMAL_DIGITS && start < length; i++) {
+            chunk = chunk * 10 + (str[start++] - '0');
+            scale *= 10;
+        }
+        carry = chunk;
+        for (i = 0; i < count; i++) {
+            carry += (unsigned long)digits[i] * scale;
+            digits[i] = carry & BIGNUM_DIGIT_MASK;
+            carry >>= BIGNUM_DIGIT_BITS;
+        }
+        if (carry != 0) {
+            digits[count++] = carry;
+        }
+    }
+    result->data.bignum.length = count;
+    return normalize_bignum(result);
 }
 
-object *make_input_port(FILE *in);
+/* There are only 256 characters, so all are made once by init.
+ * Lookups are then safe from a load's reading thread. */
+object *characters[256];
 
-object *open_input_port_proc(object *arguments) {
-    char *filename;
-    FILE *in;
+void init_characters(void) {
+    object *obj;
+    int i;
 
-    filename = car(arguments)->data.string.value;
-    in = fopen(filename, "r");
-    if (in == NULL) {
-        fprintf(stderr, "could not open file \"%s\"\n", filename);
-        exit(1);
+    for (i = 0; i < 256; i++) {
+        obj = alloc_object();
+        obj->type = CHARACTER;
+        obj->data.character.value = (char)i;
+        characters[i] = obj;
     }
-    return make_input_port(in);
 }
 
-object *close_input_port_proc(object *arguments) {
-    int result;
-    
-    result = fclose(car(arguments)->data.input_port.stream);
-    if (result == EOF) {
-        fprintf(stderr, "could not close input port\n");
-        exit(1);
-    }
-    return ok_symbol;
+object *make_character(char value) {
+    return characters[(unsigned char)value];
 }
 
-char is_input_port(object *obj);
-
-object *is_input_port_proc(object *arguments) {
-    return is_input_port(car(arguments)) ? true : false;
+char is_character(object *obj) {
+    return obj->type == CHARACTER;
 }
 
-object *read_proc(object *arguments) {
-    FILE *in;
-    object *result;
-    
-    in = is_the_empty_list(arguments) ?
-             stdin :
-             car(arguments)->data.input_port.stream;
-    result = read(in);
-    return (result == NULL) ? eof_object : result;
-}
+/* leaves the characters to be filled in if chars is NULL */
+object *make_string_of_length(char *chars, size_t length) {
+    object *obj;
 
-object *read_char_proc(object *arguments) {
-    FILE *in;
-    int result;
-    
-    in = is_the_empty_list(arguments) ?
-             stdin :
-             car(arguments)->data.input_port.stream;
-    result = getc(in);
-    return (result == EOF) ? eof_object : make_character(result);
+    obj = alloc_object();
+    obj->type = STRING;
+    obj->data.string.value = check_alloc(malloc(length + 1));
+    if (chars != NULL) {
+        memcpy(obj->data.string.value, chars, length);
+    }
+    obj->data.string.value[length] = '\0';
+    obj->data.string.length = length;
+    obj->data.string.hash = 0;
+    return obj;
 }
 
-int peek(FILE *in);
-
-object *peek_char_proc(object *arguments) {
-    FILE *in;
-    int result;
-    
-    in = is_the_empty_list(arguments) ?
-             stdin :
-             car(arguments)->data.input_port.stream;
-    result = peek(in);
-    return (result == EOF) ? eof_object : make_character(result);
+object *make_string(char *value) {
+    return make_string_of_length(value, strlen(value));
 }
 
-char is_eof_object(object *obj);
-
-object *is_eof_object_proc(object *arguments) {
-    return is_eof_object(car(arguments)) ? true : false;
+char is_string(object *obj) {
+    return obj->type == STRING;
 }
 
-object *make_output_port(FILE *in);
-
-object *open_output_port_proc(object *arguments) {
-    char *filename;
-    FILE *out;
+object *make_vector(long length, object *fill) {
+    object *obj;
+    long i;
 
-    filename = car(arguments)->data.string.value;
-    out = fopen(filename, "w");
-    if (out == NULL) {
-        fprintf(stderr, "could not open file \"%s\"\n", filename);
-        exit(1);
+    obj = alloc_object();
+    obj->type = VECTOR;
+    obj->data.vector.length = length;
+    obj->data.vector.elements =
+        check_alloc(malloc((length > 0 ? length : 1) * sizeof(object *)));
+    for (i = 0; i < length; i++) {
+        obj->data.vector.elements[i] = fill;
     }
-    return make_output_port(out);
+    return obj;
 }
 
-object *close_output_port_proc(object *arguments) {
-    int result;
-    
-    result = fclose(car(arguments)->data.output_port.stream);
-    if (result == EOF) {
-        fprintf(stderr, "could not close output port\n");
-        exit(1);
-    }
-    return ok_symbol;
+char is_vector(object *obj) {
+    return obj->type == VECTOR;
 }
 
-char is_output_port(object *obj);
+object *make_record_type(object *name, long field_count) {
+    object *obj;
 
-object *is_output_port_proc(object *arguments) {
-    return is_output_port(car(arguments)) ? true : false;
+    obj = alloc_object();
+    obj->type = RECORD_TYPE;
+    obj->data.record_type.name = name;
+    obj->data.record_type.field_count = field_count;
+    return obj;
 }
 
-object *write_char_proc(object *arguments) {
-    object *character;
-    FILE *out;
-    
-    character = car(arguments);
-    arguments = cdr(arguments);
-    out = is_the_empty_list(arguments) ?
-             stdout :
-             car(arguments)->data.output_port.stream;
-    putc(character->data.character.value, out);    
-    fflush(out);
-    return ok_symbol;
+char is_record_type(object *obj) {
+    return obj->type == RECORD_TYPE;
 }
 
-void write(FILE *out, object *obj);
+/* the slots are allocated with the object, so a record is one block */
+object *make_record(object *type) {
+    object *obj;
 
-object *write_proc(object *arguments) {
-    object *exp;
-    FILE *out;
-    
-    exp = car(arguments);
-    arguments = cdr(arguments);
-    out = is_the_empty_list(arguments) ?
-             stdout :
-             car(arguments)->data.output_port.stream;
-    write(out, exp);
-    fflush(out);
-    return ok_symbol;
+    obj = check_alloc(malloc(sizeof(object) +
+                             type->data.record_type.field_count *
+                                 sizeof(object *)));
+    obj->mark = 0;
+    obj->type = RECORD;
+    obj->data.record.type = type;
+    obj->data.record.slots = (object **)(obj + 1);
+    return obj;
 }
 
-object *error_proc(object *arguments) {
-    while (!is_the_empty_list(arguments)) {
-        write(stderr, car(arguments));
-        fprintf(stderr, " ");
-        arguments = cdr(arguments);
-    };
-    printf("\nexiting\n");
-    exit(1);
+char is_record(object *obj) {
+    return obj->type == RECORD;
 }
 
-object *make_compound_proc(object *parameters, object *body,
-                           object* env) {
+object *make_bytevector(long length) {
     object *obj;
-    
+
     obj = alloc_object();
-    obj->type = COMPOUND_PROC;
-    obj->data.compound_proc.parameters = parameters;
-    obj->data.compound_proc.body = body;
-    obj->data.compound_proc.env = env;
+    obj->type = BYTEVECTOR;
+    obj->data.bytevector.length = length;
+    obj->data.bytevector.bytes =
+        check_alloc(malloc(length > 0 ? length : 1));
     return obj;
 }
 
-char is_compound_proc(object *obj) {
-    return obj->type == COMPOUND_PROC;
+char is_bytevector(object *obj) {
+    return obj->type == BYTEVECTOR;
 }
 
-object *make_input_port(FILE *stream) {
+object *make_s64vector(long length) {
     object *obj;
-    
+
     obj = alloc_object();
-    obj->type = INPUT_PORT;
-    obj->data.input_port.stream = stream;
+    obj->type = S64VECTOR;
+    obj->data.s64vector.length = length;
+    obj->data.s64vector.elements =
+        check_alloc(malloc((length > 0 ? length : 1) * sizeof(long)));
     return obj;
 }
 
-char is_input_port(object *obj) {
-    return obj->type == INPUT_PORT;
+char is_s64vector(object *obj) {
+    return obj->type == S64VECTOR;
 }
 
-object *make_output_port(FILE *stream) {
+object *cons(object *car, object *cdr) {
     object *obj;
     
     obj = alloc_object();
-    obj->type = OUTPUT_PORT;
-    obj->data.output_port.stream = stream;
+    obj->type = PAIR;
+    obj->data.pair.car = car;
+    obj->data.pair.cdr = cdr;
+    obj->data.pair.annotation = NULL;
     return obj;
 }
 
-char is_output_port(object *obj) {
-    return obj->type == OUTPUT_PORT;
+/* a list of length fresh pairs, all of them taken from one block,
+ * with the empty list for each car */
+object *make_list_block(unsigned long length) {
+    object *block;
+    unsigned long i;
+    
+    block = check_alloc(malloc(length * sizeof(object)));
+    for (i = 0; i < length; i++) {
+        block[i].type = PAIR;
+        block[i].mark = 0;
+        block[i].data.pair.car = the_empty_list;
+        block[i].data.pair.cdr = (i + 1 < length) ? &block[i + 1] :
+                                                    the_empty_list;
+        block[i].data.pair.annotation = NULL;
+    }
+    return block;
 }
 
-char is_eof_object(object *obj) {
-    return obj == eof_object;
+object *region_cons(object *car, object *cdr) {
+    object *obj;
+    
+    obj = alloc_region_object();
+    obj->type = PAIR;
+    obj->data.pair.car = car;
+    obj->data.pair.cdr = cdr;
+    obj->data.pair.annotation = NULL;
+    return obj;
 }
 
-object *enclosing_environment(object *env) {
-    return cdr(env);
+char is_pair(object *obj) {
+    return obj->type == PAIR;
 }
 
-object *first_frame(object *env) {
-    return car(env);
+object *car(object *pair) {
+    return pair->data.pair.car;
 }
 
-object *make_frame(object *variables, object *values) {
-    return cons(variables, values);
+void set_car(object *obj, object* value) {
+    obj->data.pair.car = value;
 }
 
-object *frame_variables(object *frame) {
-    return car(frame);
+object *cdr(object *pair) {
+    return pair->data.pair.cdr;
 }
 
-object *frame_values(object *frame) {
-    return cdr(frame);
+void set_cdr(object *obj, object* value) {
+    obj->data.pair.cdr = value;
 }
 
-void add_binding_to_frame(object *var, object *val, 
-                          object *frame) {
-    set_car(frame, cons(var, car(frame)));
-    set_cdr(frame, cons(val, cdr(frame)));
+#define caar(obj)   car(car(obj))
+#define cadr(obj)   car(cdr(obj))
+#define cdar(obj)   cdr(car(obj))
+#define cddr(obj)   cdr(cdr(obj))
+#define caaar(obj)  car(car(car(obj)))
+#define caadr(obj)  car(car(cdr(obj)))
+#define cadar(obj)  car(cdr(car(obj)))
+#define caddr(obj)  car(cdr(cdr(obj)))
+#define cdaar(obj)  cdr(car(car(obj)))
+#define cdadr(obj)  cdr(car(cdr(obj)))
+#define cddar(obj)  cdr(cdr(car(obj)))
+#define cdddr(obj)  cdr(cdr(cdr(obj)))
+#define caaaar(obj) car(car(car(car(obj))))
+#define caaadr(obj) car(car(car(cdr(obj))))
+#define caadar(obj) car(car(cdr(car(obj))))
+#define caaddr(obj) car(car(cdr(cdr(obj))))
+#define cadaar(obj) car(cdr(car(car(obj))))
+#define cadadr(obj) car(cdr(car(cdr(obj))))
+#define caddar(obj) car(cdr(cdr(car(obj))))
+#define cadddr(obj) car(cdr(cdr(cdr(obj))))
+#define cdaaar(obj) cdr(car(car(car(obj))))
+#define cdaadr(obj) cdr(car(car(cdr(obj))))
+#define cdadar(obj) cdr(car(cdr(car(obj))))
+#define cdaddr(obj) cdr(car(cdr(cdr(obj))))
+#define cddaar(obj) cdr(cdr(car(car(obj))))
+#define cddadr(obj) cdr(cdr(car(cdr(obj))))
+#define cdddar(obj) cdr(cdr(cdr(car(obj))))
+#define cddddr(obj) cdr(cdr(cdr(cdr(obj))))
+
+/* Hash tables use open addressing with linear probing. An entry
+ * whose key is NULL has never been used. Deleting an entry only
+ * takes its value, so probes for other keys carry on past it until
+ * the table is next rebuilt. Entries keep their hash for that. */
+typedef struct hash_entry {
+    object *key;
+    object *value;          /* NULL once deleted */
+    unsigned long hash;
+} hash_entry;
+
+typedef struct hash_table {
+    hash_entry *entries;
+    unsigned long size;     /* a power of two */
+    unsigned long count;    /* of entries with values */
+    unsigned long used;     /* of entries with keys */
+    char is_equal;          /* compares keys with equal? not eq? */
+} hash_table;
+
+unsigned long mix_hash(unsigned long hash) {
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bUL;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+unsigned long hash_string(object *obj) {
+    if (obj->data.string.hash == 0) {
+        obj->data.string.hash = hash_symbol_name(obj->data.string.value) | 1;
+    }
+    return obj->data.string.hash;
 }
 
-object *extend_environment(object *vars, object *vals,
-                           object *base_env) {
-    return cons(make_frame(vars, vals), base_env);
+unsigned long hash_bignum(object *obj) {
+    unsigned long hash;
+    long i;
+
+    hash = obj->data.bignum.is_negative;
+    for (i = 0; i < obj->data.bignum.length; i++) {
+        hash = hash * 31 + obj->data.bignum.digits[i];
+    }
+    return mix_hash(hash);
 }
 
-object *lookup_variable_value(object *var, object *env) {
-    object *frame;
-    object *vars;
-    object *vals;
-    while (!is_the_empty_list(env)) {
-        frame = first_frame(env);
-        vars = frame_variables(frame);
-        vals = frame_values(frame);
-        while (!is_the_empty_list(vars)) {
-            if (var == car(vars)) {
-                return car(vals);
-            }
-            vars = cdr(vars);
-            vals = cdr(vals);
-        }
-        env = enclosing_environment(env);
+/* eq? compares numbers, characters and strings by value, so they
+ * hash by value too */
+unsigned long hash_eq(object *obj) {
+    switch (obj->type) {
+        case FIXNUM:
+            return mix_hash(obj->data.fixnum.value);
+        case BIGNUM:
+            return hash_bignum(obj);
+        case CHARACTER:
+            return mix_hash((unsigned char)obj->data.character.value);
+        case STRING:
+            return hash_string(obj);
+        case SYMBOL:
+            return obj->data.symbol.hash;
+        default:
+            return mix_hash((unsigned long)obj);
     }
-    fprintf(stderr, "unbound variable, %s\n", var->data.symbol.value);
-    exit(1);
 }
 
-void set_variable_value(object *var, object *val, object *env) {
-    object *frame;
-    object *vars;
-    object *vals;
+/* Hashes no more than the first HASH_EQUAL_BUDGET objects in the
+ * structure, which keeps deep and cyclic keys cheap. */
+#define HASH_EQUAL_BUDGET 64
 
-    while (!is_the_empty_list(env)) {
-        frame = first_frame(env);
-        vars = frame_variables(frame);
-        vals = frame_values(frame);
-        while (!is_the_empty_list(vars)) {
-            if (var == car(vars)) {
-                set_car(vals, val);
-                return;
+unsigned long hash_equal(object *obj, int *budget) {
+    unsigned long hash;
+    long i;
+    
+    hash = obj->type;
+    while (--*budget > 0) {
+        if (is_pair(obj)) {
+            hash = hash * 31 + hash_equal(car(obj), budget);
+            obj = cdr(obj);
+        }
+        else if (is_vector(obj)) {
+            hash = hash * 31 + obj->data.vector.length;
+            for (i = 0; i < obj->data.vector.length && *budget > 0; i++) {
+                hash = hash * 31 +
+                       hash_equal(obj->data.vector.elements[i], budget);
             }
-            vars = cdr(vars);
-            vals = cdr(vals);
+            break;
+        }
+        else if (is_bytevector(obj)) {
+            for (i = 0; i < obj->data.bytevector.length; i++) {
+                hash = hash * 31 + obj->data.bytevector.bytes[i];
+            }
+            break;
+        }
+        else if (is_s64vector(obj)) {
+            for (i = 0; i < obj->data.s64vector.length; i++) {
+                hash = hash * 31 + obj->data.s64vector.elements[i];
+            }
+            break;
+        }
+        else {
+            hash = hash * 31 + hash_eq(obj);
+            break;
         }
-        env = enclosing_environment(env);
     }
-    fprintf(stderr, "unbound variable, %s\n", var->data.symbol.value);
-    exit(1);
+    return mix_hash(hash);
 }
 
-void define_variable(object *var, object *val, object *env) {
-    object *frame;
-    object *vars;
-    object *vals;
-    
-    frame = first_frame(env);    
-    vars = frame_variables(frame);
-    vals = frame_values(frame);
+char is_eq(object *obj1, object *obj2) {
+    if (obj1 == obj2) {
+        return 1;
+    }
+    if (obj1->type != obj2->type) {
+        return 0;
+    }
+    switch (obj1->type) {
+        case FIXNUM:
+            return obj1->data.fixnum.value == obj2->data.fixnum.value;
+        case BIGNUM:
+            return compare_integers(obj1, obj2) == 0;
+        case CHARACTER:
+            return obj1->data.character.value ==
+                   obj2->data.character.value;
+        case STRING:
+            /* strings hashed already for a table may differ there */
+            if (obj1->data.string.hash != 0 &&
+                obj2->data.string.hash != 0 &&
+                obj1->data.string.hash != obj2->data.string.hash) {
+                return 0;
+            }
+            return obj1->data.string.length == obj2->data.string.length &&
+                   memcmp(obj1->data.string.value, obj2->data.string.value,
+                          obj1->data.string.length) == 0;
+        default:
+            return 0;
+    }
+}
 
-    while (!is_the_empty_list(vars)) {
-        if (var == car(vars)) {
-            set_car(vals, val);
-            return;
+/* memcmp is vectorized in the C library, so it does the bulk
+ * compare */
+char is_bytevector_equal(object *obj1, object *obj2) {
+    return obj1->data.bytevector.length == obj2->data.bytevector.length &&
+           memcmp(obj1->data.bytevector.bytes, obj2->data.bytevector.bytes,
+                  obj1->data.bytevector.length) == 0;
+}
+
+char is_equal(object *obj1, object *obj2) {
+    long i;
+    
+    while (!is_eq(obj1, obj2)) {
+        if (is_pair(obj1) && is_pair(obj2)) {
+            if (!is_equal(car(obj1), car(obj2))) {
+                return 0;
+            }
+            obj1 = cdr(obj1);
+            obj2 = cdr(obj2);
+        }
+        else if (is_vector(obj1) && is_vector(obj2) &&
+                 obj1->data.vector.length == obj2->data.vector.length) {
+            for (i = 0; i < obj1->data.vector.length; i++) {
+                if (!is_equal(obj1->data.vector.elements[i],
+                              obj2->data.vector.elements[i])) {
+                    return 0;
+                }
+            }
+            return 1;
+        }
+        else if (is_bytevector(obj1) && is_bytevector(obj2)) {
+            return is_bytevector_equal(obj1, obj2);
+        }
+        else if (is_s64vector(obj1) && is_s64vector(obj2)) {
+            return obj1->data.s64vector.length ==
+                       obj2->data.s64vector.length &&
+                   memcmp(obj1->data.s64vector.elements,
+                          obj2->data.s64vector.elements,
+                          obj1->data.s64vector.length * sizeof(long)) == 0;
+        }
+        else {
+            return 0;
         }
-        vars = cdr(vars);
-        vals = cdr(vals);
     }
-    add_binding_to_frame(var, val, frame);
+    return 1;
 }
 
-object *setup_environment(void) {
-    object *initial_env;
+hash_entry *alloc_hash_entries(unsigned long size) {
+    hash_entry *entries;
+    unsigned long i;
     
-    initial_env = extend_environment(
-                      the_empty_list,
-                      the_empty_list,
-                      the_empty_environment);
-    return initial_env;
+    entries = check_alloc(malloc(size * sizeof(hash_entry)));
+    for (i = 0; i < size; i++) {
+        entries[i].key = NULL;
+    }
+    return entries;
 }
 
-void populate_environment(object *env) {
+object *make_hash_table(char is_equal) {
+    object *obj;
+    hash_table *table;
+    
+    table = check_alloc(malloc(sizeof(hash_table)));
+    table->size = 16;
+    table->entries = alloc_hash_entries(table->size);
+    table->count = 0;
+    table->used = 0;
+    table->is_equal = is_equal;
+    obj = alloc_object();
+    obj->type = HASH_TABLE;
+    obj->data.hash_table.table = table;
+    return obj;
+}
 
-#define add_procedure(scheme_name, c_name)              \
-    define_variable(make_symbol(scheme_name),           \
-                    make_primitive_proc(c_name),        \
-                    env);
+char is_hash_table(object *obj) {
+    return obj->type == HASH_TABLE;
+}
 
-    add_procedure("null?"      , is_null_proc);
-    add_procedure("boolean?"   , is_boolean_proc);
-    add_procedure("symbol?"    , is_symbol_proc);
-    add_procedure("integer?"   , is_integer_proc);
-    add_procedure("char?"      , is_char_proc);
-    add_procedure("string?"    , is_string_proc);
-    add_procedure("pair?"      , is_pair_proc);
-    add_procedure("procedure?" , is_procedure_proc);
+unsigned long hash_key(hash_table *table, object *key) {
+    int budget;
     
-    add_procedure("char->integer" , char_to_integer_proc);
-    add_procedure("integer->char" , integer_to_char_proc);
-    add_procedure("number->string", number_to_string_proc);
-    add_procedure("string->number", string_to_number_proc);
-    add_procedure("symbol->string", symbol_to_string_proc);
-    add_procedure("string->symbol", string_to_symbol_proc);
-      
-    add_procedure("+"        , add_proc);
-    add_procedure("-"        , sub_proc);
-    add_procedure("*"        , mul_proc);
-    add_procedure("quotient" , quotient_proc);
-    add_procedure("remainder", remainder_proc);
-    add_procedure("="        , is_number_equal_proc);
-    add_procedure("<"        , is_less_than_proc);
-    add_procedure(">"        , is_greater_than_proc);
-
-    add_procedure("cons"    , cons_proc);
-    add_procedure("car"     , car_proc);
-    add_procedure("cdr"     , cdr_proc);
-    add_procedure("set-car!", set_car_proc);
-    add_procedure("set-cdr!", set_cdr_proc);
-    add_procedure("list"    , list_proc);
+    if (table->is_equal) {
+        budget = HASH_EQUAL_BUDGET;
+        return hash_equal(key, &budget);
+    }
+    return hash_eq(key);
+}
 
-    add_procedure("eq?", is_eq_proc);
+/* the entry holding key, or the unused entry where it would go */
+hash_entry *find_hash_entry(hash_table *table, object *key,
+                            unsigned long hash) {
+    hash_entry *entry;
+    unsigned long i;
+    
+    i = hash & (table->size - 1);
+    while (1) {
+        entry = &table->entries[i];
+        if (entry->key == NULL) {
+            return entry;
+        }
+        if (entry->hash == hash &&
+            (table->is_equal ? is_equal(entry->key, key) :
+                               is_eq(entry->key, key))) {
+            return entry;
+        }
+        i = (i + 1) & (table->size - 1);
+    }
+}
 
-    add_procedure("apply", apply_proc);
+/* rebuilds the table with room for twice its live entries, which
+ * drops the deleted ones */
+void rebuild_hash_table(hash_table *table) {
+    hash_entry *old;
+    hash_entry *entry;
+    unsigned long old_size;
+    unsigned long i;
     
-    add_procedure("interaction-environment", 
-                                     interaction_environment_proc);
-    add_procedure("null-environment", null_environment_proc);
-    add_procedure("environment"     , environment_proc);
-    add_procedure("eval"            , eval_proc);
+    old = table->entries;
+    old_size = table->size;
+    table->size = 16;
+    while (table->size < 4 * (table->count + 1)) {
+        table->size *= 2;
+    }
+    table->entries = alloc_hash_entries(table->size);
+    table->used = table->count;
+    for (i = 0; i < old_size; i++) {
+        if (old[i].key != NULL && old[i].value != NULL) {
+            entry = &table->entries[old[i].hash & (table->size - 1)];
+            while (entry->key != NULL) {
+                entry = (entry == &table->entries[table->size - 1]) ?
+                            table->entries : entry + 1;
+            }
+            *entry = old[i];
+        }
+    }
+    free(old);
+}
 
-    add_procedure("load"             , load_proc);
-    add_procedure("open-input-port"  , open_input_port_proc);
-    add_procedure("close-input-port" , close_input_port_proc);
-    add_procedure("input-port?"      , is_input_port_proc);
-    add_procedure("read"             , read_proc);
-    add_procedure("read-char"        , read_char_proc);
-    add_procedure("peek-char"        , peek_char_proc);
-    add_procedure("eof-object?"      , is_eof_object_proc);
-    add_procedure("open-output-port" , open_output_port_proc);
-    add_procedure("close-output-port", close_output_port_proc);
-    add_procedure("output-port?"     , is_output_port_proc);
-    add_procedure("write-char"       , write_char_proc);
-    add_procedure("write"            , write_proc);
+object *hash_table_ref(hash_table *table, object *key) {
+    hash_entry *entry;
+    
+    entry = find_hash_entry(table, key, hash_key(table, key));
+    return (entry->key == NULL) ? NULL : entry->value;
+}
 
-    add_procedure("error", error_proc);
+void hash_table_set(hash_table *table, object *key, object *value) {
+    hash_entry *entry;
+    unsigned long hash;
+    
+    hash = hash_key(table, key);
+    entry = find_hash_entry(table, key, hash);
+    if (entry->key == NULL) {
+        if (4 * (table->used + 1) > 3 * table->size) {
+            rebuild_hash_table(table);
+            entry = find_hash_entry(table, key, hash);
+        }
+        entry->key = key;
+        entry->hash = hash;
+        entry->value = NULL;
+        table->used++;
+    }
+    if (entry->value == NULL) {
+        table->count++;
+    }
+    entry->value = value;
 }
 
-object *make_environment(void) {
-    object *env;
+void hash_table_delete(hash_table *table, object *key) {
+    hash_entry *entry;
     
-    env = setup_environment();
-    populate_environment(env);
-    return env;
+    entry = find_hash_entry(table, key, hash_key(table, key));
+    if (entry->key != NULL && entry->value != NULL) {
+        entry->value = NULL;
+        table->count--;
+    }
 }
 
-void init(void) {
-    the_empty_list = alloc_object();
-    the_empty_list->type = THE_EMPTY_LIST;
+/* A promise keeps its thunk until forced and its value after. The
+ * thunk of delay-force gives another promise to be forced in its
+ * place. */
+typedef struct promise_box {
+    char is_done;
+    char is_chained; /* from delay-force */
+    struct object *value; /* or the thunk, until done */
+} promise_box;
 
-    false = alloc_object();
-    false->type = BOOLEAN;
-    false->data.boolean.value = 0;
+object *make_promise(object *value, char is_done, char is_chained) {
+    object *obj;
+    promise_box *box;
 
-    true = alloc_object();
-    true->type = BOOLEAN;
-    true->data.boolean.value = 1;
-    
-    symbol_table = the_empty_list;
-    quote_symbol = make_symbol("quote");
-    define_symbol = make_symbol("define");
-    set_symbol = make_symbol("set!");
-    ok_symbol = make_symbol("ok");
+    box = check_alloc(malloc(sizeof(promise_box)));
+    box->is_done = is_done;
+    box->is_chained = is_chained;
+    box->value = value;
+    obj = alloc_object();
+    obj->type = PROMISE;
+    obj->data.promise.box = box;
+    return obj;
+}
+
+char is_promise(object *obj) {
+    return obj->type == PROMISE;
+}
+
+object *make_primitive_proc(
+           object *(*fn)(struct object *arguments)) {
+    object *obj;
+
+    obj = alloc_object();
+    obj->type = PRIMITIVE_PROC;
+    obj->data.primitive_proc.fn = fn;
+    return obj;
+}
+
+char is_primitive_proc(object *obj) {
+    return obj->type == PRIMITIVE_PROC;
+}
+
+object *is_null_proc(object *arguments) {
+    return is_the_empty_list(car(arguments)) ? true : false;
+}
+
+object *is_boolean_proc(object *arguments) {
+    return is_boolean(car(arguments)) ? true : false;
+}
+
+object *is_symbol_proc(object *arguments) {
+    return is_symbol(car(arguments)) ? true : false;
+}
+
+object *is_integer_proc(object *arguments) {
+    return is_integer(car(arguments)) ? true : false;
+}
+
+object *is_fixnum_proc(object *arguments) {
+    return is_fixnum(car(arguments)) ? true : false;
+}
+
+object *is_char_proc(object *arguments) {
+    return is_character(car(arguments)) ? true : false;
+}
+
+object *is_string_proc(object *arguments) {
+    return is_string(car(arguments)) ? true : false;
+}
+
+object *is_pair_proc(object *arguments) {
+    return is_pair(car(arguments)) ? true : false;
+}
+
+char is_compound_proc(object *obj);
+
+object *is_procedure_proc(object *arguments) {
+    object *obj;
+    
+    obj = car(arguments);
+    return (is_primitive_proc(obj) ||
+            is_compound_proc(obj)) ?
+                true :
+                false;
+}
+
+object *char_to_integer_proc(object *arguments) {
+    return make_fixnum((car(arguments))->data.character.value);
+}
+
+object *integer_to_char_proc(object *arguments) {
+    return make_character((car(arguments))->data.fixnum.value);
+}
+
+object *number_to_string_proc(object *arguments) {
+    object *obj;
+    char *str;
+
+    str = integer_to_string(integer_argument(car(arguments)));
+    obj = make_string(str);
+    free(str);
+    return obj;
+}
+
+object *string_to_number_proc(object *arguments) {
+    object *str;
+    object *obj;
+
+    str = car(arguments);
+    obj = string_to_integer(str->data.string.value,
+                            strlen(str->data.string.value));
+    return (obj == NULL) ? false : obj;
+}
+
+object *symbol_to_string_proc(object *arguments) {
+    return make_string((car(arguments))->data.symbol.value);
+}
+
+object *string_to_symbol_proc(object *arguments) {
+    return make_symbol((car(arguments))->data.string.value);
+}
+
+long fixnum_argument(object *obj) {
+    if (!is_fixnum(obj)) {
+        fprintf(stderr_stream, "integer expected\n");
+        end_with_error();
+    }
+    return obj->data.fixnum.value;
+}
+
+/* The arithmetic keeps to longs until a result overflows or an
+ * argument is a bignum, and goes on with the general integers from
+ * there. */
+object *add_proc(object *arguments) {
+    object *result;
+    long sum = 0;
+    long next;
+    
+    while (!is_the_empty_list(arguments)) {
+        if (!is_fixnum(car(arguments)) ||
+            add_overflows(sum, car(arguments)->data.fixnum.value, &next)) {
+            break;
+        }
+        sum = next;
+        arguments = cdr(arguments);
+    }
+    result = make_fixnum(sum);
+    while (!is_the_empty_list(arguments)) {
+        result = add_integers(result, car(arguments));
+        arguments = cdr(arguments);
+    }
+    return result;
+}
+
+object *sub_proc(object *arguments) {
+    object *result;
+    long difference;
+    long next;
+    
+    result = integer_argument(car(arguments));
+    if (is_the_empty_list(cdr(arguments))) {
+        return subtract_integers(make_fixnum(0), result);
+    }
+    if (is_fixnum(result)) {
+        difference = result->data.fixnum.value;
+        while (!is_the_empty_list(arguments = cdr(arguments))) {
+            if (!is_fixnum(car(arguments)) ||
+                sub_overflows(difference, car(arguments)->data.fixnum.value,
+                              &next)) {
+                break;
+            }
+            difference = next;
+        }
+        if (is_the_empty_list(arguments)) {
+            return make_fixnum(difference);
+        }
+        result = subtract_integers(make_fixnum(difference), car(arguments));
+    }
+    while (!is_the_empty_list(arguments = cdr(arguments))) {
+        result = subtract_integers(result, car(arguments));
+    }
+    return result;
+}
+
+object *mul_proc(object *arguments) {
+    object *result;
+    long product = 1;
+    long next;
+    
+    while (!is_the_empty_list(arguments)) {
+        if (!is_fixnum(car(arguments)) ||
+            mul_overflows(product, car(arguments)->data.fixnum.value,
+                          &next)) {
+            break;
+        }
+        product = next;
+        arguments = cdr(arguments);
+    }
+    result = make_fixnum(product);
+    while (!is_the_empty_list(arguments)) {
+        result = multiply_integers(result, car(arguments));
+        arguments = cdr(arguments);
+    }
+    return result;
+}
+
+object *quotient_proc(object *arguments) {
+    object *quotient;
+
+    divide_integers(car(arguments), cadr(arguments), &quotient, NULL);
+    return quotient;
+}
+
+object *remainder_proc(object *arguments) {
+    object *remainder;
+
+    divide_integers(car(arguments), cadr(arguments), NULL, &remainder);
+    return remainder;
+}
+
+object *is_number_equal_proc(object *arguments) {
+    object *value;
+    
+    value = integer_argument(car(arguments));
+    while (!is_the_empty_list(arguments = cdr(arguments))) {
+        if (compare_integers(value, car(arguments)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+object *is_less_than_proc(object *arguments) {
+    object *previous;
+    object *next;
+    
+    previous = integer_argument(car(arguments));
+    while (!is_the_empty_list(arguments = cdr(arguments))) {
+        next = car(arguments);
+        if (compare_integers(previous, next) < 0) {
+            previous = next;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+object *is_greater_than_proc(object *arguments) {
+    object *previous;
+    object *next;
+    
+    previous = integer_argument(car(arguments));
+    while (!is_the_empty_list(arguments = cdr(arguments))) {
+        next = car(arguments);
+        if (compare_integers(previous, next) > 0) {
+            previous = next;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+object *cons_proc(object *arguments) {
+    return cons(car(arguments), cadr(arguments));
+}
+
+object *car_proc(object *arguments) {
+    return caar(arguments);
+}
+
+object *cdr_proc(object *arguments) {
+    return cdar(arguments);
+}
+
+object *set_car_proc(object *arguments) {
+    set_car(car(arguments), cadr(arguments));
+    return ok_symbol;
+}
+
+object *set_cdr_proc(object *arguments) {
+    set_cdr(car(arguments), cadr(arguments));
+    return ok_symbol;
+}
+
+object *list_proc(object *arguments) {
+    return arguments;
+}
+
+object *is_vector_proc(object *arguments) {
+    return is_vector(car(arguments)) ? true : false;
+}
+
+long fixnum_argument(object *obj);
+
+object *make_vector_proc(object *arguments) {
+    long length;
+    
+    length = fixnum_argument(car(arguments));
+    if (length < 0) {
+        fprintf(stderr_stream, "make-vector needs a length of 0 or more\n");
+        end_with_error();
+    }
+    arguments = cdr(arguments);
+    return make_vector(length, is_the_empty_list(arguments) ?
+                                   false : car(arguments));
+}
+
+object *list_to_vector(object *list) {
+    object *vector;
+    object *rest;
+    long length;
+    long i;
+    
+    length = 0;
+    for (rest = list; is_pair(rest); rest = cdr(rest)) {
+        length++;
+    }
+    vector = make_vector(length, the_empty_list);
+    for (i = 0; i < length; i++) {
+        vector->data.vector.elements[i] = car(list);
+        list = cdr(list);
+    }
+    return vector;
+}
+
+object *vector_proc(object *arguments) {
+    return list_to_vector(arguments);
+}
+
+object *list_to_vector_proc(object *arguments) {
+    return list_to_vector(car(arguments));
+}
+
+object *vector_to_list_proc(object *arguments) {
+    object *vector;
+    object *list;
+    long i;
+    
+    vector = car(arguments);
+    list = the_empty_list;
+    for (i = vector->data.vector.length - 1; i >= 0; i--) {
+        list = cons(vector->data.vector.elements[i], list);
+    }
+    return list;
+}
+
+object *vector_length_proc(object *arguments) {
+    return make_fixnum(car(arguments)->data.vector.length);
+}
+
+/* the index of the element of the vector that the second argument
+ * names, which must be there */
+long vector_index(object *arguments) {
+    object *vector;
+    long index;
+    
+    vector = car(arguments);
+    if (!is_vector(vector)) {
+        fprintf(stderr_stream, "vector expected\n");
+        end_with_error();
+    }
+    index = fixnum_argument(cadr(arguments));
+    if (index < 0 || index >= vector->data.vector.length) {
+        fprintf(stderr_stream, "vector index %ld out of range\n", index);
+        end_with_error();
+    }
+    return index;
+}
+
+object *vector_ref_proc(object *arguments) {
+    return car(arguments)->data.vector.elements[vector_index(arguments)];
+}
+
+object *vector_set_proc(object *arguments) {
+    car(arguments)->data.vector.elements[vector_index(arguments)] =
+        caddr(arguments);
+    return ok_symbol;
+}
+
+object *vector_fill_proc(object *arguments) {
+    object *vector;
+    object *fill;
+    long i;
+    
+    vector = car(arguments);
+    fill = cadr(arguments);
+    for (i = 0; i < vector->data.vector.length; i++) {
+        vector->data.vector.elements[i] = fill;
+    }
+    return ok_symbol;
+}
+
+object *string_argument(object *obj) {
+    if (!is_string(obj)) {
+        fprintf(stderr_stream, "string expected\n");
+        end_with_error();
+    }
+    return obj;
+}
+
+/* the index that the argument names in a string of the length, or
+ * the default if there is no argument */
+size_t string_bound(object *arguments, size_t length, size_t otherwise) {
+    long bound;
+
+    if (is_the_empty_list(arguments)) {
+        return otherwise;
+    }
+    bound = fixnum_argument(car(arguments));
+    if (bound < 0 || (size_t)bound > length) {
+        fprintf(stderr_stream, "string index %ld out of range\n", bound);
+        end_with_error();
+    }
+    return bound;
+}
+
+object *string_length_proc(object *arguments) {
+    return make_fixnum(string_argument(car(arguments))->data.string.length);
+}
+
+object *string_ref_proc(object *arguments) {
+    object *str;
+    long index;
+
+    str = string_argument(car(arguments));
+    index = fixnum_argument(cadr(arguments));
+    if (index < 0 || (size_t)index >= str->data.string.length) {
+        fprintf(stderr_stream, "string index %ld out of range\n", index);
+        end_with_error();
+    }
+    return make_character(str->data.string.value[index]);
+}
+
+/* (substring string start [end]) */
+object *substring_proc(object *arguments) {
+    object *str;
+    size_t start;
+    size_t end;
+
+    str = string_argument(car(arguments));
+    arguments = cdr(arguments);
+    start = string_bound(arguments, str->data.string.length, 0);
+    end = string_bound(cdr(arguments), str->data.string.length,
+                       str->data.string.length);
+    if (start > end) {
+        fprintf(stderr_stream, "substring start after end\n");
+        end_with_error();
+    }
+    return make_string_of_length(str->data.string.value + start,
+                                 end - start);
+}
+
+/* the strings of the list, with the separator between each two, as
+ * one new string */
+object *join_strings(object *list, char *separator, size_t separator_length) {
+    object *rest;
+    object *result;
+    size_t length;
+    char *p;
+
+    length = 0;
+    for (rest = list; is_pair(rest); rest = cdr(rest)) {
+        length += string_argument(car(rest))->data.string.length;
+        if (is_pair(cdr(rest))) {
+            length += separator_length;
+        }
+    }
+    result = make_string_of_length(NULL, length);
+    p = result->data.string.value;
+    for (rest = list; is_pair(rest); rest = cdr(rest)) {
+        memcpy(p, car(rest)->data.string.value,
+               car(rest)->data.string.length);
+        p += car(rest)->data.string.length;
+        if (is_pair(cdr(rest))) {
+            memcpy(p, separator, separator_length);
+            p += separator_length;
+        }
+    }
+    return result;
+}
+
+object *string_append_proc(object *arguments) {
+    return join_strings(arguments, "", 0);
+}
+
+/* (string-join list [separator]), the separator being a space
+ * unless given */
+object *string_join_proc(object *arguments) {
+    object *separator;
+
+    if (is_the_empty_list(cdr(arguments))) {
+        return join_strings(car(arguments), " ", 1);
+    }
+    separator = string_argument(cadr(arguments));
+    return join_strings(car(arguments), separator->data.string.value,
+                        separator->data.string.length);
+}
+
+/* The case functions know ASCII only, like the reader. Without a
+ * branch or a table the loops are left for the compiler to
+ * vectorize. */
+unsigned char fold_case(unsigned char c) {
+    return c + (((unsigned char)(c - 'A') < 26) << 5);
+}
+
+object *convert_case(object *arguments, char is_up) {
+    object *str;
+    object *result;
+    unsigned char *from;
+    unsigned char *to;
+    size_t i;
+
+    str = string_argument(car(arguments));
+    result = make_string_of_length(NULL, str->data.string.length);
+    from = (unsigned char *)str->data.string.value;
+    to = (unsigned char *)result->data.string.value;
+    if (is_up) {
+        for (i = 0; i < str->data.string.length; i++) {
+            to[i] = from[i] - (((unsigned char)(from[i] - 'a') < 26) << 5);
+        }
+    }
+    else {
+        for (i = 0; i < str->data.string.length; i++) {
+            to[i] = fold_case(from[i]);
+        }
+    }
+    return result;
+}
+
+object *string_upcase_proc(object *arguments) {
+    return convert_case(arguments, 1);
+}
+
+object *string_downcase_proc(object *arguments) {
+    return convert_case(arguments, 0);
+}
+
+/* negative, zero or positive as the first string sorts before, with
+ * or after the second, ignoring case if so asked */
+int compare_strings(object *str1, object *str2, char is_ci) {
+    unsigned char *p1;
+    unsigned char *p2;
+    size_t length;
+    size_t i;
+    int order;
+
+    length = (str1->data.string.length < str2->data.string.length) ?
+                 str1->data.string.length : str2->data.string.length;
+    p1 = (unsigned char *)str1->data.string.value;
+    p2 = (unsigned char *)str2->data.string.value;
+    if (!is_ci) {
+        order = memcmp(p1, p2, length);
+    }
+    else {
+        order = 0;
+        for (i = 0; i < length && order == 0; i++) {
+            order = fold_case(p1[i]) - fold_case(p2[i]);
+        }
+    }
+    if (order != 0) {
+        return order;
+    }
+    return (str1->data.string.length < str2->data.string.length) ? -1 :
+           (str1->data.string.length > str2->data.string.length) ? 1 : 0;
+}
+
+/* whether each two neighbouring strings of the arguments are in the
+ * order, -1 for less than and 0 for equal */
+object *are_strings_ordered(object *arguments, int order, char is_ci) {
+    object *previous;
+    int result;
+
+    previous = string_argument(car(arguments));
+    while (!is_the_empty_list(arguments = cdr(arguments))) {
+        result = compare_strings(previous,
+                                 string_argument(car(arguments)), is_ci);
+        if ((order == 0) ? result != 0 : result >= 0) {
+            return false;
+        }
+        previous = car(arguments);
+    }
+    return true;
+}
+
+object *is_string_equal_proc(object *arguments) {
+    return are_strings_ordered(arguments, 0, 0);
+}
+
+object *is_string_less_than_proc(object *arguments) {
+    return are_strings_ordered(arguments, -1, 0);
+}
+
+object *is_string_ci_equal_proc(object *arguments) {
+    return are_strings_ordered(arguments, 0, 1);
+}
+
+object *is_string_ci_less_than_proc(object *arguments) {
+    return are_strings_ordered(arguments, -1, 1);
+}
+
+/* (string-index string char [start]), the index of the first
+ * occurrence of the character from start on, or #f */
+object *string_index_proc(object *arguments) {
+    object *str;
+    object *c;
+    size_t start;
+    char *found;
+
+    str = string_argument(car(arguments));
+    c = cadr(arguments);
+    if (!is_character(c)) {
+        fprintf(stderr_stream, "character expected\n");
+        end_with_error();
+    }
+    start = string_bound(cddr(arguments), str->data.string.length, 0);
+    found = memchr(str->data.string.value + start, c->data.character.value,
+                   str->data.string.length - start);
+    return (found == NULL) ? false :
+                             make_fixnum(found - str->data.string.value);
+}
+
+/* Crochemore and Perrin's two-way string matching. The needle splits
+ * where its maximal suffix starts, at ms + 1, and its right part is
+ * matched first. A mismatch there shifts past what was matched. A
+ * match is then finished leftward, and a mismatch on that side
+ * shifts by the period p. For a periodic needle, mem keeps how much
+ * of it is known to match after such a shift. This takes linear
+ * time, and memchr finds one-byte needles. */
+char *find_substring(char *haystack, size_t haystack_length,
+                     char *needle_chars, size_t l) {
+    unsigned char *h;
+    unsigned char *z;
+    unsigned char *n;
+    size_t ip, jp, k, p, ms, p0, mem, mem0;
+
+    if (l == 0) {
+        return haystack;
+    }
+    if (l == 1) {
+        return memchr(haystack, needle_chars[0], haystack_length);
+    }
+    h = (unsigned char *)haystack;
+    z = h + haystack_length;
+    n = (unsigned char *)needle_chars;
+
+    /* the maximal suffix for one order of the alphabet, and then for
+     * the other */
+    ip = (size_t)-1;
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        if (n[ip + k] == n[jp + k]) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            }
+            else {
+                k++;
+            }
+        }
+        else if (n[ip + k] > n[jp + k]) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        }
+        else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    ms = ip;
+    p0 = p;
+    ip = (size_t)-1;
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        if (n[ip + k] == n[jp + k]) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            }
+            else {
+                k++;
+            }
+        }
+        else if (n[ip + k] < n[jp + k]) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        }
+        else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    if (ip + 1 > ms + 1) {
+        ms = ip;
+    }
+    else {
+        p = p0;
+    }
+
+    if (memcmp(n, n + p, ms + 1) != 0) {
+        mem0 = 0;
+        p = ((ms > l - ms - 1) ? ms : l - ms - 1) + 1;
+    }
+    else {
+        mem0 = l - p;
+    }
+    mem = 0;
+
+    while ((size_t)(z - h) >= l) {
+        k = (ms + 1 > mem) ? ms + 1 : mem;
+        while (k < l && n[k] == h[k]) {
+            k++;
+        }
+        if (k < l) {
+            h += k - ms;
+            mem = 0;
+            continue;
+        }
+        k = ms + 1;
+        while (k > mem && n[k - 1] == h[k - 1]) {
+            k--;
+        }
+        if (k <= mem) {
+            return (char *)h;
+        }
+        h += p;
+        mem = mem0;
+    }
+    return NULL;
+}
+
+/* (string-search-forward pattern string start), the index where the
+ * pattern first occurs from start on, or #f */
+object *string_search_forward_proc(object *arguments) {
+    object *pattern;
+    object *str;
+    size_t start;
+    char *found;
+
+    pattern = string_argument(car(arguments));
+    str = string_argument(cadr(arguments));
+    start = string_bound(cddr(arguments), str->data.string.length, 0);
+    found = find_substring(str->data.string.value + start,
+                           str->data.string.length - start,
+                           pattern->data.string.value,
+                           pattern->data.string.length);
+    return (found == NULL) ? false :
+                             make_fixnum(found - str->data.string.value);
+}
+
+/* (string-split string char), the pieces between each occurrence of
+ * the character, empty ones too */
+object *string_split_proc(object *arguments) {
+    object *str;
+    object *c;
+    object *list;
+    object *last;
+    object *piece;
+    char *start;
+    char *end;
+    char *found;
+
+    str = string_argument(car(arguments));
+    c = cadr(arguments);
+    if (!is_character(c)) {
+        fprintf(stderr_stream, "character expected\n");
+        end_with_error();
+    }
+    list = the_empty_list;
+    last = NULL;
+    start = str->data.string.value;
+    end = start + str->data.string.length;
+    while (1) {
+        found = memchr(start, c->data.character.value, end - start);
+        piece = cons(make_string_of_length(start, ((found == NULL) ?
+                                                      end : found) - start),
+                     the_empty_list);
+        if (last == NULL) {
+            list = piece;
+        }
+        else {
+            set_cdr(last, piece);
+        }
+        last = piece;
+        if (found == NULL) {
+            return list;
+        }
+        start = found + 1;
+    }
+}
+
+object *bytevector_argument(object *obj) {
+    if (!is_bytevector(obj)) {
+        fprintf(stderr_stream, "bytevector expected\n");
+        end_with_error();
+    }
+    return obj;
+}
+
+unsigned char byte_argument(object *obj) {
+    if (!is_fixnum(obj) ||
+        obj->data.fixnum.value < 0 || obj->data.fixnum.value > 255) {
+        fprintf(stderr_stream, "byte expected\n");
+        end_with_error();
+    }
+    return obj->data.fixnum.value;
+}
+
+/* the start or end that the argument names in a bytevector of the
+ * length, or the default if there is no argument */
+long bytevector_bound(object *arguments, long length, long otherwise) {
+    long bound;
+    
+    if (is_the_empty_list(arguments)) {
+        return otherwise;
+    }
+    bound = fixnum_argument(car(arguments));
+    if (bound < 0 || bound > length) {
+        fprintf(stderr_stream, "bytevector index %ld out of range\n", bound);
+        end_with_error();
+    }
+    return bound;
+}
+
+object *is_bytevector_proc(object *arguments) {
+    return is_bytevector(car(arguments)) ? true : false;
+}
+
+object *make_bytevector_proc(object *arguments) {
+    object *obj;
+    long length;
+    
+    length = fixnum_argument(car(arguments));
+    if (length < 0) {
+        fprintf(stderr_stream,
+                "make-bytevector needs a length of 0 or more\n");
+        end_with_error();
+    }
+    arguments = cdr(arguments);
+    obj = make_bytevector(length);
+    memset(obj->data.bytevector.bytes,
+           is_the_empty_list(arguments) ? 0 : byte_argument(car(arguments)),
+           length);
+    return obj;
+}
+
+object *list_to_bytevector(object *list) {
+    object *obj;
+    object *rest;
+    long length;
+    long i;
+    
+    length = 0;
+    for (rest = list; is_pair(rest); rest = cdr(rest)) {
+        length++;
+    }
+    obj = make_bytevector(length);
+    for (i = 0; i < length; i++) {
+        obj->data.bytevector.bytes[i] = byte_argument(car(list));
+        list = cdr(list);
+    }
+    return obj;
+}
+
+object *bytevector_proc(object *arguments) {
+    return list_to_bytevector(arguments);
+}
+
+object *bytevector_length_proc(object *arguments) {
+    return make_fixnum(
+        bytevector_argument(car(arguments))->data.bytevector.length);
+}
+
+/* the index of the byte that the second argument names, which must
+ * be there */
+long bytevector_index(object *arguments) {
+    object *obj;
+    long index;
+    
+    obj = bytevector_argument(car(arguments));
+    index = fixnum_argument(cadr(arguments));
+    if (index < 0 || index >= obj->data.bytevector.length) {
+        fprintf(stderr_stream, "bytevector index %ld out of range\n", index);
+        end_with_error();
+    }
+    return index;
+}
+
+object *bytevector_u8_ref_proc(object *arguments) {
+    return make_fixnum(
+        car(arguments)->data.bytevector.bytes[bytevector_index(arguments)]);
+}
+
+object *bytevector_u8_set_proc(object *arguments) {
+    car(arguments)->data.bytevector.bytes[bytevector_index(arguments)] =
+        byte_argument(caddr(arguments));
+    return ok_symbol;
+}
+
+/* (bytevector-copy! to at from [start [end]]), which may overlap */
+object *bytevector_copy_to_proc(object *arguments) {
+    object *to;
+    object *from;
+    long at;
+    long start;
+    long end;
+    
+    to = bytevector_argument(car(arguments));
+    at = bytevector_bound(cdr(arguments), to->data.bytevector.length, 0);
+    arguments = cddr(arguments);
+    from = bytevector_argument(car(arguments));
+    arguments = cdr(arguments);
+    start = bytevector_bound(arguments, from->data.bytevector.length, 0);
+    end = bytevector_bound(is_the_empty_list(arguments) ?
+                               arguments : cdr(arguments),
+                           from->data.bytevector.length,
+                           from->data.bytevector.length);
+    if (start > end || end - start > to->data.bytevector.length - at) {
+        fprintf(stderr_stream, "bytevector-copy! out of range\n");
+        end_with_error();
+    }
+    memmove(to->data.bytevector.bytes + at,
+            from->data.bytevector.bytes + start, end - start);
+    return ok_symbol;
+}
+
+/* (bytevector-fill! bytevector byte [start [end]]) */
+object *bytevector_fill_proc(object *arguments) {
+    object *obj;
+    unsigned char byte;
+    long start;
+    long end;
+    
+    obj = bytevector_argument(car(arguments));
+    byte = byte_argument(cadr(arguments));
+    arguments = cddr(arguments);
+    start = bytevector_bound(arguments, obj->data.bytevector.length, 0);
+    end = bytevector_bound(is_the_empty_list(arguments) ?
+                               arguments : cdr(arguments),
+                           obj->data.bytevector.length,
+                           obj->data.bytevector.length);
+    if (start > end) {
+        fprintf(stderr_stream, "bytevector-fill! out of range\n");
+        end_with_error();
+    }
+    memset(obj->data.bytevector.bytes + start, byte, end - start);
+    return ok_symbol;
+}
+
+object *is_bytevector_equal_proc(object *arguments) {
+    object *obj;
+    
+    obj = bytevector_argument(car(arguments));
+    while (!is_the_empty_list(arguments = cdr(arguments))) {
+        if (!is_bytevector_equal(obj, bytevector_argument(car(arguments)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* The s64vector kernels run over whole vectors of longs with no
+ * element ever boxed. Where the processor has AVX2, picked when the
+ * program starts, they take four elements at a time, and otherwise
+ * they are plain loops. Sums and products watch for overflow as
+ * they go, and a kernel that sees one returns nonzero. The sum and
+ * the dot product then redo the work with bignums. Adding and
+ * subtracting vectors is an error on overflow instead, so those
+ * kernels are first run with no destination, NULL, only to look for
+ * one, and the destination, which may be an operand, is not written
+ * unless the whole result fits. */
+
+char s64_add_scalar(long *r, long *a, long *b, long n) {
+    unsigned long overflow = 0;
+    long sum;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        sum = (long)((unsigned long)a[i] + (unsigned long)b[i]);
+        overflow |= (unsigned long)((a[i] ^ sum) & (b[i] ^ sum));
+        if (r != NULL) {
+            r[i] = sum;
+        }
+    }
+    return (overflow >> (sizeof(long) * CHAR_BIT - 1)) != 0;
+}
+
+char s64_sub_scalar(long *r, long *a, long *b, long n) {
+    unsigned long overflow = 0;
+    long sum;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        sum = (long)((unsigned long)a[i] - (unsigned long)b[i]);
+        overflow |= (unsigned long)((a[i] ^ b[i]) & (a[i] ^ sum));
+        if (r != NULL) {
+            r[i] = sum;
+        }
+    }
+    return (overflow >> (sizeof(long) * CHAR_BIT - 1)) != 0;
+}
+
+void s64_bitwise_scalar(long *r, long *a, long *b, long n, int op) {
+    long i;
+
+    for (i = 0; i < n; i++) {
+        r[i] = (op == '&') ? a[i] & b[i] :
+               (op == '|') ? a[i] | b[i] :
+                             a[i] ^ b[i];
+    }
+}
+
+char s64_sum_scalar(long *a, long n, long *sum) {
+    long i;
+
+    for (i = 0; i < n; i++) {
+        if (add_overflows(*sum, a[i], sum)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+long s64_min_scalar(long *a, long n, char is_max) {
+    long result;
+    long i;
+
+    result = a[0];
+    for (i = 1; i < n; i++) {
+        if (is_max ? a[i] > result : a[i] < result) {
+            result = a[i];
+        }
+    }
+    return result;
+}
+
+char s64_dot_scalar(long *a, long *b, long n, long *dot) {
+    long product;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        if (mul_overflows(a[i], b[i], &product) ||
+            add_overflows(*dot, product, dot)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+unsigned long s64_popcount_scalar(long *a, long n) {
+    unsigned long count = 0;
+#ifndef __GNUC__
+    unsigned long x;
+#endif
+    long i;
+
+    for (i = 0; i < n; i++) {
+#ifdef __GNUC__
+        count += __builtin_popcountl((unsigned long)a[i]);
+#else
+        for (x = (unsigned long)a[i]; x != 0; x &= x - 1) {
+            count++;
+        }
+#endif
+    }
+    return count;
+}
+
+#ifdef USE_SIMD_KERNELS
+
+/* the sign bits of the four lanes */
+__attribute__((target("avx2")))
+int sign_bits_avx2(__m256i x) {
+    return _mm256_movemask_pd(_mm256_castsi256_pd(x));
+}
+
+__attribute__((target("avx2")))
+char s64_add_avx2(long *r, long *a, long *b, long n) {
+    __m256i x, y, z;
+    __m256i overflow = _mm256_setzero_si256();
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        x = _mm256_loadu_si256((__m256i *)(a + i));
+        y = _mm256_loadu_si256((__m256i *)(b + i));
+        z = _mm256_add_epi64(x, y);
+        overflow = _mm256_or_si256(overflow,
+                       _mm256_and_si256(_mm256_xor_si256(x, z),
+                                        _mm256_xor_si256(y, z)));
+        if (r != NULL) {
+            _mm256_storeu_si256((__m256i *)(r + i), z);
+        }
+    }
+    return (sign_bits_avx2(overflow) != 0) |
+           s64_add_scalar((r != NULL) ? r + i : NULL, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+char s64_sub_avx2(long *r, long *a, long *b, long n) {
+    __m256i x, y, z;
+    __m256i overflow = _mm256_setzero_si256();
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        x = _mm256_loadu_si256((__m256i *)(a + i));
+        y = _mm256_loadu_si256((__m256i *)(b + i));
+        z = _mm256_sub_epi64(x, y);
+        overflow = _mm256_or_si256(overflow,
+                       _mm256_and_si256(_mm256_xor_si256(x, y),
+                                        _mm256_xor_si256(x, z)));
+        if (r != NULL) {
+            _mm256_storeu_si256((__m256i *)(r + i), z);
+        }
+    }
+    return (sign_bits_avx2(overflow) != 0) |
+           s64_sub_scalar((r != NULL) ? r + i : NULL, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void s64_bitwise_avx2(long *r, long *a, long *b, long n, int op) {
+    __m256i x, y;
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        x = _mm256_loadu_si256((__m256i *)(a + i));
+        y = _mm256_loadu_si256((__m256i *)(b + i));
+        x = (op == '&') ? _mm256_and_si256(x, y) :
+            (op == '|') ? _mm256_or_si256(x, y) :
+                          _mm256_xor_si256(x, y);
+        _mm256_storeu_si256((__m256i *)(r + i), x);
+    }
+    s64_bitwise_scalar(r + i, a + i, b + i, n - i, op);
+}
+
+/* each lane sums every fourth element, and the lanes are added at
+ * the end */
+__attribute__((target("avx2")))
+char s64_sum_avx2(long *a, long n, long *sum) {
+    __m256i x, z;
+    __m256i lanes = _mm256_setzero_si256();
+    __m256i overflow = _mm256_setzero_si256();
+    long partial[4];
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        x = _mm256_loadu_si256((__m256i *)(a + i));
+        z = _mm256_add_epi64(lanes, x);
+        overflow = _mm256_or_si256(overflow,
+                       _mm256_and_si256(_mm256_xor_si256(lanes, z),
+                                        _mm256_xor_si256(x, z)));
+        lanes = z;
+    }
+    if (sign_bits_avx2(overflow) != 0) {
+        return 1;
+    }
+    _mm256_storeu_si256((__m256i *)partial, lanes);
+    return s64_sum_scalar(partial, 4, sum) ||
+           s64_sum_scalar(a + i, n - i, sum);
+}
+
+__attribute__((target("avx2")))
+long s64_min_avx2(long *a, long n, char is_max) {
+    __m256i x, lanes;
+    long partial[4];
+    long result;
+    long tail;
+    long i;
+
+    if (n < 4) {
+        return s64_min_scalar(a, n, is_max);
+    }
+    lanes = _mm256_loadu_si256((__m256i *)a);
+    for (i = 4; i + 4 <= n; i += 4) {
+        x = _mm256_loadu_si256((__m256i *)(a + i));
+        lanes = _mm256_blendv_epi8(lanes, x,
+                    is_max ? _mm256_cmpgt_epi64(x, lanes) :
+                             _mm256_cmpgt_epi64(lanes, x));
+    }
+    _mm256_storeu_si256((__m256i *)partial, lanes);
+    result = s64_min_scalar(partial, 4, is_max);
+    if (i < n) {
+        tail = s64_min_scalar(a + i, n - i, is_max);
+        if (is_max ? tail > result : tail < result) {
+            result = tail;
+        }
+    }
+    return result;
+}
+
+/* AVX2 multiplies only 32 bit halves, so this takes the elements to
+ * fit in 32 bits, and says it overflowed if they do not */
+__attribute__((target("avx2")))
+char s64_dot_avx2(long *a, long *b, long n, long *dot) {
+    __m256i x, y, z, product;
+    __m256i lanes = _mm256_setzero_si256();
+    __m256i overflow = _mm256_setzero_si256();
+    __m256i wide = _mm256_setzero_si256();
+    __m256i half = _mm256_set1_epi64x(0x80000000L);
+    long partial[4];
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        x = _mm256_loadu_si256((__m256i *)(a + i));
+        y = _mm256_loadu_si256((__m256i *)(b + i));
+        wide = _mm256_or_si256(wide,
+                   _mm256_or_si256(
+                       _mm256_srli_epi64(_mm256_add_epi64(x, half), 32),
+                       _mm256_srli_epi64(_mm256_add_epi64(y, half), 32)));
+        product = _mm256_mul_epi32(x, y);
+        z = _mm256_add_epi64(lanes, product);
+        overflow = _mm256_or_si256(overflow,
+                       _mm256_and_si256(_mm256_xor_si256(lanes, z),
+                                        _mm256_xor_si256(product, z)));
+        lanes = z;
+    }
+    if (sign_bits_avx2(overflow) != 0 ||
+        !_mm256_testz_si256(wide, wide)) {
+        return 1;
+    }
+    _mm256_storeu_si256((__m256i *)partial, lanes);
+    return s64_sum_scalar(partial, 4, dot) ||
+           s64_dot_scalar(a + i, b + i, n - i, dot);
+}
+
+/* counts the bits of each nibble through a table in a register,
+ * then adds up the bytes of each lane */
+__attribute__((target("avx2")))
+unsigned long s64_popcount_avx2(long *a, long n) {
+    __m256i x, low, high, counts;
+    __m256i lanes = _mm256_setzero_si256();
+    __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                     1, 2, 2, 3, 2, 3, 3, 4,
+                                     0, 1, 1, 2, 1, 2, 2, 3,
+                                     1, 2, 2, 3, 2, 3, 3, 4);
+    unsigned long partial[4];
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        x = _mm256_loadu_si256((__m256i *)(a + i));
+        low = _mm256_and_si256(x, nibble);
+        high = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+        counts = _mm256_add_epi8(_mm256_shuffle_epi8(table, low),
+                                 _mm256_shuffle_epi8(table, high));
+        lanes = _mm256_add_epi64(lanes,
+                    _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+    }
+    _mm256_storeu_si256((__m256i *)partial, lanes);
+    return partial[0] + partial[1] + partial[2] + partial[3] +
+           s64_popcount_scalar(a + i, n - i);
+}
+
+#endif
+
+char (*s64_add)(long *r, long *a, long *b, long n) = s64_add_scalar;
+char (*s64_sub)(long *r, long *a, long *b, long n) = s64_sub_scalar;
+void (*s64_bitwise)(long *r, long *a, long *b, long n, int op) =
+    s64_bitwise_scalar;
+char (*s64_sum)(long *a, long n, long *sum) = s64_sum_scalar;
+long (*s64_min)(long *a, long n, char is_max) = s64_min_scalar;
+char (*s64_dot)(long *a, long *b, long n, long *dot) = s64_dot_scalar;
+unsigned long (*s64_popcount)(long *a, long n) = s64_popcount_scalar;
+
+void init_s64_kernels(void) {
+#ifdef USE_SIMD_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        s64_add = s64_add_avx2;
+        s64_sub = s64_sub_avx2;
+        s64_bitwise = s64_bitwise_avx2;
+        s64_sum = s64_sum_avx2;
+        s64_min = s64_min_avx2;
+        s64_dot = s64_dot_avx2;
+        s64_popcount = s64_popcount_avx2;
+    }
+#endif
+}
+
+object *s64vector_argument(object *obj) {
+    if (!is_s64vector(obj)) {
+        fprintf(stderr_stream, "s64vector expected\n");
+        end_with_error();
+    }
+    return obj;
+}
+
+object *is_s64vector_proc(object *arguments) {
+    return is_s64vector(car(arguments)) ? true : false;
+}
+
+object *make_s64vector_proc(object *arguments) {
+    object *obj;
+    long length;
+    long fill;
+    long i;
+
+    length = fixnum_argument(car(arguments));
+    if (length < 0) {
+        fprintf(stderr_stream, "make-s64vector needs a length of 0 or more\n");
+        end_with_error();
+    }
+    arguments = cdr(arguments);
+    fill = is_the_empty_list(arguments) ? 0 : fixnum_argument(car(arguments));
+    obj = make_s64vector(length);
+    for (i = 0; i < length; i++) {
+        obj->data.s64vector.elements[i] = fill;
+    }
+    return obj;
+}
+
+object *list_to_s64vector(object *list) {
+    object *obj;
+    object *rest;
+    long length;
+    long i;
+
+    length = 0;
+    for (rest = list; is_pair(rest); rest = cdr(rest)) {
+        length++;
+    }
+    obj = make_s64vector(length);
+    for (i = 0; i < length; i++) {
+        obj->data.s64vector.elements[i] = fixnum_argument(car(list));
+        list = cdr(list);
+    }
+    return obj;
+}
+
+object *s64vector_proc(object *arguments) {
+    return list_to_s64vector(arguments);
+}
+
+object *list_to_s64vector_proc(object *arguments) {
+    return list_to_s64vector(car(arguments));
+}
+
+object *s64vector_to_list_proc(object *arguments) {
+    object *obj;
+    object *list;
+    long i;
+
+    obj = s64vector_argument(car(arguments));
+    list = the_empty_list;
+    for (i = obj->data.s64vector.length - 1; i >= 0; i--) {
+        list = cons(make_fixnum(obj->data.s64vector.elements[i]), list);
+    }
+    return list;
+}
+
+object *s64vector_length_proc(object *arguments) {
+    return make_fixnum(
+        s64vector_argument(car(arguments))->data.s64vector.length);
+}
+
+/* the index of the element that the second argument names, which
+ * must be there */
+long s64vector_index(object *arguments) {
+    object *obj;
+    long index;
+
+    obj = s64vector_argument(car(arguments));
+    index = fixnum_argument(cadr(arguments));
+    if (index < 0 || index >= obj->data.s64vector.length) {
+        fprintf(stderr_stream, "s64vector index %ld out of range\n", index);
+        end_with_error();
+    }
+    return index;
+}
+
+object *s64vector_ref_proc(object *arguments) {
+    return make_fixnum(
+        car(arguments)->data.s64vector.elements[s64vector_index(arguments)]);
+}
+
+object *s64vector_set_proc(object *arguments) {
+    car(arguments)->data.s64vector.elements[s64vector_index(arguments)] =
+        fixnum_argument(caddr(arguments));
+    return ok_symbol;
+}
+
+/* The element-wise operations write into the optional third
+ * argument, which may be one of the first two, and otherwise into a
+ * new s64vector. All must be as long. */
+object *s64vector_result(object *arguments) {
+    object *result;
+    long length;
+
+    length = s64vector_argument(car(arguments))->data.s64vector.length;
+    arguments = cdr(arguments);
+    if (s64vector_argument(car(arguments))->data.s64vector.length !=
+            length) {
+        fprintf(stderr_stream, "s64vectors of different lengths\n");
+        end_with_error();
+    }
+    arguments = cdr(arguments);
+    if (is_the_empty_list(arguments)) {
+        return make_s64vector(length);
+    }
+    result = s64vector_argument(car(arguments));
+    if (result->data.s64vector.length != length) {
+        fprintf(stderr_stream, "s64vectors of different lengths\n");
+        end_with_error();
+    }
+    return result;
+}
+
+object *s64vector_add_proc(object *arguments) {
+    object *result;
+    long *a;
+    long *b;
+
+    result = s64vector_result(arguments);
+    a = car(arguments)->data.s64vector.elements;
+    b = cadr(arguments)->data.s64vector.elements;
+    if (s64_add(NULL, a, b, result->data.s64vector.length)) {
+        fprintf(stderr_stream, "s64vector-add overflows\n");
+        end_with_error();
+    }
+    s64_add(result->data.s64vector.elements, a, b,
+            result->data.s64vector.length);
+    return result;
+}
+
+object *s64vector_sub_proc(object *arguments) {
+    object *result;
+    long *a;
+    long *b;
+
+    result = s64vector_result(arguments);
+    a = car(arguments)->data.s64vector.elements;
+    b = cadr(arguments)->data.s64vector.elements;
+    if (s64_sub(NULL, a, b, result->data.s64vector.length)) {
+        fprintf(stderr_stream, "s64vector-sub overflows\n");
+        end_with_error();
+    }
+    s64_sub(result->data.s64vector.elements, a, b,
+            result->data.s64vector.length);
+    return result;
+}
+
+object *s64vector_bitwise(object *arguments, int op) {
+    object *result;
+
+    result = s64vector_result(arguments);
+    s64_bitwise(result->data.s64vector.elements,
+                car(arguments)->data.s64vector.elements,
+                cadr(arguments)->data.s64vector.elements,
+                result->data.s64vector.length, op);
+    return result;
+}
+
+object *s64vector_and_proc(object *arguments) {
+    return s64vector_bitwise(arguments, '&');
+}
+
+object *s64vector_or_proc(object *arguments) {
+    return s64vector_bitwise(arguments, '|');
+}
+
+object *s64vector_xor_proc(object *arguments) {
+    return s64vector_bitwise(arguments, '^');
+}
+
+object *s64vector_sum_proc(object *arguments) {
+    object *obj;
+    object *result;
+    long sum = 0;
+    long i;
+
+    obj = s64vector_argument(car(arguments));
+    if (!s64_sum(obj->data.s64vector.elements, obj->data.s64vector.length,
+                 &sum)) {
+        return make_fixnum(sum);
+    }
+    result = make_fixnum(0);
+    for (i = 0; i < obj->data.s64vector.length; i++) {
+        result = add_integers(result,
+                              make_fixnum(obj->data.s64vector.elements[i]));
+    }
+    return result;
+}
+
+object *s64vector_extreme(object *arguments, char is_max) {
+    object *obj;
+
+    obj = s64vector_argument(car(arguments));
+    if (obj->data.s64vector.length == 0) {
+        fprintf(stderr_stream, "empty s64vector has no %s\n",
+                is_max ? "maximum" : "minimum");
+        end_with_error();
+    }
+    return make_fixnum(s64_min(obj->data.s64vector.elements,
+                               obj->data.s64vector.length, is_max));
+}
+
+object *s64vector_min_proc(object *arguments) {
+    return s64vector_extreme(arguments, 0);
+}
+
+object *s64vector_max_proc(object *arguments) {
+    return s64vector_extreme(arguments, 1);
+}
+
+/* the fast kernel gives up on wide elements, the scalar one only on
+ * a dot product that is not a fixnum */
+object *s64vector_dot_proc(object *arguments) {
+    long *a;
+    long *b;
+    long length;
+    long dot;
+    object *result;
+    long i;
+
+    length = s64vector_argument(car(arguments))->data.s64vector.length;
+    if (s64vector_argument(cadr(arguments))->data.s64vector.length !=
+            length) {
+        fprintf(stderr_stream, "s64vectors of different lengths\n");
+        end_with_error();
+    }
+    a = car(arguments)->data.s64vector.elements;
+    b = cadr(arguments)->data.s64vector.elements;
+    dot = 0;
+    if (!s64_dot(a, b, length, &dot)) {
+        return make_fixnum(dot);
+    }
+    dot = 0;
+    if (!s64_dot_scalar(a, b, length, &dot)) {
+        return make_fixnum(dot);
+    }
+    result = make_fixnum(0);
+    for (i = 0; i < length; i++) {
+        result = add_integers(result, multiply_integers(make_fixnum(a[i]),
+                                                        make_fixnum(b[i])));
+    }
+    return result;
+}
+
+/* the number of bits set in the elements, as a bitset */
+object *s64vector_popcount_proc(object *arguments) {
+    object *obj;
+
+    obj = s64vector_argument(car(arguments));
+    return make_fixnum(s64_popcount(obj->data.s64vector.elements,
+                                    obj->data.s64vector.length));
+}
+
+hash_table *hash_table_argument(object *obj) {
+    if (!is_hash_table(obj)) {
+        fprintf(stderr_stream, "hash table expected\n");
+        end_with_error();
+    }
+    return obj->data.hash_table.table;
+}
+
+object *make_eq_hash_table_proc(object *arguments) {
+    return make_hash_table(0);
+}
+
+object *make_equal_hash_table_proc(object *arguments) {
+    return make_hash_table(1);
+}
+
+object *is_hash_table_proc(object *arguments) {
+    return is_hash_table(car(arguments)) ? true : false;
+}
+
+object *apply_procedure(object *procedure, object *arguments);
+
+/* the value of the key, or what the thunk returns if it has none */
+object *hash_table_ref_proc(object *arguments) {
+    object *value;
+    
+    value = hash_table_ref(hash_table_argument(car(arguments)),
+                           cadr(arguments));
+    if (value != NULL) {
+        return value;
+    }
+    arguments = cddr(arguments);
+    if (is_the_empty_list(arguments)) {
+        fprintf(stderr_stream, "key not found in hash table\n");
+        end_with_error();
+    }
+    return apply_procedure(car(arguments), the_empty_list);
+}
+
+object *hash_table_ref_default_proc(object *arguments) {
+    object *value;
+    
+    value = hash_table_ref(hash_table_argument(car(arguments)),
+                           cadr(arguments));
+    return (value != NULL) ? value : caddr(arguments);
+}
+
+object *hash_table_set_proc(object *arguments) {
+    hash_table_set(hash_table_argument(car(arguments)),
+                   cadr(arguments), caddr(arguments));
+    return ok_symbol;
+}
+
+object *hash_table_delete_proc(object *arguments) {
+    hash_table_delete(hash_table_argument(car(arguments)),
+                      cadr(arguments));
+    return ok_symbol;
+}
+
+object *hash_table_count_proc(object *arguments) {
+    return make_fixnum(hash_table_argument(car(arguments))->count);
+}
+
+/* Calls the procedure on the key and value of each entry. The
+ * entries are looked up afresh each time round as the procedure may
+ * change the table. Like any argument list, the one for the call
+ * need not outlive it. */
+object *hash_table_walk_proc(object *arguments) {
+    hash_table *table;
+    object *procedure;
+    hash_entry *entry;
+    unsigned long i;
+    region_mark mark;
+    
+    table = hash_table_argument(car(arguments));
+    procedure = cadr(arguments);
+    for (i = 0; i < table->size; i++) {
+        entry = &table->entries[i];
+        if (entry->key != NULL && entry->value != NULL) {
+            mark = current_region_mark();
+            apply_procedure(procedure,
+                            region_cons(entry->key,
+                                        region_cons(entry->value,
+                                                    the_empty_list)));
+            release_region(mark);
+        }
+    }
+    return ok_symbol;
+}
+
+/* Forces the promise with the C stack no deeper however long the
+ * chain of delay-force behind it. The promise that a chained thunk
+ * gives hands over its state to the box and then shares it, and the
+ * loop goes on with what the box now holds. A thunk may force the
+ * same promise itself, which leaves it done. */
+object *force(object *obj) {
+    promise_box *box;
+    object *value;
+
+    if (!is_promise(obj)) {
+        return obj;
+    }
+    while (!obj->data.promise.box->is_done) {
+        value = apply_procedure(obj->data.promise.box->value,
+                                the_empty_list);
+        box = obj->data.promise.box;
+        if (box->is_done) {
+            break;
+        }
+        if (!box->is_chained) {
+            box->is_done = 1;
+            box->value = value;
+        }
+        else if (!is_promise(value)) {
+            fprintf(stderr_stream, "delay-force expression gave no promise\n");
+            end_with_error();
+        }
+        else {
+            *box = *value->data.promise.box;
+            value->data.promise.box = box;
+        }
+    }
+    return obj->data.promise.box->value;
+}
+
+/* what delay and delay-force become, see lazy_to_application */
+object *delay_proc(object *arguments) {
+    return make_promise(car(arguments), 0, 0);
+}
+
+object *delay_force_proc(object *arguments) {
+    return make_promise(car(arguments), 0, 1);
+}
+
+object *make_promise_proc(object *arguments) {
+    return is_promise(car(arguments)) ? car(arguments) :
+                                        make_promise(car(arguments), 1, 0);
+}
+
+object *is_promise_proc(object *arguments) {
+    return is_promise(car(arguments)) ? true : false;
+}
+
+object *force_proc(object *arguments) {
+    return force(car(arguments));
+}
+
+/* A stream is the empty list or a pair of a value and the promise of
+ * the rest, as cons-stream makes it. */
+object *stream_pair_argument(object *obj) {
+    if (!is_pair(obj)) {
+        fprintf(stderr_stream, "stream pair expected\n");
+        end_with_error();
+    }
+    return obj;
+}
+
+object *is_stream_pair_proc(object *arguments) {
+    return (is_pair(car(arguments)) && is_promise(cdar(arguments))) ?
+               true : false;
+}
+
+object *stream_car_proc(object *arguments) {
+    return car(stream_pair_argument(car(arguments)));
+}
+
+object *stream_cdr_proc(object *arguments) {
+    return force(cdr(stream_pair_argument(car(arguments))));
+}
+
+/* what the procedures of define-record-type call, with the record
+ * type and the index of the slot, see record_definition_to_begin */
+object *record_argument(object *obj, object *type) {
+    if (!is_record(obj) || obj->data.record.type != type) {
+        fprintf(stderr_stream, "record of type %s expected\n",
+                type->data.record_type.name->data.symbol.value);
+        end_with_error();
+    }
+    return obj;
+}
+
+object *record_proc(object *arguments) {
+    object *obj;
+    object **slot;
+
+    obj = make_record(car(arguments));
+    for (slot = obj->data.record.slots;
+         !is_the_empty_list(arguments = cdr(arguments));
+         slot++) {
+        *slot = car(arguments);
+    }
+    return obj;
+}
+
+object *is_record_proc(object *arguments) {
+    return (is_record(car(arguments)) &&
+            car(arguments)->data.record.type == cadr(arguments)) ?
+               true : false;
+}
+
+object *record_ref_proc(object *arguments) {
+    return record_argument(car(arguments), cadr(arguments))->
+               data.record.slots[caddr(arguments)->data.fixnum.value];
+}
+
+object *record_set_proc(object *arguments) {
+    record_argument(car(arguments), cadr(arguments))->
+        data.record.slots[caddr(arguments)->data.fixnum.value] =
+            cadddr(arguments);
+    return ok_symbol;
+}
+
+/* How sort compares. Called through, or with < or > on fixnums
+ * straight in C when the procedure is that primitive and the keys
+ * are all fixnums. */
+#define SORT_CALL    0
+#define SORT_LESS    1
+#define SORT_GREATER 2
+
+/* the key of an item, which is the car when list cells are sorted */
+#define sort_key(item, is_cells) ((is_cells) ? car(item) : (item))
+
+int sort_order(object **items, long n, object *less, char is_cells) {
+    int order;
+    long i;
+
+    if (!is_primitive_proc(less)) {
+        return SORT_CALL;
+    }
+    if (less->data.primitive_proc.fn == is_less_than_proc) {
+        order = SORT_LESS;
+    }
+    else if (less->data.primitive_proc.fn == is_greater_than_proc) {
+        order = SORT_GREATER;
+    }
+    else {
+        return SORT_CALL;
+    }
+    for (i = 0; i < n; i++) {
+        if (!is_fixnum(sort_key(items[i], is_cells))) {
+            return SORT_CALL;
+        }
+    }
+    return order;
+}
+
+/* whether a goes strictly before b */
+char is_sorted_before(object *a, object *b, object *less, int order) {
+    region_mark mark;
+    object *result;
+
+    switch (order) {
+        case SORT_LESS:
+            return a->data.fixnum.value < b->data.fixnum.value;
+        case SORT_GREATER:
+            return a->data.fixnum.value > b->data.fixnum.value;
+        default:
+            mark = current_region_mark();
+            result = apply_procedure(less,
+                                     region_cons(a,
+                                                 region_cons(b,
+                                                     the_empty_list)));
+            release_region(mark);
+            return is_true(result);
+    }
+}
+
+/* room for n items to sort and as many again to merge them into */
+object **sort_buffer(long n) {
+    return check_alloc(malloc((n > 0 ? 2 * n : 1) * sizeof(object *)));
+}
+
+/* A bottom-up merge sort, stable as an item of the right run goes
+ * first only if it is strictly before. Merged runs alternate between
+ * the two halves of a sort buffer, and a pair of runs already in
+ * order is copied without merging. Gives back the half the sorted
+ * items end up in. An error in less frees the buffer on its way, so
+ * a sequence is only changed once it is sorted. */
+object **merge_sort(object **items, long n, object *less, char is_cells) {
+    jmp_buf recovery;
+    jmp_buf *outer_recovery;
+    object **from;
+    object **to;
+    object **swap;
+    long width;
+    long lo, mid, hi;
+    long i, j, k;
+    int order;
+
+    if (n < 2) {
+        return items;
+    }
+    outer_recovery = error_recovery;
+    if (outer_recovery != NULL) {
+        if (setjmp(recovery) != 0) {
+            error_recovery = outer_recovery;
+            free(items);
+            end_with_error();
+        }
+        error_recovery = &recovery;
+    }
+    order = sort_order(items, n, less, is_cells);
+    from = items;
+    to = items + n;
+    for (width = 1; width < n; width *= 2) {
+        for (lo = 0; lo < n; lo = hi) {
+            mid = (n - lo > width) ? lo + width : n;
+            hi = (n - mid > width) ? mid + width : n;
+            i = lo;
+            j = mid;
+            k = lo;
+            if (j < hi && !is_sorted_before(sort_key(from[j], is_cells),
+                                            sort_key(from[j - 1], is_cells),
+                                            less, order)) {
+                i = j = hi;
+                memcpy(to + lo, from + lo, (hi - lo) * sizeof(object *));
+            }
+            while (i < mid && j < hi) {
+                if (is_sorted_before(sort_key(from[j], is_cells),
+                                     sort_key(from[i], is_cells),
+                                     less, order)) {
+                    to[k++] = from[j++];
+                }
+                else {
+                    to[k++] = from[i++];
+                }
+            }
+            while (i < mid) {
+                to[k++] = from[i++];
+            }
+            while (j < hi) {
+                to[k++] = from[j++];
+            }
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+    error_recovery = outer_recovery;
+    return from;
+}
+
+/* the cells of the list, or their cars, in a new sort buffer */
+object **list_items(object *list, long *length, char is_cells) {
+    object **items;
+    object *rest;
+    long i;
+
+    *length = 0;
+    for (rest = list; is_pair(rest); rest = cdr(rest)) {
+        (*length)++;
+    }
+    if (!is_the_empty_list(rest)) {
+        fprintf(stderr_stream, "list or vector expected\n");
+        end_with_error();
+    }
+    items = sort_buffer(*length);
+    for (i = 0; i < *length; i++) {
+        items[i] = is_cells ? list : car(list);
+        list = cdr(list);
+    }
+    return items;
+}
+
+/* the elements of the vector in a new sort buffer */
+object **vector_items(object *vector) {
+    object **items;
+
+    items = sort_buffer(vector->data.vector.length);
+    memcpy(items, vector->data.vector.elements,
+           vector->data.vector.length * sizeof(object *));
+    return items;
+}
+
+/* a sorted copy of the list or vector */
+object *sort(object *sequence, object *less) {
+    object *result;
+    object **items;
+    object **sorted;
+    long length;
+
+    if (is_vector(sequence)) {
+        length = sequence->data.vector.length;
+        items = vector_items(sequence);
+        sorted = merge_sort(items, length, less, 0);
+        result = make_vector(length, false);
+        memcpy(result->data.vector.elements, sorted,
+               length * sizeof(object *));
+        free(items);
+        return result;
+    }
+    items = list_items(sequence, &length, 0);
+    sorted = merge_sort(items, length, less, 0);
+    result = the_empty_list;
+    while (length > 0) {
+        result = cons(sorted[--length], result);
+    }
+    free(items);
+    return result;
+}
+
+/* (sort sequence less?) */
+object *sort_proc(object *arguments) {
+    return sort(car(arguments), cadr(arguments));
+}
+
+/* (list-sort less? list) */
+object *list_sort_proc(object *arguments) {
+    return sort(cadr(arguments), car(arguments));
+}
+
+/* (sort! sequence less?) sorts a vector in place, and a list by
+ * linking its cells anew, giving back the first */
+object *sort_in_place_proc(object *arguments) {
+    object *sequence;
+    object **items;
+    object **sorted;
+    long length;
+    long i;
+
+    sequence = car(arguments);
+    if (is_vector(sequence)) {
+        length = sequence->data.vector.length;
+        items = vector_items(sequence);
+        sorted = merge_sort(items, length, cadr(arguments), 0);
+        memcpy(sequence->data.vector.elements, sorted,
+               length * sizeof(object *));
+        free(items);
+        return sequence;
+    }
+    items = list_items(sequence, &length, 1);
+    sorted = merge_sort(items, length, cadr(arguments), 1);
+    if (length > 0) {
+        for (i = 0; i < length - 1; i++) {
+            set_cdr(sorted[i], sorted[i + 1]);
+        }
+        set_cdr(sorted[length - 1], the_empty_list);
+        sequence = sorted[0];
+    }
+    free(items);
+    return sequence;
+}
+
+object *is_eq_proc(object *arguments) {
+    return is_eq(car(arguments), cadr(arguments)) ? true : false;
+}
+
+object *is_equal_proc(object *arguments) {
+    return is_equal(car(arguments), cadr(arguments)) ? true : false;
+}
+
+object *apply_proc(object *arguments) {
+    fprintf(stderr_stream, "illegal state: The body of the apply "
+            "primitive procedure should not execute.\n");
+    end_with_error();
+}
+
+object *interaction_environment_proc(object *arguments) {
+    return the_global_environment;
+}
+
+object *setup_environment(void);
+
+object *null_environment_proc(object *arguments) {
+    return setup_environment();
+}
+
+object *make_environment(void);
+
+object *environment_proc(object *arguments) {
+    return make_environment();
+}
+
+object *eval_proc(object *arguments) {
+    fprintf(stderr_stream, "illegal state: The body of the eval "
+            "primitive procedure should not execute.\n");
+    end_with_error();
+}
+
+object *read(reader *in);
+object *load_files(char **filenames, int count);
+
+object *load_proc(object *arguments) {
+    return load_files(&car(arguments)->data.string.value, 1);
+}
+
+object *load_all_proc(object *arguments) {
+    object *list;
+    char **filenames;
+    int count;
+    object *result;
+    
+    count = 0;
+    for (list = car(arguments); !is_the_empty_list(list);
+         list = cdr(list)) {
+        count++;
+    }
+    filenames = check_alloc(malloc((count + 1) * sizeof(char *)));
+    count = 0;
+    for (list = car(arguments); !is_the_empty_list(list);
+         list = cdr(list)) {
+        filenames[count++] = car(list)->data.string.value;
+    }
+    result = load_files(filenames, count);
+    free(filenames);
+    return result;
+}
+
+object *make_input_port(reader *in);
+
+object *open_input_port_proc(object *arguments) {
+    char *filename;
+    FILE *stream;
+
+    filename = car(arguments)->data.string.value;
+    stream = fopen(filename, "r");
+    if (stream == NULL) {
+        fprintf(stderr_stream, "could not open file \"%s\"\n", filename);
+        end_with_error();
+    }
+    return make_input_port(make_reader(stream));
+}
+
+reader *make_string_reader(char *chars, size_t length);
+
+object *open_input_string_proc(object *arguments) {
+    char *str;
+    
+    str = car(arguments)->data.string.value;
+    return make_input_port(make_string_reader(str, strlen(str)));
+}
+
+object *close_input_port_proc(object *arguments) {
+    int result;
+    
+    result = close_reader(car(arguments)->data.input_port.reader);
+    if (result == EOF) {
+        fprintf(stderr_stream, "could not close input port\n");
+        end_with_error();
+    }
+    return ok_symbol;
+}
+
+char is_input_port(object *obj);
+
+object *is_input_port_proc(object *arguments) {
+    return is_input_port(car(arguments)) ? true : false;
+}
+
+object *read_proc(object *arguments) {
+    reader *in;
+    object *result;
+    
+    in = is_the_empty_list(arguments) ?
+             stdin_reader :
+             car(arguments)->data.input_port.reader;
+    result = read(in);
+    return (result == NULL) ? eof_object : result;
+}
+
+int get_char(reader *in);
+
+object *read_char_proc(object *arguments) {
+    reader *in;
+    int result;
+    
+    in = is_the_empty_list(arguments) ?
+             stdin_reader :
+             car(arguments)->data.input_port.reader;
+    result = get_char(in);
+    return (result == EOF) ? eof_object : make_character(result);
+}
+
+int peek(reader *in);
+
+object *peek_char_proc(object *arguments) {
+    reader *in;
+    int result;
+    
+    in = is_the_empty_list(arguments) ?
+             stdin_reader :
+             car(arguments)->data.input_port.reader;
+    result = peek(in);
+    return (result == EOF) ? eof_object : make_character(result);
+}
+
+char *read_chars(reader *in, size_t count, char is_line, size_t *length);
+
+object *read_line_proc(object *arguments) {
+    reader *in;
+    char *line;
+    size_t length;
+    
+    in = is_the_empty_list(arguments) ?
+             stdin_reader :
+             car(arguments)->data.input_port.reader;
+    line = read_chars(in, (size_t)-1, 1, &length);
+    return (line == NULL) ? eof_object : make_string_of_length(line, length);
+}
+
+object *read_string_proc(object *arguments) {
+    reader *in;
+    long count;
+    char *chars;
+    size_t length;
+    
+    count = car(arguments)->data.fixnum.value;
+    arguments = cdr(arguments);
+    in = is_the_empty_list(arguments) ?
+             stdin_reader :
+             car(arguments)->data.input_port.reader;
+    if (count < 0) {
+        fprintf(stderr_stream, "read-string needs a count of 0 or more\n");
+        end_with_error();
+    }
+    if (count == 0) {
+        return make_string("");
+    }
+    chars = read_chars(in, count, 0, &length);
+    return (chars == NULL) ? eof_object : make_string_of_length(chars, length);
+}
+
+/* reads up to k bytes, fewer only at the end of the port */
+object *read_bytevector_proc(object *arguments) {
+    reader *in;
+    long count;
+    char *chars;
+    size_t length;
+    object *obj;
+    
+    count = fixnum_argument(car(arguments));
+    arguments = cdr(arguments);
+    in = is_the_empty_list(arguments) ?
+             stdin_reader :
+             car(arguments)->data.input_port.reader;
+    if (count < 0) {
+        fprintf(stderr_stream, "read-bytevector needs a count of 0 or more\n");
+        end_with_error();
+    }
+    if (count == 0) {
+        return make_bytevector(0);
+    }
+    chars = read_chars(in, count, 0, &length);
+    if (chars == NULL) {
+        return eof_object;
+    }
+    obj = make_bytevector(length);
+    memcpy(obj->data.bytevector.bytes, chars, length);
+    return obj;
+}
+
+object *apply_procedure(object *procedure, object *arguments);
+
+/* calls the procedure on each line left in the port and returns ok */
+object *port_for_each_line_proc(object *arguments) {
+    object *procedure;
+    reader *in;
+    char *line;
+    size_t length;
+    object *argument;
+    
+    procedure = car(arguments);
+    arguments = cdr(arguments);
+    in = is_the_empty_list(arguments) ?
+             stdin_reader :
+             car(arguments)->data.input_port.reader;
+    while ((line = read_chars(in, (size_t)-1, 1, &length)) != NULL) {
+        argument = cons(make_string_of_length(line, length), the_empty_list);
+        apply_procedure(procedure, argument);
+    }
+    return ok_symbol;
+}
+
+char is_eof_object(object *obj);
+
+object *is_eof_object_proc(object *arguments) {
+    return is_eof_object(car(arguments)) ? true : false;
+}
+
+object *make_output_port(FILE *in);
+
+/* Output ports are fully buffered and written out only when the
+ * buffer fills, by flush-output, at close-output-port or at exit. */
+#define OUTPUT_BUFFER_SIZE 65536
+
+object *open_output_port_proc(object *arguments) {
+    char *filename;
+    FILE *out;
+
+    filename = car(arguments)->data.string.value;
+    out = fopen(filename, "w");
+    if (out == NULL) {
+        fprintf(stderr_stream, "could not open file \"%s\"\n", filename);
+        end_with_error();
+    }
+    setvbuf(out, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    return make_output_port(out);
+}
+
+/* A string port writes to a memory stream where there are those,
+ * which grows its buffer geometrically, and to a temporary file
+ * elsewhere. */
+object *open_output_string_proc(object *arguments) {
+    object *port;
+    FILE *out;
+    
+    port = make_output_port(NULL);
+#ifdef HAVE_MEMSTREAM
+    out = open_memstream(&port->data.output_port.string,
+                         &port->data.output_port.length);
+#else
+    out = tmpfile();
+#endif
+    if (out == NULL) {
+        fprintf(stderr_stream, "could not open string port\n");
+        end_with_error();
+    }
+    port->data.output_port.stream = out;
+    return port;
+}
+
+object *get_output_string_proc(object *arguments) {
+    object *port;
+    FILE *out;
+#ifndef HAVE_MEMSTREAM
+    long length;
+#endif
+    
+    port = car(arguments);
+    out = port->data.output_port.stream;
+    if (fflush(out) == EOF) {
+        fprintf(stderr_stream, "could not flush output port\n");
+        end_with_error();
+    }
+#ifndef HAVE_MEMSTREAM
+    length = ftell(out);
+    port->data.output_port.string =
+        check_alloc(realloc(port->data.output_port.string, length + 1));
+    rewind(out);
+    port->data.output_port.length =
+        fread(port->data.output_port.string, 1, length, out);
+    fseek(out, 0, SEEK_END);
+#endif
+    return make_string_of_length(port->data.output_port.string,
+                                 port->data.output_port.length);
+}
+
+object *close_output_port_proc(object *arguments) {
+    int result;
+    
+    result = fclose(car(arguments)->data.output_port.stream);
+    if (result == EOF) {
+        fprintf(stderr_stream, "could not close output port\n");
+        end_with_error();
+    }
+    free(car(arguments)->data.output_port.string);
+    return ok_symbol;
+}
+
+char is_output_port(object *obj);
+
+object *is_output_port_proc(object *arguments) {
+    return is_output_port(car(arguments)) ? true : false;
+}
+
+object *write_char_proc(object *arguments) {
+    object *character;
+    FILE *out;
+    
+    character = car(arguments);
+    arguments = cdr(arguments);
+    out = is_the_empty_list(arguments) ?
+             stdout_stream :
+             car(arguments)->data.output_port.stream;
+    putc(character->data.character.value, out);    
+    return ok_symbol;
+}
+
+object *write_string_proc(object *arguments) {
+    char *str;
+    FILE *out;
+    
+    str = car(arguments)->data.string.value;
+    arguments = cdr(arguments);
+    out = is_the_empty_list(arguments) ?
+             stdout_stream :
+             car(arguments)->data.output_port.stream;
+    fputs(str, out);
+    return ok_symbol;
+}
+
+object *write_bytevector_proc(object *arguments) {
+    object *obj;
+    FILE *out;
+    
+    obj = bytevector_argument(car(arguments));
+    arguments = cdr(arguments);
+    out = is_the_empty_list(arguments) ?
+             stdout_stream :
+             car(arguments)->data.output_port.stream;
+    fwrite(obj->data.bytevector.bytes, 1, obj->data.bytevector.length, out);
+    return ok_symbol;
+}
+
+object *flush_output_proc(object *arguments) {
+    FILE *out;
+    
+    out = is_the_empty_list(arguments) ?
+             stdout_stream :
+             car(arguments)->data.output_port.stream;
+    if (fflush(out) == EOF) {
+        fprintf(stderr_stream, "could not flush output port\n");
+        end_with_error();
+    }
+    return ok_symbol;
+}
+
+void write(FILE *out, object *obj);
+
+object *write_proc(object *arguments) {
+    object *exp;
+    FILE *out;
+    
+    exp = car(arguments);
+    arguments = cdr(arguments);
+    out = is_the_empty_list(arguments) ?
+             stdout_stream :
+             car(arguments)->data.output_port.stream;
+    write(out, exp);
+    return ok_symbol;
+}
+
+object *read_fasl(reader *in);
+
+object *read_fasl_proc(object *arguments) {
+    reader *in;
+    object *result;
+    
+    in = is_the_empty_list(arguments) ?
+             stdin_reader :
+             car(arguments)->data.input_port.reader;
+    result = read_fasl(in);
+    return (result == NULL) ? eof_object : result;
+}
+
+void write_fasl(FILE *out, object *obj);
+
+object *write_fasl_proc(object *arguments) {
+    object *exp;
+    FILE *out;
+    
+    exp = car(arguments);
+    arguments = cdr(arguments);
+    out = is_the_empty_list(arguments) ?
+             stdout_stream :
+             car(arguments)->data.output_port.stream;
+    write_fasl(out, exp);
+    return ok_symbol;
+}
+
+object *error_proc(object *arguments) {
+    while (!is_the_empty_list(arguments)) {
+        write(stderr_stream, car(arguments));
+        fprintf(stderr_stream, " ");
+        arguments = cdr(arguments);
+    };
+    if (error_recovery == NULL) {
+        printf("\nexiting\n");
+    }
+    end_with_error();
+}
+
+object *make_compound_proc(object* env, object *info) {
+    object *obj;
+    
+    obj = alloc_object();
+    obj->type = COMPOUND_PROC;
+    obj->data.compound_proc.env = env;
+    obj->data.compound_proc.info = info;
+    return obj;
+}
+
+char is_compound_proc(object *obj) {
+    return obj->type == COMPOUND_PROC;
+}
+
+object *make_input_port(reader *in) {
+    object *obj;
+    
+    obj = alloc_object();
+    obj->type = INPUT_PORT;
+    obj->data.input_port.reader = in;
+    return obj;
+}
+
+char is_input_port(object *obj) {
+    return obj->type == INPUT_PORT;
+}
+
+object *make_output_port(FILE *stream) {
+    object *obj;
+    
+    obj = alloc_object();
+    obj->type = OUTPUT_PORT;
+    obj->data.output_port.stream = stream;
+    obj->data.output_port.string = NULL;
+    obj->data.output_port.length = 0;
+    return obj;
+}
+
+char is_output_port(object *obj) {
+    return obj->type == OUTPUT_PORT;
+}
+
+char is_eof_object(object *obj) {
+    return obj == eof_object;
+}
+
+object *enclosing_environment(object *env) {
+    return cdr(env);
+}
+
+object *first_frame(object *env) {
+    return car(env);
+}
+
+object *make_frame(object *variables, object *values) {
+    return cons(variables, values);
+}
+
+object *frame_variables(object *frame) {
+    return car(frame);
+}
+
+object *frame_values(object *frame) {
+    return cdr(frame);
+}
+
+void add_binding_to_frame(object *var, object *val, 
+                          object *frame) {
+    set_car(frame, cons(var, car(frame)));
+    set_cdr(frame, cons(val, cdr(frame)));
+}
+
+object *extend_environment(object *vars, object *vals,
+                           object *base_env) {
+    return cons(make_frame(vars, vals), base_env);
+}
+
+object *extend_region_environment(object *vars, object *vals,
+                                  object *base_env) {
+    return region_cons(region_cons(vars, vals), base_env);
+}
+
+/* Bindings that are both assigned and captured by a closure hold
+ * their value in a box, so the closure's copy of the binding and the
+ * frame it came from share it. */
+object *make_box(object *value) {
+    object *obj;
+    
+    obj = alloc_object();
+    obj->type = BOX;
+    obj->data.box.value = value;
+    return obj;
+}
+
+char is_box(object *obj) {
+    return obj->type == BOX;
+}
+
+object *binding_value(object *binding) {
+    object *value;
+    
+    value = car(binding);
+    return is_box(value) ? value->data.box.value : value;
+}
+
+void set_binding_value(object *binding, object *val) {
+    if (is_box(car(binding))) {
+        car(binding)->data.box.value = val;
+    }
+    else {
+        set_car(binding, val);
+    }
+}
+
+/* the cell holding the value of var in the frames of env before
+ * stop_env, or NULL */
+object *find_binding(object *var, object *env, object *stop_env) {
+    object *frame;
+    object *vars;
+    object *vals;
+
+    while (env != stop_env) {
+        frame = first_frame(env);
+        vars = frame_variables(frame);
+        vals = frame_values(frame);
+        while (!is_the_empty_list(vars)) {
+            if (var == car(vars)) {
+                return vals;
+            }
+            vars = cdr(vars);
+            vals = cdr(vals);
+        }
+        env = enclosing_environment(env);
+    }
+    return NULL;
+}
+
+object *lookup_variable_value(object *var, object *env) {
+    object *binding;
+    object *value;
+    
+    binding = find_binding(var, env, the_empty_environment);
+    if (binding == NULL) {
+        fprintf(stderr_stream, "unbound variable, %s\n",
+                var->data.symbol.value);
+        end_with_error();
+    }
+    value = binding_value(binding);
+    if (value == unassigned) {
+        fprintf(stderr_stream, "unassigned variable, %s\n",
+                var->data.symbol.value);
+        end_with_error();
+    }
+    return value;
+}
+
+/* Bumped whenever a binding a call site may have cached changes.
+ * Only variables never bound locally are cached, and they can only
+ * be bound in an outermost frame. */
+long binding_version = 0;
+
+/* bumped when a binding threaded code was compiled against changes */
+long assumption_version = 0;
+
+void note_binding_change(object *var) {
+    if (!var->data.symbol.is_bound_locally) {
+        binding_version++;
+    }
+    if (var->data.symbol.is_assumed) {
+        assumption_version++;
+    }
+}
+
+void note_bound_locally(object *var) {
+    if (!var->data.symbol.is_bound_locally) {
+        var->data.symbol.is_bound_locally = 1;
+        binding_version++;
+    }
+}
+
+void set_variable_value(object *var, object *val, object *env) {
+    object *binding;
+    
+    binding = find_binding(var, env, the_empty_environment);
+    if (binding == NULL) {
+        fprintf(stderr_stream, "unbound variable, %s\n",
+                var->data.symbol.value);
+        end_with_error();
+    }
+    set_binding_value(binding, val);
+    note_binding_change(var);
+}
+
+void define_variable(object *var, object *val, object *env) {
+    object *binding;
+    
+    note_binding_change(var);
+    binding = find_binding(var, env, enclosing_environment(env));
+    if (binding == NULL) {
+        add_binding_to_frame(var, val, first_frame(env));
+    }
+    else {
+        set_binding_value(binding, val);
+    }
+}
+
+object *outermost_environment(object *env) {
+    while (!is_the_empty_list(enclosing_environment(env))) {
+        env = enclosing_environment(env);
+    }
+    return env;
+}
+
+object *setup_environment(void) {
+    object *initial_env;
+    
+    initial_env = extend_environment(
+                      the_empty_list,
+                      the_empty_list,
+                      the_empty_environment);
+    return initial_env;
+}
+
+void populate_environment(object *env) {
+
+#define add_procedure(scheme_name, c_name)              \
+    define_variable(make_symbol(scheme_name),           \
+                    make_primitive_proc(c_name),        \
+                    env);
+
+    add_procedure("null?"      , is_null_proc);
+    add_procedure("boolean?"   , is_boolean_proc);
+    add_procedure("symbol?"    , is_symbol_proc);
+    add_procedure("integer?"   , is_integer_proc);
+    add_procedure("fixnum?"    , is_fixnum_proc);
+    add_procedure("char?"      , is_char_proc);
+    add_procedure("string?"    , is_string_proc);
+    add_procedure("pair?"      , is_pair_proc);
+    add_procedure("procedure?" , is_procedure_proc);
+    
+    add_procedure("char->integer" , char_to_integer_proc);
+    add_procedure("integer->char" , integer_to_char_proc);
+    add_procedure("number->string", number_to_string_proc);
+    add_procedure("string->number", string_to_number_proc);
+    add_procedure("symbol->string", symbol_to_string_proc);
+    add_procedure("string->symbol", string_to_symbol_proc);
+
+    add_procedure("string-length"        , string_length_proc);
+    add_procedure("string-ref"           , string_ref_proc);
+    add_procedure("substring"            , substring_proc);
+    add_procedure("string-append"        , string_append_proc);
+    add_procedure("string-join"          , string_join_proc);
+    add_procedure("string-split"         , string_split_proc);
+    add_procedure("string-index"         , string_index_proc);
+    add_procedure("string-search-forward", string_search_forward_proc);
+    add_procedure("string-upcase"        , string_upcase_proc);
+    add_procedure("string-downcase"      , string_downcase_proc);
+    add_procedure("string=?"             , is_string_equal_proc);
+    add_procedure("string<?"             , is_string_less_than_proc);
+    add_procedure("string-ci=?"          , is_string_ci_equal_proc);
+    add_procedure("string-ci<?"          , is_string_ci_less_than_proc);
+      
+    add_procedure("+"        , add_proc);
+    add_procedure("-"        , sub_proc);
+    add_procedure("*"        , mul_proc);
+    add_procedure("quotient" , quotient_proc);
+    add_procedure("remainder", remainder_proc);
+    add_procedure("="        , is_number_equal_proc);
+    add_procedure("<"        , is_less_than_proc);
+    add_procedure(">"        , is_greater_than_proc);
+
+    add_procedure("cons"    , cons_proc);
+    add_procedure("car"     , car_proc);
+    add_procedure("cdr"     , cdr_proc);
+    add_procedure("set-car!", set_car_proc);
+    add_procedure("set-cdr!", set_cdr_proc);
+    add_procedure("list"    , list_proc);
+
+    add_procedure("vector?"      , is_vector_proc);
+    add_procedure("make-vector"  , make_vector_proc);
+    add_procedure("vector"       , vector_proc);
+    add_procedure("vector-length", vector_length_proc);
+    add_procedure("vector-ref"   , vector_ref_proc);
+    add_procedure("vector-set!"  , vector_set_proc);
+    add_procedure("vector->list" , vector_to_list_proc);
+    add_procedure("list->vector" , list_to_vector_proc);
+    add_procedure("vector-fill!" , vector_fill_proc);
+
+    add_procedure("sort"     , sort_proc);
+    add_procedure("sort!"    , sort_in_place_proc);
+    add_procedure("list-sort", list_sort_proc);
+
+    add_procedure("bytevector?"       , is_bytevector_proc);
+    add_procedure("make-bytevector"   , make_bytevector_proc);
+    add_procedure("bytevector"        , bytevector_proc);
+    add_procedure("bytevector-length" , bytevector_length_proc);
+    add_procedure("bytevector-u8-ref" , bytevector_u8_ref_proc);
+    add_procedure("bytevector-u8-set!", bytevector_u8_set_proc);
+    add_procedure("bytevector-copy!"  , bytevector_copy_to_proc);
+    add_procedure("bytevector-fill!"  , bytevector_fill_proc);
+    add_procedure("bytevector=?"      , is_bytevector_equal_proc);
+
+    add_procedure("s64vector?"        , is_s64vector_proc);
+    add_procedure("make-s64vector"    , make_s64vector_proc);
+    add_procedure("s64vector"         , s64vector_proc);
+    add_procedure("s64vector-length"  , s64vector_length_proc);
+    add_procedure("s64vector-ref"     , s64vector_ref_proc);
+    add_procedure("s64vector-set!"    , s64vector_set_proc);
+    add_procedure("s64vector->list"   , s64vector_to_list_proc);
+    add_procedure("list->s64vector"   , list_to_s64vector_proc);
+    add_procedure("s64vector-add"     , s64vector_add_proc);
+    add_procedure("s64vector-sub"     , s64vector_sub_proc);
+    add_procedure("s64vector-and"     , s64vector_and_proc);
+    add_procedure("s64vector-or"      , s64vector_or_proc);
+    add_procedure("s64vector-xor"     , s64vector_xor_proc);
+    add_procedure("s64vector-sum"     , s64vector_sum_proc);
+    add_procedure("s64vector-min"     , s64vector_min_proc);
+    add_procedure("s64vector-max"     , s64vector_max_proc);
+    add_procedure("s64vector-dot"     , s64vector_dot_proc);
+    add_procedure("s64vector-popcount", s64vector_popcount_proc);
+
+    add_procedure("make-eq-hash-table"    , make_eq_hash_table_proc);
+    add_procedure("make-eqv-hash-table"   , make_eq_hash_table_proc);
+    add_procedure("make-equal-hash-table" , make_equal_hash_table_proc);
+    add_procedure("hash-table?"           , is_hash_table_proc);
+    add_procedure("hash-table-ref"        , hash_table_ref_proc);
+    add_procedure("hash-table-ref/default", hash_table_ref_default_proc);
+    add_procedure("hash-table-set!"       , hash_table_set_proc);
+    add_procedure("hash-table-delete!"    , hash_table_delete_proc);
+    add_procedure("hash-table-count"      , hash_table_count_proc);
+    add_procedure("hash-table-walk"       , hash_table_walk_proc);
+
+    add_procedure("make-promise", make_promise_proc);
+    add_procedure("promise?"    , is_promise_proc);
+    add_procedure("force"       , force_proc);
+    add_procedure("stream-pair?", is_stream_pair_proc);
+    add_procedure("stream-null?", is_null_proc);
+    add_procedure("stream-car"  , stream_car_proc);
+    add_procedure("stream-cdr"  , stream_cdr_proc);
+    define_variable(make_symbol("the-empty-stream"), the_empty_list, env);
+
+    add_procedure("eq?"   , is_eq_proc);
+    add_procedure("eqv?"  , is_eq_proc);
+    add_procedure("equal?", is_equal_proc);
+
+    add_procedure("apply", apply_proc);
+    
+    add_procedure("interaction-environment", 
+                                     interaction_environment_proc);
+    add_procedure("null-environment", null_environment_proc);
+    add_procedure("environment"     , environment_proc);
+    add_procedure("eval"            , eval_proc);
+
+    add_procedure("load"             , load_proc);
+    add_procedure("load-all"         , load_all_proc);
+    add_procedure("open-input-port"  , open_input_port_proc);
+    add_procedure("close-input-port" , close_input_port_proc);
+    add_procedure("input-port?"      , is_input_port_proc);
+    add_procedure("read"             , read_proc);
+    add_procedure("read-char"        , read_char_proc);
+    add_procedure("peek-char"        , peek_char_proc);
+    add_procedure("read-line"        , read_line_proc);
+    add_procedure("read-string"      , read_string_proc);
+    add_procedure("read-bytevector"  , read_bytevector_proc);
+    add_procedure("port-for-each-line", port_for_each_line_proc);
+    add_procedure("eof-object?"      , is_eof_object_proc);
+    add_procedure("open-output-port" , open_output_port_proc);
+    add_procedure("close-output-port", close_output_port_proc);
+    add_procedure("open-input-string", open_input_string_proc);
+    add_procedure("open-output-string", open_output_string_proc);
+    add_procedure("get-output-string", get_output_string_proc);
+    add_procedure("output-port?"     , is_output_port_proc);
+    add_procedure("write-char"       , write_char_proc);
+    add_procedure("write"            , write_proc);
+    add_procedure("write-string"     , write_string_proc);
+    add_procedure("write-bytevector" , write_bytevector_proc);
+    add_procedure("flush-output"     , flush_output_proc);
+    add_procedure("read-fasl"        , read_fasl_proc);
+    add_procedure("write-fasl"       , write_fasl_proc);
+
+    add_procedure("error", error_proc);
+}
+
+object *make_environment(void) {
+    object *env;
+    
+    env = setup_environment();
+    populate_environment(env);
+    return env;
+}
+
+void init_primitive_types(void);
+void init_char_classes(void);
+
+object *make_uninterned_symbol(char *name) {
+    object *obj;
+
+    obj = alloc_object();
+    obj->type = SYMBOL;
+    obj->data.symbol.value = name;
+    obj->data.symbol.is_bound_locally = 0;
+    obj->data.symbol.is_assumed = 0;
+    obj->data.symbol.hash = 0;
+    return obj;
+}
+
+void init(void) {
+    the_empty_list = alloc_object();
+    the_empty_list->type = THE_EMPTY_LIST;
+
+    false = alloc_object();
+    false->type = BOOLEAN;
+    false->data.boolean.value = 0;
+
+    true = alloc_object();
+    true->type = BOOLEAN;
+    true->data.boolean.value = 1;
+    
+    init_characters();
+    
+    symbol_table_size = 256;
+    symbol_table = alloc_symbol_table(symbol_table_size);
+    symbol_count = 0;
+    quote_symbol = make_symbol("quote");
+    define_symbol = make_symbol("define");
+    set_symbol = make_symbol("set!");
+    ok_symbol = make_symbol("ok");
     if_symbol = make_symbol("if");
     lambda_symbol = make_symbol("lambda");
     begin_symbol = make_symbol("begin");
@@ -923,576 +4618,5590 @@ void init(void) {
     let_symbol = make_symbol("let");
     and_symbol = make_symbol("and");
     or_symbol = make_symbol("or");
+    delay_symbol = make_symbol("delay");
+    delay_force_symbol = make_symbol("delay-force");
+    cons_stream_symbol = make_symbol("cons-stream");
+    define_record_type_symbol = make_symbol("define-record-type");
+    
+    /* called by what the lazy and record special forms become, whatever
+     * programs bind the names to */
+    delay_procedure = make_primitive_proc(delay_proc);
+    delay_force_procedure = make_primitive_proc(delay_force_proc);
+    cons_procedure = make_primitive_proc(cons_proc);
+    record_procedure = make_primitive_proc(record_proc);
+    is_record_procedure = make_primitive_proc(is_record_proc);
+    record_ref_procedure = make_primitive_proc(record_ref_proc);
+    record_set_procedure = make_primitive_proc(record_set_proc);
+    
+    eof_object = alloc_object();
+    eof_object->type = EOF_OBJECT;
+    
+    /* not interned so no program can get hold of them */
+    unassigned = make_uninterned_symbol("unassigned");
+    record_variable = make_uninterned_symbol("record");
+    value_variable = make_uninterned_symbol("value");
+    
+    the_empty_environment = the_empty_list;
+
+    region_top = alloc_region_chunk();
+    stdin_reader = make_reader(stdin);
+    stdout_stream = stdout;
+    stderr_stream = stderr;
+    init_char_classes();
+    init_s64_kernels();
+    init_primitive_types();
+
+    the_global_environment = make_environment();
+}
+
+/***************************** READ ******************************/
+
+/* what the reader needs to know of each character, looked up
+ * instead of asked of the C library for each one */
+#define CHAR_SPACE     1
+#define CHAR_DELIMITER 2
+#define CHAR_INITIAL   4
+#define CHAR_DIGIT     8
+#define CHAR_SYMBOL    16 /* can follow the first character of one */
+#define CHAR_STRING    32 /* stands for itself in a string */
+#define CHAR_COMMENT   64 /* does not end a comment */
+
+char char_classes[256];
+
+/* Runs of whitespace, comments, strings and digits are skipped 32
+ * or 16 bytes at a time where the processor allows, AVX2 or SSE2
+ * being picked when the program starts, and a byte at a time
+ * through the table otherwise. Each such class is a range of bytes
+ * and two more bytes, or all bytes but those, compared against
+ * vectors made once in init_vector_classes. The compares are
+ * signed, so only ASCII is ever in a range, as in the table for
+ * the C locale. Symbols are too short to be worth it. */
+
+char *skip_char_run_scalar(char *p, char *end, int class) {
+    while (p < end && (char_classes[(unsigned char)*p] & class)) {
+        p++;
+    }
+    return p;
+}
+
+char *(*skip_char_run)(char *p, char *end, int class) =
+    skip_char_run_scalar;
+
+#ifdef USE_SIMD_SCAN
+
+/* indexed by the number of the class bit */
+struct vector_class {
+    char is_known;
+    char low, high, one, other;
+    char is_negated;
+} vector_classes[7];
+
+__m128i sse2_classes[7][4];
+__m256i avx2_classes[7][4];
+
+void define_vector_class(int class, char low, char high,
+                         char one, char other, char is_negated) {
+    struct vector_class *vc = &vector_classes[__builtin_ctz(class)];
+    
+    vc->is_known = 1;
+    vc->low = low;
+    vc->high = high;
+    vc->one = one;
+    vc->other = other;
+    vc->is_negated = is_negated;
+}
+
+char *skip_char_run_sse2(char *p, char *end, int class) {
+    int i = __builtin_ctz(class);
+    __m128i *v = sse2_classes[i];
+    __m128i x, in;
+    unsigned int outside;
+    unsigned int negated;
+    
+    if (!vector_classes[i].is_known) {
+        return skip_char_run_scalar(p, end, class);
+    }
+    negated = vector_classes[i].is_negated ? 0xffff : 0;
+    while (end - p >= 16) {
+        x = _mm_loadu_si128((__m128i *)p);
+        in = _mm_or_si128(
+                 _mm_and_si128(_mm_cmpgt_epi8(x, v[0]),
+                               _mm_cmplt_epi8(x, v[1])),
+                 _mm_or_si128(_mm_cmpeq_epi8(x, v[2]),
+                              _mm_cmpeq_epi8(x, v[3])));
+        outside = (_mm_movemask_epi8(in) ^ negated ^ 0xffff) & 0xffff;
+        if (outside != 0) {
+            return p + __builtin_ctz(outside);
+        }
+        p += 16;
+    }
+    return skip_char_run_scalar(p, end, class);
+}
+
+__attribute__((target("avx2")))
+char *skip_char_run_avx2(char *p, char *end, int class) {
+    int i = __builtin_ctz(class);
+    __m256i *v = avx2_classes[i];
+    __m256i x, in;
+    unsigned int outside;
+    unsigned int negated;
+    
+    if (!vector_classes[i].is_known) {
+        return skip_char_run_scalar(p, end, class);
+    }
+    negated = vector_classes[i].is_negated ? 0xffffffff : 0;
+    while (end - p >= 32) {
+        x = _mm256_loadu_si256((__m256i *)p);
+        in = _mm256_or_si256(
+                 _mm256_and_si256(_mm256_cmpgt_epi8(x, v[0]),
+                                  _mm256_cmpgt_epi8(v[1], x)),
+                 _mm256_or_si256(_mm256_cmpeq_epi8(x, v[2]),
+                                 _mm256_cmpeq_epi8(x, v[3])));
+        outside = ~((unsigned int)_mm256_movemask_epi8(in) ^ negated);
+        if (outside != 0) {
+            return p + __builtin_ctz(outside);
+        }
+        p += 32;
+    }
+    return skip_char_run_sse2(p, end, class);
+}
+
+__attribute__((target("avx2")))
+void init_avx2_classes(void) {
+    struct vector_class *vc;
+    int i;
+    
+    for (i = 0; i < 7; i++) {
+        vc = &vector_classes[i];
+        avx2_classes[i][0] = _mm256_set1_epi8(vc->low - 1);
+        avx2_classes[i][1] = _mm256_set1_epi8(vc->high + 1);
+        avx2_classes[i][2] = _mm256_set1_epi8(vc->one);
+        avx2_classes[i][3] = _mm256_set1_epi8(vc->other);
+    }
+}
+
+void init_vector_classes(void) {
+    struct vector_class *vc;
+    int i;
+    
+    define_vector_class(CHAR_SPACE,   '\t', '\r', ' ', ' ', 0);
+    define_vector_class(CHAR_DIGIT,   '0', '9', '0', '0', 0);
+    define_vector_class(CHAR_STRING,  '"', '"', '\\', '\\', 1);
+    define_vector_class(CHAR_COMMENT, '\n', '\n', '\n', '\n', 1);
+    for (i = 0; i < 7; i++) {
+        vc = &vector_classes[i];
+        sse2_classes[i][0] = _mm_set1_epi8(vc->low - 1);
+        sse2_classes[i][1] = _mm_set1_epi8(vc->high + 1);
+        sse2_classes[i][2] = _mm_set1_epi8(vc->one);
+        sse2_classes[i][3] = _mm_set1_epi8(vc->other);
+    }
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        init_avx2_classes();
+        skip_char_run = skip_char_run_avx2;
+    }
+    else {
+        skip_char_run = skip_char_run_sse2;
+    }
+}
+
+#endif
+
+void init_char_classes(void) {
+    int c;
+    
+    for (c = 0; c < 256; c++) {
+        char_classes[c] =
+            (isspace(c) ? CHAR_SPACE : 0) |
+            ((isspace(c) || c == '(' || c == ')' ||
+              c == '"' || c == ';') ? CHAR_DELIMITER : 0) |
+            ((isalpha(c) || c == '*' || c == '/' || c == '>' ||
+              c == '<' || c == '=' || c == '?' || c == '!') ?
+                 CHAR_INITIAL : 0) |
+            (isdigit(c) ? CHAR_DIGIT : 0);
+        if (char_classes[c] & (CHAR_INITIAL | CHAR_DIGIT) ||
+            c == '+' || c == '-') {
+            char_classes[c] |= CHAR_SYMBOL;
+        }
+        if (c != '"' && c != '\\') {
+            char_classes[c] |= CHAR_STRING;
+        }
+        if (c != '\n') {
+            char_classes[c] |= CHAR_COMMENT;
+        }
+    }
+#ifdef USE_SIMD_SCAN
+    init_vector_classes();
+#endif
+}
+
+char has_char_class(int c, int class) {
+    return c != EOF && (char_classes[c] & class);
+}
+
+char is_delimiter(int c) {
+    return c == EOF || has_char_class(c, CHAR_DELIMITER);
+}
+
+char is_initial(int c) {
+    return has_char_class(c, CHAR_INITIAL);
+}
+
+int peek(reader *in) {
+    return (in->next < in->end) ?
+               (unsigned char)*in->next :
+               refill_reader(in);
+}
+
+int get_char(reader *in) {
+    int c;
+    
+    if (in->next < in->end) {
+        return (unsigned char)*in->next++;
+    }
+    c = refill_reader(in);
+    if (c != EOF) {
+        in->next++;
+    }
+    return c;
+}
+
+void unget_char(int c, reader *in) {
+    if (c != EOF) {
+        in->next--;
+    }
+}
+
+void reserve_token(reader *in, size_t length);
+
+/* Takes up to count characters, or up to a newline if is_line, which
+ * is consumed but not kept. What lies whole in the buffer is handed
+ * back in place, anything longer is gathered in the token buffer.
+ * Returns NULL at the end of the input. */
+char *read_chars(reader *in, size_t count, char is_line, size_t *length) {
+    char *start;
+    char *stop;
+    char *newline;
+    size_t i;
+    
+    if (count == 0 || peek(in) == EOF) {
+        return NULL;
+    }
+    i = 0;
+    while (1) {
+        start = in->next;
+        stop = ((size_t)(in->end - start) > count - i) ?
+                   start + (count - i) : in->end;
+        newline = is_line ? memchr(start, '\n', stop - start) : NULL;
+        if (newline != NULL) {
+            stop = newline;
+        }
+        in->next = (newline != NULL) ? newline + 1 : stop;
+        if (i == 0 && (newline != NULL || (size_t)(stop - start) == count)) {
+            *length = stop - start;
+            return start;
+        }
+        reserve_token(in, i + (stop - start));
+        memcpy(in->token + i, start, stop - start);
+        i += stop - start;
+        if (newline != NULL || i == count || peek(in) == EOF) {
+            *length = i;
+            return in->token;
+        }
+    }
+}
+
+/* the number of characters of class from the next one on, as far
+ * as the buffer goes */
+int char_run(reader *in, int class) {
+    return skip_char_run(in->next, in->end, class) - in->next;
+}
+
+/* whether a run of characters read out to the end of the buffer may
+ * go on after a refill */
+char may_continue_run(reader *in) {
+    return in->next == in->end && peek(in) != EOF;
+}
+
+void eat_whitespace(reader *in) {
+    int c;
+    
+    while (1) {
+        in->next = skip_char_run(in->next, in->end, CHAR_SPACE);
+        c = peek(in);
+        if (c == ';') { /* comments are whitespace also */
+            do {
+                in->next = skip_char_run(in->next, in->end, CHAR_COMMENT);
+            } while (may_continue_run(in));
+            continue;
+        }
+        if (c == EOF || !(char_classes[c] & CHAR_SPACE)) {
+            break;
+        }
+    }
+}
+
+void fail_read_ahead(struct read_ahead *ahead, char *message);
+
+/* Reports what is wrong with the input and exits, unless reading
+ * ahead for a load, when the forms before it are evaluated first.
+ * The format has at most the one character c to show. */
+void read_error(reader *in, char *format, int c) {
+    char message[128];
+    
+    sprintf(message, format, c);
+#ifdef HAVE_PTHREADS
+    if (in->ahead != NULL) {
+        fail_read_ahead(in->ahead, message);
+    }
+#endif
+    fputs(message, stderr_stream);
+    end_with_error();
+}
+
+void eat_expected_string(reader *in, char *str) {
+    int c;
+
+    while (*str != '\0') {
+        c = get_char(in);
+        if (c != *str) {
+            read_error(in, "unexpected character '%c'\n", c);
+        }
+        str++;
+    }
+}
+
+void peek_expected_delimiter(reader *in) {
+    if (!is_delimiter(peek(in))) {
+        read_error(in, "character not followed by delimiter\n", 0);
+    }
+}
+
+object *read_character(reader *in) {
+    int c;
+
+    c = get_char(in);
+    switch (c) {
+        case EOF:
+            read_error(in, "incomplete character literal\n", 0);
+        case 's':
+            if (peek(in) == 'p') {
+                eat_expected_string(in, "pace");
+                peek_expected_delimiter(in);
+                return make_character(' ');
+            }
+            break;
+        case 'n':
+            if (peek(in) == 'e') {
+                eat_expected_string(in, "ewline");
+                peek_expected_delimiter(in);
+                return make_character('\n');
+            }
+            break;
+    }
+    peek_expected_delimiter(in);
+    return make_character(c);
+}
+
+/* reads the elements after the open paren in a loop, appending each
+ * to the last pair, so a list can be as long as memory allows */
+object *read_pair(reader *in) {
+    int c;
+    object *list;
+    object *last;
+    object *pair;
+    
+    list = the_empty_list;
+    last = NULL;
+    while (1) {
+        eat_whitespace(in);
+        c = get_char(in);
+        if (c == ')') {
+            return list;
+        }
+        if (c == EOF) {
+            read_error(in, "non-terminated list\n", 0);
+        }
+        if (c == '.' && last != NULL) { /* read improper list */
+            c = peek(in);
+            if (!is_delimiter(c)) {
+                read_error(in, "dot not followed by delimiter\n", 0);
+            }
+            set_cdr(last, read(in));
+            eat_whitespace(in);
+            c = get_char(in);
+            if (c != ')') {
+                read_error(in, "where was the trailing right paren?\n", 0);
+            }
+            return list;
+        }
+        unget_char(c, in);
+        pair = cons(read(in), the_empty_list);
+        if (last == NULL) {
+            list = pair;
+        }
+        else {
+            set_cdr(last, pair);
+        }
+        last = pair;
+    }
+}
+
+object *list_to_vector(object *list);
+
+object *read_vector(reader *in) {
+    object *list;
+    object *rest;
+    
+    list = read_pair(in);
+    rest = list;
+    while (is_pair(rest)) {
+        rest = cdr(rest);
+    }
+    if (!is_the_empty_list(rest)) {
+        read_error(in, "dot in vector literal\n", 0);
+    }
+    return list_to_vector(list);
+}
+
+object *list_to_bytevector(object *list);
+
+/* after "#u8", which is followed by the bytes in parentheses */
+object *read_bytevector(reader *in) {
+    object *list;
+    object *rest;
+    
+    if (get_char(in) != '(') {
+        read_error(in, "bytevector literal expects \"(\" after #u8\n", 0);
+    }
+    list = read_pair(in);
+    for (rest = list; is_pair(rest); rest = cdr(rest)) {
+        if (!is_fixnum(car(rest)) || car(rest)->data.fixnum.value < 0 ||
+            car(rest)->data.fixnum.value > 255) {
+            read_error(in, "byte expected in bytevector literal\n", 0);
+        }
+    }
+    if (!is_the_empty_list(rest)) {
+        read_error(in, "dot in bytevector literal\n", 0);
+    }
+    return list_to_bytevector(list);
+}
+
+object *list_to_s64vector(object *list);
+
+/* after "#s", which is followed by "64" and the elements in
+ * parentheses */
+object *read_s64vector(reader *in) {
+    object *list;
+    object *rest;
+    
+    if (get_char(in) != '6' || get_char(in) != '4' || get_char(in) != '(') {
+        read_error(in, "s64vector literal expects \"64(\" after #s\n", 0);
+    }
+    list = read_pair(in);
+    for (rest = list; is_pair(rest); rest = cdr(rest)) {
+        if (!is_fixnum(car(rest))) {
+            read_error(in, "fixnum expected in s64vector literal\n", 0);
+        }
+    }
+    if (!is_the_empty_list(rest)) {
+        read_error(in, "dot in s64vector literal\n", 0);
+    }
+    return list_to_s64vector(list);
+}
+
+/* makes room in the reader's token for length characters and the
+ * '\0' terminator, growing it as symbols and strings need */
+void reserve_token(reader *in, size_t length) {
+    if (length < in->token_size) {
+        return;
+    }
+    if (in->token_size == 0) {
+        in->token_size = 256;
+    }
+    while (length >= in->token_size) {
+        in->token_size *= 2;
+    }
+    in->token = check_alloc(realloc(in->token, in->token_size));
+}
+
+object *read(reader *in) {
+    int c;
+    short sign = 1;
+    size_t i;
+    int n;
+    int digit;
+    long num = 0;
+    long next;
+
+    eat_whitespace(in);
+
+    c = get_char(in);    
+
+    if (c == '#') { /* read a boolean, character or vector */
+        c = get_char(in);
+        switch (c) {
+            case 't':
+                return true;
+            case 'f':
+                return false;
+            case '\\':
+                return read_character(in);
+            case '(':
+                return read_vector(in);
+            case 'u':
+                if (get_char(in) != '8') {
+                    read_error(in, "unknown literal after #u\n", 0);
+                }
+                return read_bytevector(in);
+            case 's':
+                return read_s64vector(in);
+            default:
+                read_error(in, "unknown boolean or character literal\n",
+                           0);
+        }
+    }
+    else if (has_char_class(c, CHAR_DIGIT) ||
+             (c == '-' && has_char_class(peek(in), CHAR_DIGIT))) {
+        /* read an integer */
+        if (c == '-') {
+            sign = -1;
+        }
+        else {
+            unget_char(c, in);
+        }
+        /* once num overflows the digits go on in the token */
+        i = 0;
+        do {
+            for (n = char_run(in, CHAR_DIGIT); n > 0; n--) {
+                digit = *in->next++ - '0';
+                if (i == 0 && (mul_overflows(num, 10, &next) ||
+                               add_overflows(next, digit, &next))) {
+                    reserve_token(in, 32);
+                    i = sprintf(in->token, (sign < 0) ? "-%ld" : "%ld",
+                                num);
+                }
+                if (i == 0) {
+                    num = next;
+                }
+                else {
+                    reserve_token(in, i + 1);
+                    in->token[i++] = '0' + digit;
+                }
+            }
+        } while (may_continue_run(in));
+        if (is_delimiter(peek(in))) {
+            return (i == 0) ? make_fixnum(num * sign) :
+                              string_to_integer(in->token, i);
+        }
+        else {
+            read_error(in, "number not followed by delimiter\n", 0);
+        }
+    }
+    else if (is_initial(c) ||
+             ((c == '+' || c == '-') &&
+              is_delimiter(peek(in)))) { /* read a symbol */
+        reserve_token(in, 1);
+        in->token[0] = c;
+        i = 1;
+        do {
+            n = char_run(in, CHAR_SYMBOL);
+            reserve_token(in, i + n);
+            memcpy(in->token + i, in->next, n);
+            i += n;
+            in->next += n;
+        } while (may_continue_run(in));
+        c = peek(in);
+        if (is_delimiter(c)) {
+            in->token[i] = '\0';
+            return make_symbol(in->token);
+        }
+        else {
+            read_error(in, "symbol not followed by delimiter. "
+                           "Found '%c'\n", c);
+        }
+    }
+    else if (c == '"') { /* read a string */
+        i = 0;
+        while (1) {
+            n = char_run(in, CHAR_STRING);
+            reserve_token(in, i + n);
+            memcpy(in->token + i, in->next, n);
+            i += n;
+            in->next += n;
+            c = get_char(in);
+            if (c == '"') {
+                break;
+            }
+            if (c == '\\') {
+                c = get_char(in);
+                if (c == 'n') {
+                    c = '\n';
+                }
+            }
+            if (c == EOF) {
+                read_error(in, "non-terminated string literal\n", 0);
+            }
+            reserve_token(in, i + 1);
+            in->token[i++] = c;
+        }
+        in->token[i] = '\0';
+        return make_string(in->token);
+    }
+    else if (c == '(') { /* read the empty list or pair */
+        return read_pair(in);
+    }
+    else if (c == '\'') { /* read quoted expression */
+        return cons(quote_symbol, cons(read(in), the_empty_list));
+    }
+    else if (c == EOF) {
+        return NULL;
+    }
+    else {
+        read_error(in, "bad input. Unexpected '%c'\n", c);
+    }
+    read_error(in, "read illegal state\n", 0);
+    return NULL;
+}
+
+/* A fasl record is a datum in binary, one write-fasl and read-fasl
+ * apiece, so records can follow each other on a port:
+ *
+ *   "FASL" version
+ *   symbol count, then each symbol as length and name
+ *   count of objects met more than once
+ *   the datum, in prefix order
+ *
+ * Counts, lengths, fixnums and indexes are varints, seven bits to a
+ * byte, low bits first, the high bit set on all but the last byte.
+ * Fixnums are zigzagged first so small negative ones stay short. A
+ * list is its length and the cars of that many pairs, followed by
+ * whatever ends it, usually the empty list. A vector is its length
+ * and its elements, a bytevector its length and its bytes, and an
+ * s64vector its length and its elements as zigzagged varints. A bignum
+ * is a sign byte, then its magnitude as a count of bytes and the
+ * bytes, low first. A pair, string or any kind of vector met more
+ * than once is written after FASL_DEFINE the first time and as FASL_REFERENCE to its index after, so shared
+ * structure stays shared and cycles can be written. */
+#define FASL_VERSION 2
+
+typedef enum {FASL_EMPTY_LIST, FASL_FALSE, FASL_TRUE, FASL_FIXNUM,
+              FASL_CHARACTER, FASL_STRING, FASL_SYMBOL, FASL_LIST,
+              FASL_DEFINE, FASL_REFERENCE, FASL_VECTOR,
+              FASL_BIGNUM, FASL_BYTEVECTOR, FASL_S64VECTOR} fasl_tag;
+
+typedef struct fasl_reader {
+    reader *in;
+    object **symbols;
+    unsigned long symbol_count;
+    object **shared;
+    unsigned long shared_count;
+    unsigned long defined;
+} fasl_reader;
+
+/* A reader of a load cache recovers from a bad record by reading the
+ * source instead, see read_load_cache. */
+void fasl_error(reader *in, char *message) {
+    if (in->fasl_recovery != NULL) {
+        longjmp(*in->fasl_recovery, 1);
+    }
+    read_error(in, message, 0);
+}
+
+int fasl_byte(reader *in) {
+    int c;
+    
+    c = get_char(in);
+    if (c == EOF) {
+        fasl_error(in, "truncated fasl record\n");
+    }
+    return c;
+}
+
+unsigned long read_varint(reader *in) {
+    unsigned long value;
+    int shift;
+    int c;
+    
+    value = 0;
+    shift = 0;
+    do {
+        if (shift >= (int)sizeof(unsigned long) * 8) {
+            fasl_error(in, "bad fasl varint\n");
+        }
+        c = fasl_byte(in);
+        value |= (unsigned long)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return value;
+}
+
+/* a count of what follows, each at least a byte, which a damaged
+ * record in a mapped file cannot make larger than what is left */
+unsigned long read_fasl_length(reader *in) {
+    unsigned long length;
+
+    length = read_varint(in);
+    if (in->is_mapped && length > (unsigned long)(in->end - in->next)) {
+        fasl_error(in, "bad fasl length\n");
+    }
+    return length;
+}
+
+long read_zigzag(reader *in) {
+    unsigned long value;
+    
+    value = read_varint(in);
+    return (value & 1) ? -(long)(value >> 1) - 1 : (long)(value >> 1);
+}
+
+void read_fasl_bytes(reader *in, char *bytes, unsigned long length) {
+    unsigned long i;
+    size_t n;
+    
+    i = 0;
+    while (i < length) {
+        if (in->next == in->end) {
+            bytes[i++] = fasl_byte(in);
+            continue;
+        }
+        n = in->end - in->next;
+        if (n > length - i) {
+            n = length - i;
+        }
+        memcpy(bytes + i, in->next, n);
+        in->next += n;
+        i += n;
+    }
+}
+
+/* reads length bytes into the reader's token */
+char *read_fasl_name(reader *in) {
+    unsigned long length;
+    
+    length = read_fasl_length(in);
+    reserve_token(in, length);
+    read_fasl_bytes(in, in->token, length);
+    in->token[length] = '\0';
+    return in->token;
+}
+
+object **alloc_fasl_table(unsigned long count) {
+    return check_alloc(malloc((count + 1) * sizeof(object *)));
+}
+
+object *read_fasl_bignum(reader *in) {
+    object *obj;
+    char is_negative;
+    unsigned long count;
+    unsigned long i;
+    
+    is_negative = fasl_byte(in);
+    count = read_fasl_length(in);
+    obj = make_bignum((count * 8 + BIGNUM_DIGIT_BITS - 1) /
+                      BIGNUM_DIGIT_BITS, is_negative);
+    memset(obj->data.bignum.digits, 0,
+           obj->data.bignum.length * sizeof(bignum_digit));
+    for (i = 0; i < count; i++) {
+        obj->data.bignum.digits[i * 8 / BIGNUM_DIGIT_BITS] |=
+            (bignum_digit)fasl_byte(in) << (i * 8 % BIGNUM_DIGIT_BITS);
+    }
+    return normalize_bignum(obj);
+}
+
+/* reads the pairs down a list in a loop, so only nesting in the car
+ * takes the C stack */
+object *read_fasl_datum(fasl_reader *fasl) {
+    reader *in = fasl->in;
+    object *list;
+    object *last;
+    object *obj;
+    unsigned long index;
+    unsigned long length;
+    long define;
+    int tag;
+    
+    list = NULL;
+    last = NULL;
+    while (1) {
+        tag = fasl_byte(in);
+        define = -1;
+        if (tag == FASL_DEFINE) {
+            if (fasl->defined == fasl->shared_count) {
+                fasl_error(in, "bad fasl record\n");
+            }
+            define = fasl->defined++;
+            tag = fasl_byte(in);
+        }
+        switch (tag) {
+            case FASL_EMPTY_LIST:
+                obj = the_empty_list;
+                break;
+            case FASL_FALSE:
+                obj = false;
+                break;
+            case FASL_TRUE:
+                obj = true;
+                break;
+            case FASL_FIXNUM:
+                obj = make_fixnum(read_zigzag(in));
+                break;
+            case FASL_CHARACTER:
+                obj = make_character(fasl_byte(in));
+                break;
+            case FASL_BIGNUM:
+                obj = read_fasl_bignum(in);
+                break;
+            case FASL_STRING:
+                obj = make_string(read_fasl_name(in));
+                break;
+            case FASL_SYMBOL:
+                index = read_varint(in);
+                if (index >= fasl->symbol_count) {
+                    fasl_error(in, "bad fasl symbol\n");
+                }
+                obj = fasl->symbols[index];
+                break;
+            case FASL_LIST:
+                length = read_fasl_length(in);
+                if (length == 0) {
+                    fasl_error(in, "bad fasl record\n");
+                }
+                /* made before the cars are read, for a cycle back */
+                obj = make_list_block(length);
+                if (define >= 0) {
+                    fasl->shared[define] = obj;
+                }
+                if (last == NULL) {
+                    list = obj;
+                }
+                else {
+                    set_cdr(last, obj);
+                }
+                while (1) {
+                    set_car(obj, read_fasl_datum(fasl));
+                    if (--length == 0) {
+                        break;
+                    }
+                    obj = cdr(obj);
+                }
+                last = obj;
+                continue;
+            case FASL_S64VECTOR:
+                length = read_fasl_length(in);
+                obj = make_s64vector(length);
+                for (index = 0; index < length; index++) {
+                    obj->data.s64vector.elements[index] = read_zigzag(in);
+                }
+                break;
+            case FASL_BYTEVECTOR:
+                length = read_fasl_length(in);
+                obj = make_bytevector(length);
+                read_fasl_bytes(in, (char *)obj->data.bytevector.bytes,
+                                length);
+                break;
+            case FASL_VECTOR:
+                length = read_fasl_length(in);
+                obj = make_vector(length, the_empty_list);
+                /* made before the elements are read, for a cycle back */
+                if (define >= 0) {
+                    fasl->shared[define] = obj;
+                }
+                for (index = 0; index < length; index++) {
+                    obj->data.vector.elements[index] =
+                        read_fasl_datum(fasl);
+                }
+                break;
+            case FASL_REFERENCE:
+                index = read_varint(in);
+                if (index >= fasl->defined) {
+                    fasl_error(in, "bad fasl reference\n");
+                }
+                obj = fasl->shared[index];
+                break;
+            default:
+                fasl_error(in, "bad fasl record\n");
+        }
+        if (define >= 0) {
+            fasl->shared[define] = obj;
+        }
+        if (last == NULL) {
+            return obj;
+        }
+        set_cdr(last, obj);
+        return list;
+    }
+}
+
+/* the next record's datum, or NULL at the end of the input */
+object *read_fasl(reader *in) {
+    fasl_reader fasl;
+    object *obj;
+    unsigned long i;
+    
+    if (peek(in) == EOF) {
+        return NULL;
+    }
+    if (fasl_byte(in) != 'F' || fasl_byte(in) != 'A' ||
+        fasl_byte(in) != 'S' || fasl_byte(in) != 'L' ||
+        fasl_byte(in) != FASL_VERSION) {
+        fasl_error(in, "not a fasl record\n");
+    }
+    fasl.in = in;
+    fasl.symbol_count = read_fasl_length(in);
+    fasl.symbols = alloc_fasl_table(fasl.symbol_count);
+    for (i = 0; i < fasl.symbol_count; i++) {
+        fasl.symbols[i] = make_symbol(read_fasl_name(in));
+    }
+    fasl.shared_count = read_fasl_length(in);
+    fasl.shared = alloc_fasl_table(fasl.shared_count);
+    fasl.defined = 0;
+    obj = read_fasl_datum(&fasl);
+    free(fasl.symbols);
+    free(fasl.shared);
+    return obj;
+}
+
+object *eval(object *exp, object *env);
+
+/* An up to date cache of a loaded file holds its forms as fasl
+ * records, after one holding its key, so they are not parsed again.
+ * It lives next to the file, under the file's name with ".cache"
+ * after it. A cache is written as its file is evaluated, a form at a
+ * time before each is, and only takes the place of the old one once
+ * the whole file has been. The key is the length and a hash of the
+ * text of the file, and the version of the cache. Last comes a hash
+ * of all before it, in LOAD_CACHE_CHECK_SIZE bytes low first, so a
+ * cache cut short or damaged is not used. */
+#define LOAD_CACHE_VERSION 2
+#define LOAD_CACHE_CHECK_SIZE 8
+
+char use_load_cache = 1;
+long load_cache_hits = 0;
+long load_cache_misses = 0;
+
+typedef struct load_key {
+    char is_cacheable;      /* the text could be hashed */
+    char is_cached;         /* and the cache was up to date */
+    object *forms;          /* of the cache, those not yet evaluated */
+    unsigned long hash;
+    long size;
+} load_key;
+
+char *load_cache_name(char *filename, char *suffix) {
+    char *name;
+    
+    name = check_alloc(malloc(strlen(filename) + strlen(suffix) + 1));
+    strcpy(name, filename);
+    strcat(name, suffix);
+    return name;
+}
+
+/* FNV-1a, going on from hash */
+#define LOAD_HASH_START 2166136261UL
+
+unsigned long hash_load_bytes(unsigned long hash, char *p, size_t n) {
+    while (n-- > 0) {
+        hash = (hash ^ (unsigned char)*p++) * 16777619UL;
+    }
+    return hash;
+}
+
+/* over a mapped file */
+void hash_load_source(reader *in, load_key *key) {
+    key->hash = hash_load_bytes(LOAD_HASH_START, in->buffer,
+                                in->end - in->buffer);
+    key->size = in->end - in->buffer;
+}
+
+/* whether the mapped cache ends with the hash of what is before, which
+ * is then all the reader sees */
+char is_load_cache_intact(reader *in) {
+    unsigned long hash;
+    int i;
+    
+    if (!in->is_mapped ||
+        in->end - in->buffer < LOAD_CACHE_CHECK_SIZE) {
+        return 0;
+    }
+    in->end -= LOAD_CACHE_CHECK_SIZE;
+    hash = hash_load_bytes(LOAD_HASH_START, in->buffer,
+                           in->end - in->buffer);
+    for (i = 0; i < LOAD_CACHE_CHECK_SIZE; i++) {
+        if ((unsigned char)in->end[i] != (hash & 0xff)) {
+            return 0;
+        }
+        hash >>= 8;
+    }
+    return 1;
+}
+
+object *load_key_datum(load_key *key) {
+    return cons(make_fixnum(LOAD_CACHE_VERSION),
+                cons(make_fixnum((long)key->hash),
+                     cons(make_fixnum(key->size), the_empty_list)));
+}
+
+char is_load_key_datum(object *datum, load_key *key) {
+    object *expected;
+    
+    expected = load_key_datum(key);
+    while (is_pair(expected)) {
+        if (!is_pair(datum) || !is_fixnum(car(datum)) ||
+            car(datum)->data.fixnum.value !=
+                car(expected)->data.fixnum.value) {
+            return 0;
+        }
+        datum = cdr(datum);
+        expected = cdr(expected);
+    }
+    return is_the_empty_list(datum);
+}
+
+/* whether a mapped file starts as a fasl record of this version
+ * does, so read_fasl can be trusted with it */
+char is_fasl_file(reader *in) {
+    return in->is_mapped && in->end - in->next >= 5 &&
+           memcmp(in->next, "FASL", 4) == 0 &&
+           in->next[4] == FASL_VERSION;
+}
+
+/* The forms in the cache of filename if it is up to date, or NULL.
+ * They are all read before any is evaluated, so a cache damaged
+ * anywhere is found out while the source can still be read in its
+ * place. */
+object *read_load_cache(char *filename, load_key *key) {
+    char *name;
+    FILE *stream;
+    reader *in;
+    jmp_buf recovery;
+    object *forms;
+    object *last;
+    object *exp;
+    
+    name = load_cache_name(filename, ".cache");
+    stream = fopen(name, "rb");
+    free(name);
+    if (stream == NULL) {
+        return NULL;
+    }
+    in = make_reader(stream);
+    if (setjmp(recovery) != 0) {
+        close_reader(in);
+        return NULL;
+    }
+    in->fasl_recovery = &recovery;
+    if (!is_load_cache_intact(in) || !is_fasl_file(in) ||
+        !is_load_key_datum(read_fasl(in), key)) {
+        close_reader(in);
+        return NULL;
+    }
+    forms = the_empty_list;
+    last = NULL;
+    while ((exp = read_fasl(in)) != NULL) {
+        exp = cons(exp, the_empty_list);
+        if (last == NULL) {
+            forms = exp;
+        }
+        else {
+            set_cdr(last, exp);
+        }
+        last = exp;
+    }
+    close_reader(in);
+    return forms;
+}
+
+/* the reader of a file to load, or NULL if the file cannot be
+ * opened, with the forms of its cache in the key where it can */
+reader *open_load_source(char *filename, load_key *key) {
+    FILE *stream;
+    reader *in;
+    
+    stream = fopen(filename, "r");
+    if (stream == NULL) {
+        return NULL;
+    }
+    in = make_reader(stream);
+    key->is_cacheable = use_load_cache && in->is_mapped;
+    key->is_cached = 0;
+    if (key->is_cacheable) {
+        hash_load_source(in, key);
+        key->forms = read_load_cache(filename, key);
+        key->is_cached = (key->forms != NULL);
+    }
+    return in;
+}
+
+object *read_load_form(reader *in, load_key *key) {
+    object *exp;
+
+    if (!key->is_cached) {
+        return read(in);
+    }
+    if (is_the_empty_list(key->forms)) {
+        return NULL;
+    }
+    exp = car(key->forms);
+    key->forms = cdr(key->forms);
+    return exp;
+}
+
+/* The caches being written, each to a temporary file of this
+ * process's own, so that an error that ends a load can remove those
+ * files. */
+typedef struct pending_cache {
+    FILE *out;
+    char *temporary;
+    struct pending_cache *next;
+} pending_cache;
+
+pending_cache *pending_caches = NULL;
+
+char *load_cache_temporary_name(char *filename) {
+    char suffix[32];
+    
+#ifdef HAVE_GETPID
+    sprintf(suffix, ".cache.%ld.tmp", (long)getpid());
+#else
+    strcpy(suffix, ".cache.tmp");
+#endif
+    return load_cache_name(filename, suffix);
+}
+
+/* where the forms of a file that has no cache are written, if
+ * it could have one */
+FILE *begin_load_cache(char *filename, load_key *key) {
+    pending_cache *pending;
+    char *temporary;
+    FILE *out;
+    
+    if (!key->is_cacheable || key->is_cached) {
+        return NULL;
+    }
+    temporary = load_cache_temporary_name(filename);
+    out = fopen(temporary, "wb");
+    if (out == NULL) {
+        free(temporary);
+        return NULL;
+    }
+    pending = check_alloc(malloc(sizeof(pending_cache)));
+    pending->out = out;
+    pending->temporary = temporary;
+    pending->next = pending_caches;
+    pending_caches = pending;
+    write_fasl(out, load_key_datum(key));
+    return out;
+}
+
+pending_cache *take_pending_cache(FILE *out) {
+    pending_cache **link;
+    pending_cache *pending;
+    
+    for (link = &pending_caches; (*link)->out != out;
+         link = &(*link)->next) {
+    }
+    pending = *link;
+    *link = pending->next;
+    return pending;
+}
+
+/* hashes what was written by reading it back, and puts the hash
+ * after it */
+char put_load_cache_check(FILE *out, pending_cache *pending) {
+    FILE *in;
+    char buffer[4096];
+    unsigned long hash;
+    size_t n;
+    int i;
+    
+    in = fopen(pending->temporary, "rb");
+    if (in == NULL) {
+        return 0;
+    }
+    hash = LOAD_HASH_START;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        hash = hash_load_bytes(hash, buffer, n);
+    }
+    if (ferror(in)) {
+        fclose(in);
+        return 0;
+    }
+    fclose(in);
+    for (i = 0; i < LOAD_CACHE_CHECK_SIZE; i++) {
+        putc(hash & 0xff, out);
+        hash >>= 8;
+    }
+    return 1;
+}
+
+/* puts the cache in place only once it is all written */
+void end_load_cache(FILE *out, char *filename) {
+    pending_cache *pending;
+    char *name;
+    char is_written;
+    
+    if (out == NULL) {
+        return;
+    }
+    pending = take_pending_cache(out);
+    name = load_cache_name(filename, ".cache");
+    is_written = (fflush(out) == 0) && put_load_cache_check(out, pending);
+    is_written = !ferror(out) && is_written;
+    is_written = (fclose(out) == 0) && is_written;
+    if (!is_written || rename(pending->temporary, name) != 0) {
+        remove(pending->temporary);
+    }
+    free(name);
+    free(pending->temporary);
+    free(pending);
+}
+
+/* for loads that an error ends */
+void abandon_load_caches(void) {
+    pending_cache *pending;
+    
+    while (pending_caches != NULL) {
+        pending = take_pending_cache(pending_caches->out);
+        fclose(pending->out);
+        remove(pending->temporary);
+        free(pending->temporary);
+        free(pending);
+    }
+}
+
+void count_load(load_key *key) {
+    if (key->is_cached) {
+        load_cache_hits++;
+    }
+    else if (key->is_cacheable) {
+        load_cache_misses++;
+    }
+}
+
+/* An error that something recovers from closes the file it ended the
+ * load of on its way. */
+object *load_files_in_turn(char **filenames, int count) {
+    jmp_buf recovery;
+    jmp_buf *outer_recovery;
+    load_key key;
+    reader *volatile in;
+    FILE *cache;
+    object *exp;
+    object *result;
+    int i;
+    
+    outer_recovery = error_recovery;
+    in = NULL;
+    if (outer_recovery != NULL) {
+        if (setjmp(recovery) != 0) {
+            error_recovery = outer_recovery;
+            if (in != NULL) {
+                close_reader(in);
+            }
+            end_with_error();
+        }
+        error_recovery = &recovery;
+    }
+    result = ok_symbol;
+    for (i = 0; i < count; i++) {
+        in = open_load_source(filenames[i], &key);
+        if (in == NULL) {
+            fprintf(stderr_stream, "could not load file \"%s\"", filenames[i]);
+            end_with_error();
+        }
+        count_load(&key);
+        cache = begin_load_cache(filenames[i], &key);
+        while ((exp = read_load_form(in, &key)) != NULL) {
+            if (cache != NULL) {
+                write_fasl(cache, exp);
+            }
+            result = eval(exp, the_global_environment);
+        }
+        close_reader(in);
+        in = NULL;
+        end_load_cache(cache, filenames[i]);
+    }
+    error_recovery = outer_recovery;
+    return result;
+}
+
+#ifdef HAVE_PTHREADS
+
+/* A load reads its files on a thread of its own, a bounded queue of
+ * forms ahead of the evaluation, so reading and evaluating overlap.
+ * Forms are handed over in batches to keep the two threads from
+ * waking each other for every one. Reading touches nothing
+ * evaluating does but the malloc heap and the symbol table, which is
+ * locked. An error ends the reading but is only reported once the
+ * forms before it have been evaluated. */
+#define READ_AHEAD_BATCH 64
+#define READ_AHEAD_BATCHES 16
+#define READ_AHEAD_STACK_SIZE (64 * 1024 * 1024) /* for deep nesting */
+
+typedef struct read_batch {
+    object *forms[READ_AHEAD_BATCH];
+    int count;
+    int file;               /* the forms came from; a batch never
+                               holds those of two */
+} read_batch;
+
+typedef struct read_ahead {
+    char **filenames;
+    int count;
+    load_key *keys;         /* of each file, once it is opened */
+    int file;               /* being read */
+    read_batch batches[READ_AHEAD_BATCHES];
+    int first;              /* batch being evaluated */
+    int queued;             /* batches full or being evaluated */
+    int filling;            /* after the queued ones, the reader's */
+    char is_done;
+    char *message;          /* of the error that stopped reading */
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} read_ahead;
+
+void queue_batch(read_ahead *ahead) {
+    pthread_mutex_lock(&ahead->lock);
+    ahead->queued++;
+    pthread_cond_signal(&ahead->not_empty);
+    while (ahead->queued == READ_AHEAD_BATCHES) {
+        pthread_cond_wait(&ahead->not_full, &ahead->lock);
+    }
+    pthread_mutex_unlock(&ahead->lock);
+    ahead->filling = (ahead->filling + 1) % READ_AHEAD_BATCHES;
+    ahead->batches[ahead->filling].count = 0;
+}
+
+void put_form(read_ahead *ahead, object *form) {
+    read_batch *batch;
+    
+    batch = &ahead->batches[ahead->filling];
+    batch->file = ahead->file;
+    batch->forms[batch->count++] = form;
+    if (batch->count == READ_AHEAD_BATCH) {
+        queue_batch(ahead);
+    }
+}
+
+/* the next batch to evaluate, or NULL once all have been */
+read_batch *take_batch(read_ahead *ahead) {
+    read_batch *batch;
+    
+    pthread_mutex_lock(&ahead->lock);
+    while (ahead->queued == 0 && !ahead->is_done) {
+        pthread_cond_wait(&ahead->not_empty, &ahead->lock);
+    }
+    batch = (ahead->queued == 0) ? NULL : &ahead->batches[ahead->first];
+    pthread_mutex_unlock(&ahead->lock);
+    return batch;
+}
+
+void release_batch(read_ahead *ahead) {
+    pthread_mutex_lock(&ahead->lock);
+    ahead->first = (ahead->first + 1) % READ_AHEAD_BATCHES;
+    ahead->queued--;
+    pthread_cond_signal(&ahead->not_full);
+    pthread_mutex_unlock(&ahead->lock);
+}
+
+/* queues the last batch, even if empty, so is_done needs no check
+ * of a partly filled one */
+void finish_read_ahead(read_ahead *ahead, char *message) {
+    pthread_mutex_lock(&ahead->lock);
+    ahead->queued++;
+    ahead->is_done = 1;
+    ahead->message = message;
+    pthread_cond_signal(&ahead->not_empty);
+    pthread_mutex_unlock(&ahead->lock);
+}
+
+void fail_read_ahead(read_ahead *ahead, char *message) {
+    char *copy;
+    
+    copy = check_alloc(malloc(strlen(message) + 1));
+    strcpy(copy, message);
+    finish_read_ahead(ahead, copy);
+    pthread_exit(NULL);
+}
+
+void *read_files_ahead(void *argument) {
+    read_ahead *ahead = argument;
+    char message[128];
+    load_key *key;
+    reader *in;
+    object *exp;
+    int i;
+    
+    for (i = 0; i < ahead->count; i++) {
+        ahead->file = i;
+        key = &ahead->keys[i];
+        in = open_load_source(ahead->filenames[i], key);
+        if (in == NULL) {
+            sprintf(message, "could not load file \"%.100s\"",
+                    ahead->filenames[i]);
+            fail_read_ahead(ahead, message);
+        }
+        in->ahead = ahead;
+        while ((exp = read_load_form(in, key)) != NULL) {
+            put_form(ahead, exp);
+        }
+        close_reader(in);
+        if (ahead->batches[ahead->filling].count > 0) {
+            queue_batch(ahead);
+        }
+    }
+    finish_read_ahead(ahead, NULL);
+    return NULL;
+}
+
+object *load_files(char **filenames, int count) {
+    read_ahead *ahead;
+    pthread_attr_t attributes;
+    pthread_t thread;
+    read_batch *batch;
+    FILE *cache;
+    object *result;
+    int file;
+    int i;
+    
+#ifdef _SC_NPROCESSORS_ONLN
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2) { /* nothing to overlap */
+        return load_files_in_turn(filenames, count);
+    }
+#endif
+    /* an error could not be recovered from with the thread reading */
+    if (error_recovery != NULL) {
+        return load_files_in_turn(filenames, count);
+    }
+    ahead = check_alloc(malloc(sizeof(read_ahead)));
+    ahead->filenames = filenames;
+    ahead->count = count;
+    ahead->keys = check_alloc(malloc(count * sizeof(load_key) + 1));
+    ahead->first = 0;
+    ahead->queued = 0;
+    ahead->filling = 0;
+    ahead->batches[0].count = 0;
+    ahead->is_done = 0;
+    ahead->message = NULL;
+    pthread_mutex_init(&ahead->lock, NULL);
+    pthread_cond_init(&ahead->not_empty, NULL);
+    pthread_cond_init(&ahead->not_full, NULL);
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, READ_AHEAD_STACK_SIZE);
+    if (pthread_create(&thread, &attributes, read_files_ahead,
+                       ahead) != 0) {
+        fprintf(stderr_stream, "could not start reading ahead\n");
+        end_with_error();
+    }
+    pthread_attr_destroy(&attributes);
+    
+    result = ok_symbol;
+    file = -1;
+    cache = NULL;
+    while ((batch = take_batch(ahead)) != NULL) {
+        if (batch->count > 0 && batch->file != file) {
+            if (file >= 0) {
+                end_load_cache(cache, filenames[file]);
+            }
+            file = batch->file;
+            cache = begin_load_cache(filenames[file], &ahead->keys[file]);
+        }
+        for (i = 0; i < batch->count; i++) {
+            if (cache != NULL) {
+                write_fasl(cache, batch->forms[i]);
+            }
+            result = eval(batch->forms[i], the_global_environment);
+        }
+        release_batch(ahead);
+    }
+    pthread_join(thread, NULL);
+    if (ahead->message != NULL) {
+        fputs(ahead->message, stderr_stream);
+        end_with_error();
+    }
+    if (file >= 0) {
+        end_load_cache(cache, filenames[file]);
+    }
+    for (i = 0; i < count; i++) {
+        count_load(&ahead->keys[i]);
+    }
+    pthread_mutex_destroy(&ahead->lock);
+    pthread_cond_destroy(&ahead->not_empty);
+    pthread_cond_destroy(&ahead->not_full);
+    free(ahead->keys);
+    free(ahead);
+    return result;
+}
+
+#else
+
+object *load_files(char **filenames, int count) {
+    return load_files_in_turn(filenames, count);
+}
+
+#endif
+
+/*************************** EVALUATE ****************************/
+
+char is_self_evaluating(object *exp) {
+    return is_boolean(exp)   ||
+           is_fixnum(exp)    ||
+           is_bignum(exp)    ||
+           is_character(exp) ||
+           is_string(exp)    ||
+           is_vector(exp)    ||
+           is_bytevector(exp) ||
+           is_s64vector(exp);
+}
+
+char is_variable(object *expression) {
+    return is_symbol(expression);
+}
+
+char is_tagged_list(object *expression, object *tag) {
+    object *the_car;
+
+    if (is_pair(expression)) {
+        the_car = car(expression);
+        return is_symbol(the_car) && (the_car == tag);
+    }
+    return 0;
+}
+
+char is_quoted(object *expression) {
+    return is_tagged_list(expression, quote_symbol);
+}
+
+object *text_of_quotation(object *exp) {
+    return cadr(exp);
+}
+
+char is_assignment(object *exp) {
+    return is_tagged_list(exp, set_symbol);
+}
+
+object *assignment_variable(object *exp) {
+    return car(cdr(exp));
+}
+
+object *assignment_value(object *exp) {
+    return car(cdr(cdr(exp)));
+}
+
+char is_definition(object *exp) {
+    return is_tagged_list(exp, define_symbol);
+}
+
+object *definition_variable(object *exp) {
+    if (is_symbol(cadr(exp))) {
+        return cadr(exp);
+    }
+    else {
+        return caadr(exp);
+    }
+}
+
+object *make_lambda(object *parameters, object *body);
+
+/* the lambda is made once and kept on the expression */
+object *definition_value(object *exp) {
+    if (is_symbol(cadr(exp))) {
+        return caddr(exp);
+    }
+    else {
+        if (exp->data.pair.annotation == NULL) {
+            exp->data.pair.annotation = make_lambda(cdadr(exp), cddr(exp));
+        }
+        return exp->data.pair.annotation;
+    }
+}
+
+object *make_if(object *predicate, object *consequent,
+                object *alternative) {
+    return cons(if_symbol,
+                cons(predicate,
+                     cons(consequent,
+                          cons(alternative, the_empty_list))));
+}
+
+char is_if(object *expression) {
+    return is_tagged_list(expression, if_symbol);
+}
+
+object *if_predicate(object *exp) {
+    return cadr(exp);
+}
+
+object *if_consequent(object *exp) {
+    return caddr(exp);
+}
+
+object *if_alternative(object *exp) {
+    if (is_the_empty_list(cdddr(exp))) {
+        return false;
+    }
+    else {
+        return cadddr(exp);
+    }
+}
+
+object *make_lambda(object *parameters, object *body) {
+    return cons(lambda_symbol, cons(parameters, body));
+}
+
+char is_lambda(object *exp) {
+    return is_tagged_list(exp, lambda_symbol);
+}
+
+object *lambda_parameters(object *exp) {
+    return cadr(exp);
+}
+
+object *lambda_body(object *exp) {
+    return cddr(exp);
+}
+
+object *make_begin(object *seq) {
+    return cons(begin_symbol, seq);
+}
+
+char is_begin(object *exp) {
+    return is_tagged_list(exp, begin_symbol);
+}
+
+object *begin_actions(object *exp) {
+    return cdr(exp);
+}
+
+char is_last_exp(object *seq) {
+    return is_the_empty_list(cdr(seq));
+}
+
+object *first_exp(object *seq) {
+    return car(seq);
+}
+
+object *rest_exps(object *seq) {
+    return cdr(seq);
+}
+
+char is_cond(object *exp) {
+    return is_tagged_list(exp, cond_symbol);
+}
+
+object *cond_clauses(object *exp) {
+    return cdr(exp);
+}
+
+object *cond_predicate(object *clause) {
+    return car(clause);
+}
+
+object *cond_actions(object *clause) {
+    return cdr(clause);
+}
+
+char is_cond_else_clause(object *clause) {
+    return cond_predicate(clause) == else_symbol;
+}
+
+object *sequence_to_exp(object *seq) {
+    if (is_the_empty_list(seq)) {
+        return seq;
+    }
+    else if (is_last_exp(seq)) {
+        return first_exp(seq);
+    }
+    else {
+        return make_begin(seq);
+    }
+}
+
+object *expand_clauses(object *clauses) {
+    object *first;
+    object *rest;
+    
+    if (is_the_empty_list(clauses)) {
+        return false;
+    }
+    else {
+        first = car(clauses);
+        rest  = cdr(clauses);
+        if (is_cond_else_clause(first)) {
+            if (is_the_empty_list(rest)) {
+                return sequence_to_exp(cond_actions(first));
+            }
+            else {
+                fprintf(stderr_stream, "else clause isn't last cond->if");
+                end_with_error();
+            }
+        }
+        else {
+            return make_if(cond_predicate(first),
+                           sequence_to_exp(cond_actions(first)),
+                           expand_clauses(rest));
+        }
+    }
+}
+
+/* the conversion is done once and kept on the expression */
+object *cond_to_if(object *exp) {
+    if (exp->data.pair.annotation == NULL) {
+        exp->data.pair.annotation = expand_clauses(cond_clauses(exp));
+    }
+    return exp->data.pair.annotation;
+}
+
+object *make_application(object *operator, object *operands) {
+    return cons(operator, operands);
+}
+
+char is_application(object *exp) {
+    return is_pair(exp);
+}
+
+object *operator(object *exp) {
+    return car(exp);
+}
+
+object *operands(object *exp) {
+    return cdr(exp);
+}
+
+char is_no_operands(object *ops) {
+    return is_the_empty_list(ops);
+}
+
+object *first_operand(object *ops) {
+    return car(ops);
+}
+
+object *rest_operands(object *ops) {
+    return cdr(ops);
+}
+
+char is_let(object *exp) {
+    return is_tagged_list(exp, let_symbol);
+}
+
+object *let_bindings(object *exp) {
+    return cadr(exp);
+}
+
+object *let_body(object *exp) {
+    return cddr(exp);
+}
+
+object *binding_parameter(object *binding) {
+    return car(binding);
+}
+
+object *binding_argument(object *binding) {
+    return cadr(binding);
+}
+
+object *bindings_parameters(object *bindings) {
+    return is_the_empty_list(bindings) ?
+               the_empty_list :
+               cons(binding_parameter(car(bindings)),
+                    bindings_parameters(cdr(bindings)));
+}
+
+object *bindings_arguments(object *bindings) {
+    return is_the_empty_list(bindings) ?
+               the_empty_list :
+               cons(binding_argument(car(bindings)),
+                    bindings_arguments(cdr(bindings)));
+}
+
+object *let_parameters(object *exp) {
+    return bindings_parameters(let_bindings(exp));
+}
+
+object *let_arguments(object *exp) {
+    return bindings_arguments(let_bindings(exp));
+}
+
+/* the conversion is done once and kept on the expression */
+object *let_to_application(object *exp) {
+    if (exp->data.pair.annotation == NULL) {
+        exp->data.pair.annotation = 
+            make_application(
+                make_lambda(let_parameters(exp),
+                            let_body(exp)),
+                let_arguments(exp));
+    }
+    return exp->data.pair.annotation;
+}
+
+char is_and(object *exp) {
+    return is_tagged_list(exp, and_symbol);
+}
+
+object *and_tests(object *exp) {
+    return cdr(exp);
+}
+
+char is_or(object *exp) {
+    return is_tagged_list(exp, or_symbol);
+}
+
+object *or_tests(object *exp) {
+    return cdr(exp);
+}
+
+object *make_quotation(object *datum) {
+    return cons(quote_symbol, cons(datum, the_empty_list));
+}
+
+char is_delay(object *exp) {
+    return is_tagged_list(exp, delay_symbol);
+}
+
+char is_lazy(object *exp) {
+    return is_delay(exp) ||
+           is_tagged_list(exp, delay_force_symbol) ||
+           is_tagged_list(exp, cons_stream_symbol);
+}
+
+/* (delay exp) becomes a call of a primitive on (lambda () exp), whose
+ * closure is all the promise needs, and delay-force likewise.
+ * (cons-stream a b) becomes a call of cons on a and (delay b). The
+ * primitives are quoted so no binding can change them. The
+ * conversion is done once and kept on the expression. */
+object *lazy_to_application(object *exp) {
+    if (exp->data.pair.annotation == NULL) {
+        if (is_tagged_list(exp, cons_stream_symbol)) {
+            exp->data.pair.annotation =
+                make_application(
+                    make_quotation(cons_procedure),
+                    cons(cadr(exp),
+                         cons(cons(delay_symbol, cddr(exp)),
+                              the_empty_list)));
+        }
+        else {
+            exp->data.pair.annotation =
+                make_application(
+                    make_quotation(is_delay(exp) ? delay_procedure :
+                                                   delay_force_procedure),
+                    cons(make_lambda(the_empty_list, cdr(exp)),
+                         the_empty_list));
+        }
+    }
+    return exp->data.pair.annotation;
+}
+
+char is_record_definition(object *exp) {
+    return is_tagged_list(exp, define_record_type_symbol);
+}
+
+object *make_definition(object *variable, object *value) {
+    return cons(define_symbol,
+                cons(variable, cons(value, the_empty_list)));
+}
+
+/* the definition of a procedure whose body calls the quoted
+ * primitive on the arguments */
+object *make_record_procedure_definition(object *variable,
+                                         object *parameters,
+                                         object *primitive,
+                                         object *arguments) {
+    return make_definition(
+               variable,
+               make_lambda(parameters,
+                           cons(make_application(make_quotation(primitive),
+                                                 arguments),
+                                the_empty_list)));
+}
+
+char is_record_constructor_field(object *field, object *fields) {
+    while (is_pair(fields)) {
+        if (car(fields) == field) {
+            return 1;
+        }
+        fields = cdr(fields);
+    }
+    return 0;
+}
+
+/* (define-record-type name (constructor field ...) predicate
+ *                     (field accessor [modifier]) ...)
+ * becomes a begin of definitions. The record type is made by the
+ * conversion, which is done once and kept on the expression. Each
+ * procedure is a lambda that calls a primitive on the record, the
+ * type and the index of the slot, so the check and the access take
+ * constant time. */
+object *record_definition_to_begin(object *exp) {
+    object *type;
+    object *quoted_type;
+    object *constructor;
+    object *specs;
+    object *spec;
+    object *slots;
+    object *definitions;
+    object *result;
+    long count;
+    long i;
+
+    if (exp->data.pair.annotation != NULL) {
+        return exp->data.pair.annotation;
+    }
+    if (!is_pair(cdr(exp)) || !is_symbol(cadr(exp)) ||
+        !is_pair(cddr(exp)) || !is_pair(caddr(exp)) ||
+        !is_pair(cdddr(exp)) || !is_symbol(cadddr(exp))) {
+        fprintf(stderr_stream, "bad define-record-type\n");
+        end_with_error();
+    }
+    constructor = caddr(exp);
+    count = 0;
+    for (specs = cddddr(exp); is_pair(specs); specs = cdr(specs)) {
+        spec = car(specs);
+        if (!is_pair(spec) || !is_symbol(car(spec)) ||
+            !is_pair(cdr(spec)) || !is_symbol(cadr(spec))) {
+            fprintf(stderr_stream, "bad define-record-type field\n");
+            end_with_error();
+        }
+        count++;
+    }
+    for (specs = cdr(constructor); is_pair(specs); specs = cdr(specs)) {
+        for (spec = cddddr(exp);
+             is_pair(spec) && caar(spec) != car(specs);
+             spec = cdr(spec)) {
+        }
+        if (is_the_empty_list(spec)) {
+            fprintf(stderr_stream, "%s is not a field of %s\n",
+                    car(specs)->data.symbol.value,
+                    cadr(exp)->data.symbol.value);
+            end_with_error();
+        }
+    }
+    type = make_record_type(cadr(exp), count);
+    quoted_type = make_quotation(type);
+
+    /* made backwards, slots and definitions both */
+    slots = the_empty_list;
+    definitions = cons(make_definition(cadr(exp), quoted_type),
+                       the_empty_list);
+    definitions = cons(make_record_procedure_definition(
+                           cadddr(exp),
+                           cons(record_variable, the_empty_list),
+                           is_record_procedure,
+                           cons(record_variable, cons(quoted_type,
+                                                the_empty_list))),
+                       definitions);
+    i = 0;
+    for (specs = cddddr(exp); is_pair(specs); specs = cdr(specs), i++) {
+        spec = car(specs);
+        slots = cons(is_record_constructor_field(car(spec),
+                                                 cdr(constructor)) ?
+                         car(spec) : false,
+                     slots);
+        definitions = cons(make_record_procedure_definition(
+                               cadr(spec),
+                               cons(record_variable, the_empty_list),
+                               record_ref_procedure,
+                               cons(record_variable,
+                                    cons(quoted_type,
+                                         cons(make_fixnum(i),
+                                              the_empty_list)))),
+                           definitions);
+        if (is_pair(cddr(spec))) {
+            definitions = cons(make_record_procedure_definition(
+                                   caddr(spec),
+                                   cons(record_variable,
+                                        cons(value_variable,
+                                             the_empty_list)),
+                                   record_set_procedure,
+                                   cons(record_variable,
+                                        cons(quoted_type,
+                                             cons(make_fixnum(i),
+                                                  cons(value_variable,
+                                                       the_empty_list))))),
+                               definitions);
+        }
+    }
+    result = the_empty_list;
+    while (is_pair(slots)) {
+        result = cons(car(slots), result);
+        slots = cdr(slots);
+    }
+    definitions = cons(make_record_procedure_definition(
+                           car(constructor),
+                           cdr(constructor),
+                           record_procedure,
+                           cons(quoted_type, result)),
+                       definitions);
+    result = the_empty_list;
+    while (is_pair(definitions)) {
+        result = cons(car(definitions), result);
+        definitions = cdr(definitions);
+    }
+    exp->data.pair.annotation = make_begin(result);
+    return exp->data.pair.annotation;
+}
+
+object *apply_operator(object *arguments) {
+    return car(arguments);
+}
+
+object *prepare_apply_operands(object *arguments) {
+    if (is_the_empty_list(cdr(arguments))) {
+        return car(arguments);
+    }
+    else {
+        return cons(car(arguments),
+                    prepare_apply_operands(cdr(arguments)));
+    }
+}
+
+object *apply_operands(object *arguments) {
+    return prepare_apply_operands(cdr(arguments));
+}
+
+/* Data handed to eval may be changed with set-car! and set-cdr!
+ * between calls, which would leave stale the analyses kept on its
+ * pairs, such as by cond_to_if and let_to_application. So eval gets
+ * a fresh copy each time. Quotations are not code and stay shared. */
+object *copy_expression(object *exp) {
+    object *copy;
+    object *last;
+    object *pair;
+
+    if (!is_pair(exp) || is_quoted(exp)) {
+        return exp;
+    }
+    copy = last = cons(copy_expression(car(exp)), the_empty_list);
+    for (exp = cdr(exp); is_pair(exp); exp = cdr(exp)) {
+        pair = cons(copy_expression(car(exp)), the_empty_list);
+        set_cdr(last, pair);
+        last = pair;
+    }
+    set_cdr(last, exp);
+    return copy;
+}
+
+object *eval_expression(object *arguments) {
+    return copy_expression(car(arguments));
+}
+
+object *eval_environment(object *arguments) {
+    return cadr(arguments);
+}
+
+/* Closures are flat. A closure copies the bindings of its free
+ * variables found between the current frame and the outermost one
+ * into a single frame in front of the outermost frame, instead of
+ * holding on to the whole environment. What that needs to know about
+ * a lambda is worked out once by scanning its body and kept on the
+ * lambda expression as a list of
+ *
+ *   free variables  - referenced but not bound by the lambda
+ *   frame variables - the parameters then the internal definitions,
+ *                     which are bound up front so closures made
+ *                     before a definition runs can capture it
+ *   boxes           - for each frame variable, whether it is both
+ *                     captured and assigned, so its value is boxed;
+ *                     the empty list if the arguments need no change
+ *   assigned        - variables set! anywhere in the body
+ *   body            - the body as a begin expression
+ *   types           - the variables proven to hold one type, or #f
+ *                     until type inference has seen the lambda
+ *   code            - the threaded code of its procedures, or #f
+ *                     until --threaded has compiled it
+ *   parameters      - as written in the lambda expression, which
+ *                     its procedures keep no copy of
+ *
+ * As closures never point into frames, no frame outlives its call
+ * and all of them go on the region. */
+
+typedef struct lambda_scan {
+    object *defined;    /* by define at the lambda's own level */
+    object *referenced; /* at its own level or free in an inner lambda */
+    object *captured;   /* free in an inner lambda */
+    object *assigned;   /* by set! anywhere */
+} lambda_scan;
+
+char is_member(object *obj, object *list) {
+    while (!is_the_empty_list(list)) {
+        if (obj == car(list)) {
+            return 1;
+        }
+        list = cdr(list);
+    }
+    return 0;
+}
+
+object *adjoin_variable(object *var, object *vars) {
+    return is_member(var, vars) ? vars : cons(var, vars);
+}
+
+object *reverse_list(object *list) {
+    object *result;
+    
+    result = the_empty_list;
+    while (!is_the_empty_list(list)) {
+        result = cons(car(list), result);
+        list = cdr(list);
+    }
+    return result;
+}
+
+object *union_variables(object *vars1, object *vars2) {
+    while (!is_the_empty_list(vars1)) {
+        vars2 = adjoin_variable(car(vars1), vars2);
+        vars1 = cdr(vars1);
+    }
+    return vars2;
+}
+
+object *lambda_info(object *exp);
+
+object *lambda_info_free(object *info) {
+    return car(info);
+}
+
+object *lambda_info_frame_variables(object *info) {
+    return cadr(info);
+}
+
+object *lambda_info_boxes(object *info) {
+    return caddr(info);
+}
+
+object *lambda_info_assigned(object *info) {
+    return cadddr(info);
+}
+
+object *lambda_info_body(object *info) {
+    return car(cddddr(info));
+}
+
+object *lambda_info_types(object *info) {
+    return cadr(cddddr(info));
+}
+
+void set_lambda_info_types(object *info, object *types) {
+    set_car(cdr(cddddr(info)), types);
+}
+
+object *lambda_info_code(object *info) {
+    return car(cddr(cddddr(info)));
+}
+
+void set_lambda_info_code(object *info, object *code) {
+    set_car(cddr(cddddr(info)), code);
+}
+
+object *lambda_info_parameters(object *info) {
+    return car(cdddr(cddddr(info)));
+}
+
+void scan_exp(object *exp, lambda_scan *scan);
+
+void scan_sequence(object *seq, lambda_scan *scan) {
+    while (is_pair(seq)) {
+        scan_exp(car(seq), scan);
+        seq = cdr(seq);
+    }
+}
+
+void scan_exp(object *exp, lambda_scan *scan) {
+    object *info;
+    
+    if (is_symbol(exp)) {
+        scan->referenced = adjoin_variable(exp, scan->referenced);
+    }
+    else if (!is_pair(exp) || is_quoted(exp)) {
+        return;
+    }
+    else if (is_lambda(exp)) {
+        info = lambda_info(exp);
+        scan->referenced = union_variables(lambda_info_free(info),
+                                           scan->referenced);
+        scan->captured = union_variables(lambda_info_free(info),
+                                         scan->captured);
+        scan->assigned = union_variables(lambda_info_assigned(info),
+                                         scan->assigned);
+    }
+    else if (is_let(exp)) {
+        scan_exp(let_to_application(exp), scan);
+    }
+    else if (is_lazy(exp)) {
+        scan_exp(lazy_to_application(exp), scan);
+    }
+    else if (is_record_definition(exp)) {
+        scan_exp(record_definition_to_begin(exp), scan);
+    }
+    else if (is_cond(exp)) {
+        scan_exp(cond_to_if(exp), scan);
+    }
+    else if (is_definition(exp)) {
+        scan->defined = adjoin_variable(definition_variable(exp),
+                                        scan->defined);
+        scan_exp(definition_value(exp), scan);
+    }
+    else if (is_assignment(exp)) {
+        scan->referenced = adjoin_variable(assignment_variable(exp),
+                                           scan->referenced);
+        scan->assigned = adjoin_variable(assignment_variable(exp),
+                                         scan->assigned);
+        scan_exp(assignment_value(exp), scan);
+    }
+    else if (is_if(exp) || is_begin(exp) || is_and(exp) || is_or(exp)) {
+        scan_sequence(cdr(exp), scan);
+    }
+    else {
+        scan_sequence(exp, scan);
+    }
+}
+
+object *make_lambda_info(object *exp, lambda_scan *scan) {
+    object *parameters;
+    object *bound;
+    object *frame_vars;
+    object *free;
+    object *boxes;
+    object *vars;
+    char is_boxed;
+    char needs_boxes = 0;
+    char has_rest;
+    
+    parameters = lambda_parameters(exp);
+    bound = scan->defined;
+    for (vars = parameters; is_pair(vars); vars = cdr(vars)) {
+        bound = adjoin_variable(car(vars), bound);
+    }
+    has_rest = is_symbol(vars);
+    if (has_rest) { /* (lambda args ...) or (lambda (a . b) ...) */
+        bound = adjoin_variable(vars, bound);
+    }
+    
+    free = the_empty_list;
+    for (vars = scan->referenced; !is_the_empty_list(vars); vars = cdr(vars)) {
+        if (!is_member(car(vars), bound)) {
+            free = cons(car(vars), free);
+        }
+    }
+    
+    /* definitions go after the parameters so the arguments line up,
+     * but only for a proper parameter list */
+    frame_vars = parameters;
+    boxes = the_empty_list;
+    if (!has_rest) {
+        frame_vars = reverse_list(parameters);
+        for (vars = scan->defined; !is_the_empty_list(vars); vars = cdr(vars)) {
+            if (!is_member(car(vars), parameters)) {
+                frame_vars = cons(car(vars), frame_vars);
+                needs_boxes = 1;
+            }
+        }
+        frame_vars = reverse_list(frame_vars);
+        for (vars = frame_vars; !is_the_empty_list(vars); vars = cdr(vars)) {
+            is_boxed = is_member(car(vars), scan->captured) &&
+                       (is_member(car(vars), scan->assigned) ||
+                        is_member(car(vars), scan->defined));
+            needs_boxes = needs_boxes || is_boxed;
+            boxes = cons(is_boxed ? true : false, boxes);
+        }
+        boxes = needs_boxes ? reverse_list(boxes) : the_empty_list;
+    }
+    
+    for (vars = frame_vars; is_pair(vars); vars = cdr(vars)) {
+        note_bound_locally(car(vars));
+    }
+    if (is_symbol(vars)) {
+        note_bound_locally(vars);
+    }
+    
+    return cons(free,
+                cons(frame_vars,
+                     cons(boxes,
+                          cons(scan->assigned,
+                               cons(make_begin(lambda_body(exp)),
+                                    cons(false,
+                                         cons(false,
+                                              cons(lambda_parameters(exp),
+                                                   the_empty_list))))))));
+}
+
+/* the info is kept on the lambda expression */
+object *lambda_info(object *exp) {
+    lambda_scan scan;
+    
+    if (exp->data.pair.annotation == NULL) {
+        scan.defined = the_empty_list;
+        scan.referenced = the_empty_list;
+        scan.captured = the_empty_list;
+        scan.assigned = the_empty_list;
+        scan_sequence(lambda_body(exp), &scan);
+        exp->data.pair.annotation = make_lambda_info(exp, &scan);
+    }
+    return exp->data.pair.annotation;
+}
+
+object *make_closure(object *exp, object *env) {
+    object *info;
+    object *outermost;
+    object *free;
+    object *binding;
+    object *vars;
+    object *vals;
+    
+    info = lambda_info(exp);
+    outermost = outermost_environment(env);
+    if (env != outermost) {
+        vars = the_empty_list;
+        vals = the_empty_list;
+        for (free = lambda_info_free(info); 
+             !is_the_empty_list(free);
+             free = cdr(free)) {
+            binding = find_binding(car(free), env, outermost);
+            if (binding != NULL) {
+                vars = cons(car(free), vars);
+                vals = cons(car(binding), vals);
+            }
+        }
+        env = is_the_empty_list(vars) ?
+                  outermost :
+                  extend_environment(vars, vals, outermost);
+    }
+    return make_compound_proc(env, info);
+}
+
+/* boxes the arguments that need it and binds the internal
+ * definitions as unassigned */
+object *bind_arguments(object *boxes, object *arguments) {
+    object *value;
+    
+    if (is_the_empty_list(boxes)) {
+        return arguments;
+    }
+    if (is_the_empty_list(arguments)) {
+        value = unassigned;
+    }
+    else {
+        value = car(arguments);
+        arguments = cdr(arguments);
+    }
+    return region_cons(is_true(car(boxes)) ? make_box(value) : value,
+                       bind_arguments(cdr(boxes), arguments));
+}
+
+/* A call through a variable that was never bound locally can only
+ * reach a binding in the outermost frame, so the call site keeps the
+ * procedure it found there until any such binding changes. Moving to
+ * another outermost frame counts as a change. */
+typedef struct cached_call {
+    long version;
+    object *variable; /* the operator it was looked up for */
+    object *procedure;
+    /* the primitive type inference proved to get only fixnums here,
+     * or NULL */
+    object *(*fixnum_operation)(object *arguments);
+} cached_call;
+
+object *make_call_cache(void) {
+    object *obj;
+    cached_call *call;
+    
+    call = check_alloc(malloc(sizeof(cached_call)));
+    call->version = -1;
+    call->variable = NULL;
+    call->procedure = NULL;
+    call->fixnum_operation = NULL;
+    obj = alloc_object();
+    obj->type = CALL_CACHE;
+    obj->data.call_cache.call = call;
+    return obj;
+}
+
+object *call_cache(object *exp) {
+    if (exp->data.pair.annotation == NULL) {
+        exp->data.pair.annotation = make_call_cache();
+    }
+    return exp->data.pair.annotation;
+}
+
+object *last_outermost_environment = NULL;
+
+
+object *eval_operator(object *exp, object *env) {
+    object *var;
+    cached_call *call;
+    
+    var = operator(exp);
+    if (!is_symbol(var) || var->data.symbol.is_bound_locally) {
+        return eval(var, env);
+    }
+    env = outermost_environment(env);
+    if (env != last_outermost_environment) {
+        last_outermost_environment = env;
+        binding_version++;
+    }
+    call = call_cache(exp)->data.call_cache.call;
+    /* set-car! may have given the call another operator */
+    if (call->version != binding_version ||
+        call->variable != var) {
+        call->variable = var;
+        call->procedure = lookup_variable_value(var, env);
+        call->version = binding_version;
+    }
+    return call->procedure;
+}
+
+/* With --infer-types each lambda is walked once, together with what
+ * is known of its enclosing scope, to find the variables that can
+ * only ever hold one type: those bound by let to a literal or to the
+ * result of a primitive, parameters of internal procedures called
+ * with one type from every call site, and variables tested with
+ * fixnum? or pair? in the consequent of an if. Calls to the fixnum
+ * primitives whose operands are all proven fixnums are marked and
+ * then evaluated in place, with no argument list and no type checks.
+ *
+ * The proofs assume the names of the typed primitives are bound to
+ * those primitives, and that arithmetic never leaves the fixnums. A
+ * marked call checks the first against the procedure it is about to
+ * apply, and the second one operand at a time, going back to the
+ * primitive itself on the first that fails.
+ * --report-types prints the proven variables of each lambda. */
+
+char infer_types = 0;
+char report_types = 0;
+
+object *fixnum_type;
+object *boolean_type;
+object *pair_type;
+object *procedure_type;
+object *unknown_type;
+object *assigned_type;  /* unknown and never refined by a test */
+object *no_type;        /* no call seen yet */
+
+typedef struct primitive_type {
+    char *name;
+    object *(*fn)(object *arguments);
+    object **result_type;
+    char is_fixnum_operation;
+    object *symbol;
+} primitive_type;
+
+primitive_type primitive_types[] = {
+    {"+"            , add_proc             , &fixnum_type , 1},
+    {"-"            , sub_proc             , &fixnum_type , 1},
+    {"*"            , mul_proc             , &fixnum_type , 1},
+    {"quotient"     , quotient_proc        , &fixnum_type , 1},
+    {"remainder"    , remainder_proc       , &fixnum_type , 1},
+    {"="            , is_number_equal_proc , &boolean_type, 1},
+    {"<"            , is_less_than_proc    , &boolean_type, 1},
+    {">"            , is_greater_than_proc , &boolean_type, 1},
+    {"char->integer", char_to_integer_proc , &fixnum_type , 0},
+    {"null?"        , is_null_proc         , &boolean_type, 0},
+    {"boolean?"     , is_boolean_proc      , &boolean_type, 0},
+    {"symbol?"      , is_symbol_proc       , &boolean_type, 0},
+    {"integer?"     , is_integer_proc      , &boolean_type, 0},
+    {"fixnum?"      , is_fixnum_proc       , &boolean_type, 0},
+    {"char?"        , is_char_proc         , &boolean_type, 0},
+    {"string?"      , is_string_proc       , &boolean_type, 0},
+    {"pair?"        , is_pair_proc         , &boolean_type, 0},
+    {"vector?"      , is_vector_proc       , &boolean_type, 0},
+    {"vector-length", vector_length_proc   , &fixnum_type , 0},
+    {"procedure?"   , is_procedure_proc    , &boolean_type, 0},
+    {"eq?"          , is_eq_proc           , &boolean_type, 0},
+    {"equal?"       , is_equal_proc        , &boolean_type, 0},
+    {"cons"         , cons_proc            , &pair_type   , 0},
+    {NULL}
+};
+
+void init_primitive_types(void) {
+    primitive_type *entry;
+    
+    fixnum_type = make_symbol("fixnum");
+    boolean_type = make_symbol("boolean");
+    pair_type = make_symbol("pair");
+    procedure_type = make_symbol("procedure");
+    unknown_type = make_symbol("unknown");
+    assigned_type = make_symbol("assigned");
+    no_type = make_symbol("none");
+    for (entry = primitive_types; entry->name != NULL; entry++) {
+        entry->symbol = make_symbol(entry->name);
+    }
+}
+
+primitive_type *find_primitive_type(object *var) {
+    primitive_type *entry;
+    
+    for (entry = primitive_types; entry->name != NULL; entry++) {
+        if (entry->symbol == var) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+object *assq(object *key, object *alist) {
+    while (!is_the_empty_list(alist)) {
+        if (caar(alist) == key) {
+            return car(alist);
+        }
+        alist = cdr(alist);
+    }
+    return NULL;
+}
+
+/* The type of a variable is its binding in an association list of
+ * the variables in scope. An internal procedure is known by that
+ * binding, which keys the list of its parameter types met over all
+ * its calls so far. The lists are kept by definition across passes
+ * over the outermost lambda, which go on until no list changes. */
+
+int type_changes;
+object *internal_procedures;
+
+object *meet_types(object *type1, object *type2) {
+    if (type1 == no_type) {
+        return type2;
+    }
+    if (type2 == no_type) {
+        return type1;
+    }
+    return (type1 == type2) ? type1 : unknown_type;
+}
+
+void meet_argument_types(object *parameter_types, object *argument_types) {
+    object *type;
+    
+    while (!is_the_empty_list(parameter_types)) {
+        type = meet_types(car(parameter_types),
+                          is_the_empty_list(argument_types) ?
+                              unknown_type :
+                              car(argument_types));
+        if (type != car(parameter_types)) {
+            set_car(parameter_types, type);
+            type_changes++;
+        }
+        parameter_types = cdr(parameter_types);
+        if (!is_the_empty_list(argument_types)) {
+            argument_types = cdr(argument_types);
+        }
+    }
+}
+
+char is_only_called(object *var, object *exp, object *definition);
+
+char is_only_called_in_sequence(object *var, object *seq,
+                                object *definition) {
+    while (is_pair(seq)) {
+        if (!is_only_called(var, car(seq), definition)) {
+            return 0;
+        }
+        seq = cdr(seq);
+    }
+    return 1;
+}
+
+/* whether var appears in exp only as the operator of calls, and is
+ * defined nowhere but in definition */
+char is_only_called(object *var, object *exp, object *definition) {
+    if (exp == var) {
+        return 0;
+    }
+    else if (!is_pair(exp) || is_quoted(exp)) {
+        return 1;
+    }
+    else if (is_lambda(exp)) {
+        return is_only_called_in_sequence(var, lambda_body(exp),
+                                          definition);
+    }
+    else if (is_let(exp)) {
+        return is_only_called(var, let_to_application(exp), definition);
+    }
+    else if (is_lazy(exp)) {
+        return is_only_called(var, lazy_to_application(exp), definition);
+    }
+    else if (is_record_definition(exp)) {
+        return is_only_called(var, record_definition_to_begin(exp),
+                              definition);
+    }
+    else if (is_cond(exp)) {
+        return is_only_called(var, cond_to_if(exp), definition);
+    }
+    else if (is_definition(exp)) {
+        return (exp == definition || definition_variable(exp) != var) &&
+               is_only_called(var, definition_value(exp), definition);
+    }
+    else if (is_assignment(exp)) {
+        return assignment_variable(exp) != var &&
+               is_only_called(var, assignment_value(exp), definition);
+    }
+    else if (is_if(exp) || is_begin(exp) || is_and(exp) || is_or(exp)) {
+        return is_only_called_in_sequence(var, cdr(exp), definition);
+    }
+    else if (operator(exp) == var) {
+        return is_only_called_in_sequence(var, operands(exp), definition);
+    }
+    else {
+        return is_only_called_in_sequence(var, exp, definition);
+    }
+}
+
+object *infer_exp(object *exp, object *types, object *procs,
+                  char is_final);
+
+object *infer_sequence(object *seq, object *types, object *procs,
+                       char is_final) {
+    object *type;
+    
+    type = unknown_type;
+    while (is_pair(seq)) {
+        type = infer_exp(car(seq), types, procs, is_final);
+        seq = cdr(seq);
+    }
+    return type;
+}
+
+object *infer_operands(object *exps, object *types, object *procs,
+                       char is_final) {
+    object *type;
+    
+    if (is_no_operands(exps)) {
+        return the_empty_list;
+    }
+    type = infer_exp(first_operand(exps), types, procs, is_final);
+    return cons(type,
+                infer_operands(rest_operands(exps), types, procs,
+                               is_final));
+}
+
+void report_lambda_types(object *name, object *types, object *vars) {
+    object *binding;
+    char is_first = 1;
+    
+    while (is_pair(vars)) {
+        binding = assq(car(vars), types);
+        if (cdr(binding) != unknown_type &&
+            cdr(binding) != assigned_type &&
+            cdr(binding) != no_type) {
+            if (is_first) {
+                fprintf(stderr, "; %s:",
+                        name == NULL ? "lambda" : name->data.symbol.value);
+                is_first = 0;
+            }
+            else {
+                fprintf(stderr, ",");
+            }
+            fprintf(stderr, " %s %s", car(vars)->data.symbol.value,
+                    cdr(binding)->data.symbol.value);
+        }
+        vars = cdr(vars);
+    }
+    if (!is_first) {
+        fprintf(stderr, "\n");
+    }
+}
+
+object *infer_lambda(object *exp, object *types, object *argument_types,
+                     object *procs, object *name, char is_final);
+
+object *infer_application(object *exp, object *types, object *procs,
+                          char is_final) {
+    object *argument_types;
+    object *binding;
+    object *proc;
+    primitive_type *entry;
+    object *exps;
+    int count;
+    
+    argument_types = infer_operands(operands(exp), types, procs, is_final);
+    if (is_lambda(operator(exp))) {
+        return infer_lambda(operator(exp), types, argument_types, procs,
+                            NULL, is_final);
+    }
+    if (!is_symbol(operator(exp))) {
+        infer_exp(operator(exp), types, procs, is_final);
+        return unknown_type;
+    }
+    binding = assq(operator(exp), types);
+    if (binding != NULL) {
+        proc = assq(binding, procs);
+        if (proc != NULL) {
+            meet_argument_types(cdr(proc), argument_types);
+        }
+        return unknown_type;
+    }
+    entry = find_primitive_type(operator(exp));
+    if (entry == NULL) {
+        return unknown_type;
+    }
+    if (is_final && entry->is_fixnum_operation) {
+        count = 0;
+        for (exps = argument_types; is_pair(exps); exps = cdr(exps)) {
+            if (car(exps) != fixnum_type) {
+                count = -1;
+                break;
+            }
+            count++;
+        }
+        if ((entry->fn == quotient_proc || entry->fn == remainder_proc) ?
+                count == 2 : count >= 1) {
+            call_cache(exp)->data.call_cache.call->fixnum_operation =
+                entry->fn;
+        }
+    }
+    return *entry->result_type;
+}
+
+object *infer_if(object *exp, object *types, object *procs,
+                 char is_final) {
+    object *predicate;
+    object *consequent_types;
+    object *binding;
+    object *type;
+    
+    predicate = if_predicate(exp);
+    infer_exp(predicate, types, procs, is_final);
+    
+    /* (if (fixnum? x) ...) proves x in the consequent */
+    consequent_types = types;
+    if (is_pair(predicate) && is_symbol(car(predicate)) &&
+        is_pair(cdr(predicate)) && is_symbol(cadr(predicate)) &&
+        is_the_empty_list(cddr(predicate)) &&
+        assq(car(predicate), types) == NULL) {
+        binding = assq(cadr(predicate), types);
+        type = NULL;
+        if (find_primitive_type(car(predicate)) != NULL) {
+            if (find_primitive_type(car(predicate))->fn == is_fixnum_proc) {
+                type = fixnum_type;
+            }
+            else if (find_primitive_type(car(predicate))->fn ==
+                         is_pair_proc) {
+                type = pair_type;
+            }
+        }
+        if (type != NULL && binding != NULL &&
+            cdr(binding) != assigned_type &&
+            assq(binding, procs) == NULL) {
+            consequent_types = cons(cons(cadr(predicate), type), types);
+        }
+    }
+    return meet_types(
+               infer_exp(if_consequent(exp), consequent_types, procs,
+                         is_final),
+               infer_exp(if_alternative(exp), types, procs, is_final));
+}
+
+object *infer_exp(object *exp, object *types, object *procs,
+                  char is_final) {
+    object *binding;
+    object *proc;
+    
+    if (is_fixnum(exp)) {
+        return fixnum_type;
+    }
+    else if (is_boolean(exp)) {
+        return boolean_type;
+    }
+    else if (is_symbol(exp)) {
+        binding = assq(exp, types);
+        return (binding == NULL || cdr(binding) == assigned_type) ?
+                   unknown_type : cdr(binding);
+    }
+    else if (!is_pair(exp) || is_quoted(exp)) {
+        return unknown_type;
+    }
+    else if (is_lambda(exp)) {
+        infer_lambda(exp, types, the_empty_list, procs, NULL, is_final);
+        return procedure_type;
+    }
+    else if (is_let(exp)) {
+        return infer_exp(let_to_application(exp), types, procs, is_final);
+    }
+    else if (is_lazy(exp)) {
+        return infer_exp(lazy_to_application(exp), types, procs, is_final);
+    }
+    else if (is_record_definition(exp)) {
+        return infer_exp(record_definition_to_begin(exp), types, procs,
+                         is_final);
+    }
+    else if (is_cond(exp)) {
+        return infer_exp(cond_to_if(exp), types, procs, is_final);
+    }
+    else if (is_definition(exp)) {
+        binding = assq(definition_variable(exp), types);
+        proc = (binding == NULL) ? NULL : assq(binding, procs);
+        if (proc != NULL) {
+            infer_lambda(definition_value(exp), types, cdr(proc), procs,
+                         definition_variable(exp), is_final);
+        }
+        else {
+            infer_exp(definition_value(exp), types, procs, is_final);
+        }
+        return unknown_type;
+    }
+    else if (is_assignment(exp)) {
+        infer_exp(assignment_value(exp), types, procs, is_final);
+        return unknown_type;
+    }
+    else if (is_if(exp)) {
+        return infer_if(exp, types, procs, is_final);
+    }
+    else if (is_begin(exp)) {
+        return infer_sequence(begin_actions(exp), types, procs, is_final);
+    }
+    else if (is_and(exp) || is_or(exp)) {
+        infer_sequence(cdr(exp), types, procs, is_final);
+        return unknown_type;
+    }
+    else {
+        return infer_application(exp, types, procs, is_final);
+    }
+}
+
+/* the definition of var among the expressions of a lambda body whose
+ * value is a lambda, or NULL */
+object *internal_procedure_definition(object *var, object *body) {
+    while (is_pair(body)) {
+        if (is_definition(car(body)) &&
+            definition_variable(car(body)) == var &&
+            is_lambda(definition_value(car(body)))) {
+            return car(body);
+        }
+        body = cdr(body);
+    }
+    return NULL;
+}
+
+object *infer_lambda(object *exp, object *types, object *argument_types,
+                     object *procs, object *name, char is_final) {
+    object *info;
+    object *vars;
+    object *definition;
+    object *type;
+    object *parameters;
+    object *parameter_types;
+    object *result;
+    
+    info = lambda_info(exp);
+    if (is_true(lambda_info_types(info))) {
+        return unknown_type;
+    }
+    
+    /* definitions in the body of (lambda args ...) are not bound up
+     * front, so nothing is known about such a lambda */
+    vars = lambda_parameters(exp);
+    while (is_pair(vars)) {
+        vars = cdr(vars);
+    }
+    if (!is_the_empty_list(vars)) {
+        if (is_final) {
+            set_lambda_info_types(info, the_empty_list);
+        }
+        return unknown_type;
+    }
+    
+    for (vars = lambda_info_frame_variables(info);
+         is_pair(vars);
+         vars = cdr(vars)) {
+        if (is_member(car(vars), lambda_info_assigned(info))) {
+            type = assigned_type;
+        }
+        else if (is_pair(argument_types)) {
+            type = car(argument_types);
+        }
+        else {
+            type = unknown_type;
+        }
+        if (is_pair(argument_types)) {
+            argument_types = cdr(argument_types);
+        }
+        else {
+            argument_types = the_empty_list;
+        }
+        types = cons(cons(car(vars), type), types);
+        
+        /* an internal procedure that is only ever called learns its
+         * parameter types from the calls */
+        definition = internal_procedure_definition(car(vars),
+                                                   lambda_body(exp));
+        if (definition != NULL &&
+            type != assigned_type &&
+            !is_member(car(vars), lambda_parameters(exp)) &&
+            is_only_called_in_sequence(car(vars), lambda_body(exp),
+                                       definition)) {
+            set_cdr(car(types), procedure_type);
+            parameter_types = assq(definition, internal_procedures);
+            if (parameter_types == NULL) {
+                parameter_types = cons(definition, the_empty_list);
+                for (parameters =
+                         lambda_parameters(definition_value(definition));
+                     is_pair(parameters);
+                     parameters = cdr(parameters)) {
+                    set_cdr(parameter_types,
+                            cons(no_type, cdr(parameter_types)));
+                }
+                internal_procedures = cons(parameter_types,
+                                           internal_procedures);
+            }
+            procs = cons(cons(car(types), cdr(parameter_types)), procs);
+        }
+    }
+    
+    result = infer_sequence(lambda_body(exp), types, procs, is_final);
+    if (is_final) {
+        if (report_types) {
+            report_lambda_types(name, types,
+                                lambda_info_frame_variables(info));
+        }
+        set_lambda_info_types(info, types);
+    }
+    return result;
+}
+
+object *infer_outermost(object *exp, object *name, char is_final) {
+    return is_lambda(exp) ?
+               infer_lambda(exp, the_empty_list, the_empty_list,
+                            the_empty_list, name, is_final) :
+               infer_exp(exp, the_empty_list, the_empty_list, is_final);
+}
+
+/* exp is a lambda or an application of one */
+void infer_lambda_types(object *exp, object *name) {
+    object *info;
+    int changes;
+    
+    info = lambda_info(is_lambda(exp) ? exp : operator(exp));
+    if (!infer_types || is_true(lambda_info_types(info))) {
+        return;
+    }
+    internal_procedures = the_empty_list;
+    do {
+        changes = type_changes;
+        infer_outermost(exp, name, 0);
+    } while (changes != type_changes);
+    infer_outermost(exp, name, 1);
+}
+
+/* a marked call of +, -, *, quotient, remainder, =, < or > on
+ * operands proven to be fixnums */
+object *list_of_values(object *exps, object *env);
+
+/* An operation that overflows, or an operand that came back a
+ * bignum, finishes on the checked path with what is left. */
+object *eval_fixnum_application(object *procedure, object *operands,
+                                object *env) {
+    object *(*fn)(object *arguments);
+    object *value;
+    long result;
+    long next;
+    char is_true_result = 1;
+    char overflows;
+    
+    fn = procedure->data.primitive_proc.fn;
+    value = eval(first_operand(operands), env);
+    if (!is_fixnum(value)) {
+        return fn(cons(value,
+                       list_of_values(rest_operands(operands), env)));
+    }
+    result = value->data.fixnum.value;
+    while (!is_no_operands(operands = rest_operands(operands))) {
+        value = eval(first_operand(operands), env);
+        if (!is_fixnum(value)) {
+            break;
+        }
+        next = value->data.fixnum.value;
+        overflows = 0;
+        if (fn == add_proc) {
+            overflows = add_overflows(result, next, &next);
+        }
+        else if (fn == sub_proc) {
+            overflows = sub_overflows(result, next, &next);
+        }
+        else if (fn == mul_proc) {
+            overflows = mul_overflows(result, next, &next);
+        }
+        else if (fn == quotient_proc || fn == remainder_proc) {
+            overflows = next == 0 || (next == -1 && result == LONG_MIN);
+            if (!overflows) {
+                next = (fn == quotient_proc) ? result / next :
+                                               result % next;
+            }
+        }
+        else {
+            is_true_result = is_true_result &&
+                             ((fn == is_number_equal_proc) ?
+                                  result == next :
+                              (fn == is_less_than_proc) ?
+                                  result < next :
+                                  result > next);
+        }
+        if (overflows) {
+            break;
+        }
+        result = next;
+    }
+    if (!is_no_operands(operands)) {
+        value = fn(cons(make_fixnum(result),
+                        cons(value,
+                             list_of_values(rest_operands(operands), env))));
+        return is_true_result ? value : false;
+    }
+    if (fn == is_number_equal_proc || fn == is_less_than_proc ||
+        fn == is_greater_than_proc) {
+        return is_true_result ? true : false;
+    }
+    return make_fixnum(result);
+}
+
+/* With --dump-ir each procedure defined at top level is also lowered
+ * to an intermediate representation and run through the optimizer,
+ * and the result of every pass is printed to stderr.
+ *
+ * A lambda lowers to a function: a graph of basic blocks holding
+ * instructions in static single assignment form. Each instruction
+ * computes at most one value and is its own name for that value.
+ * Variables that are never assigned are just the value bound to
+ * them. Assigned variables and internal definitions live in cells.
+ * Inner lambdas lower to their own functions, and a closure
+ * instruction lists the values or cells they capture. Calls through
+ * global names bound to primitives become primitive operations. The
+ * function assumes those names, and those of the procedures inlined
+ * into it, keep their bindings. */
+
+char dump_ir = 0;
+
+typedef enum {
+    IR_PARAM,      /* argument index; rest list at parameter_count */
+    IR_FREE,       /* captured value or cell index */
+    IR_CONST,      /* value */
+    IR_GLOBAL,     /* value names the variable */
+    IR_SET_GLOBAL, /* value names the variable */
+    IR_COPY,
+    IR_PHI,        /* one operand for each predecessor, in order */
+    IR_PRIM,       /* value names the primitive, fn calls it */
+    IR_CALL,       /* procedure then arguments */
+    IR_CLOSURE,    /* function, operands are what it captures */
+    IR_CELL,       /* value names the variable */
+    IR_CELL_REF,
+    IR_CELL_SET,
+    IR_JUMP,       /* the rest end a block */
+    IR_BRANCH,
+    IR_RETURN,
+    IR_TAIL_CALL
+} ir_opcode;
+
+char *ir_opcode_names[] = {
+    "param", "free", "const", "global", "set-global!", "copy", "phi",
+    "prim", "call", "closure", "cell", "cell-ref", "cell-set!",
+    "jump", "branch", "return", "tail-call"
+};
+
+typedef struct ir_instr {
+    ir_opcode opcode;
+    int number;
+    int index;
+    object *value;
+    object *(*fn)(object *arguments);
+    struct ir_function *function;
+    int operand_count;
+    struct ir_instr **operands;
+    struct ir_block *targets[2];
+    struct ir_block *block;
+    struct ir_instr *prev;
+    struct ir_instr *next;
+    char is_marked;
+} ir_instr;
+
+typedef struct ir_block {
+    int number;
+    int order;              /* in postorder, for dominators */
+    ir_instr *first;
+    ir_instr *last;
+    int pred_count;
+    struct ir_block **preds;
+    struct ir_block *idom;
+    struct ir_block *next;
+    int offset;             /* of its code, see threaded code */
+    char is_marked;
+} ir_block;
+
+typedef struct ir_function {
+    int id;
+    object *name;
+    object *parameters;
+    int parameter_count;
+    char has_rest;
+    object *info;           /* of the lambda */
+    object *captured;       /* names of the values of IR_FREE */
+    object *env;            /* the outermost environment */
+    object *assumed;        /* alist of global names to their values */
+    ir_block *entry;
+} ir_function;
+
+ir_function *make_ir_function(object *name, object *parameters,
+                              object *env) {
+    ir_function *function;
+    object *vars;
+    
+    function = check_alloc(malloc(sizeof(ir_function)));
+    function->id = 0;
+    function->name = name;
+    function->parameters = parameters;
+    function->parameter_count = 0;
+    for (vars = parameters; is_pair(vars); vars = cdr(vars)) {
+        function->parameter_count++;
+    }
+    function->has_rest = is_symbol(vars);
+    function->info = NULL;
+    function->captured = the_empty_list;
+    function->env = env;
+    function->assumed = the_empty_list;
+    function->entry = NULL;
+    return function;
+}
+
+ir_block *make_ir_block(ir_function *function) {
+    ir_block *block;
+    ir_block *last;
+    
+    block = check_alloc(malloc(sizeof(ir_block)));
+    block->number = 0;
+    block->order = 0;
+    block->first = NULL;
+    block->last = NULL;
+    block->pred_count = 0;
+    block->preds = NULL;
+    block->idom = NULL;
+    block->next = NULL;
+    block->offset = 0;
+    block->is_marked = 0;
+    if (function->entry == NULL) {
+        function->entry = block;
+    }
+    else {
+        last = function->entry;
+        while (last->next != NULL) {
+            last = last->next;
+        }
+        last->next = block;
+    }
+    return block;
+}
+
+ir_instr *make_ir_instr(ir_opcode opcode, int operand_count) {
+    ir_instr *instr;
+    
+    instr = check_alloc(malloc(sizeof(ir_instr)));
+    instr->opcode = opcode;
+    instr->number = -1;
+    instr->index = 0;
+    instr->value = NULL;
+    instr->fn = NULL;
+    instr->function = NULL;
+    instr->operand_count = operand_count;
+    instr->operands = (operand_count == 0) ?
+                          NULL :
+                          check_alloc(malloc(operand_count *
+                                             sizeof(ir_instr *)));
+    instr->targets[0] = NULL;
+    instr->targets[1] = NULL;
+    instr->block = NULL;
+    instr->prev = NULL;
+    instr->next = NULL;
+    instr->is_marked = 0;
+    return instr;
+}
+
+char is_ir_terminator(ir_instr *instr) {
+    return instr->opcode >= IR_JUMP;
+}
+
+char has_ir_value(ir_instr *instr) {
+    return !is_ir_terminator(instr) &&
+           instr->opcode != IR_SET_GLOBAL &&
+           instr->opcode != IR_CELL_SET;
+}
+
+void insert_ir_instr_after(ir_block *block, ir_instr *prev,
+                           ir_instr *instr) {
+    instr->block = block;
+    instr->prev = prev;
+    instr->next = (prev == NULL) ? block->first : prev->next;
+    if (instr->next == NULL) {
+        block->last = instr;
+    }
+    else {
+        instr->next->prev = instr;
+    }
+    if (prev == NULL) {
+        block->first = instr;
+    }
+    else {
+        prev->next = instr;
+    }
+}
+
+void append_ir_instr(ir_block *block, ir_instr *instr) {
+    insert_ir_instr_after(block, block->last, instr);
+}
+
+void remove_ir_instr(ir_instr *instr) {
+    if (instr->prev == NULL) {
+        instr->block->first = instr->next;
+    }
+    else {
+        instr->prev->next = instr->next;
+    }
+    if (instr->next == NULL) {
+        instr->block->last = instr->prev;
+    }
+    else {
+        instr->next->prev = instr->prev;
+    }
+}
+
+void add_ir_operand(ir_instr *instr, ir_instr *operand) {
+    ir_instr **operands;
+    int i;
+    
+    operands = check_alloc(malloc((instr->operand_count + 1) *
+                                  sizeof(ir_instr *)));
+    for (i = 0; i < instr->operand_count; i++) {
+        operands[i] = instr->operands[i];
+    }
+    operands[i] = operand;
+    free(instr->operands);
+    instr->operands = operands;
+    instr->operand_count++;
+}
+
+void remove_ir_operand(ir_instr *instr, int index) {
+    int i;
+    
+    for (i = index; i < instr->operand_count - 1; i++) {
+        instr->operands[i] = instr->operands[i + 1];
+    }
+    instr->operand_count--;
+}
+
+/* the terminator of a block, or NULL while it is being built */
+ir_instr *ir_terminator(ir_block *block) {
+    return (block->last != NULL && is_ir_terminator(block->last)) ?
+               block->last : NULL;
+}
+
+int ir_successor_count(ir_block *block) {
+    ir_instr *last;
+    
+    last = ir_terminator(block);
+    if (last == NULL) {
+        return 0;
+    }
+    return (last->opcode == IR_JUMP) ? 1 :
+           (last->opcode == IR_BRANCH) ? 2 : 0;
+}
+
+void add_ir_edge(ir_block *from, ir_block *to) {
+    ir_block **preds;
+    int i;
+    
+    preds = check_alloc(malloc((to->pred_count + 1) * sizeof(ir_block *)));
+    for (i = 0; i < to->pred_count; i++) {
+        preds[i] = to->preds[i];
+    }
+    preds[i] = from;
+    free(to->preds);
+    to->preds = preds;
+    to->pred_count++;
+}
+
+/* drops one edge and the operands the phis in to had for it */
+void remove_ir_edge(ir_block *from, ir_block *to) {
+    ir_instr *instr;
+    int i;
+    int index;
     
-    eof_object = alloc_object();
-    eof_object->type = EOF_OBJECT;
+    index = 0;
+    while (to->preds[index] != from) {
+        index++;
+    }
+    for (i = index; i < to->pred_count - 1; i++) {
+        to->preds[i] = to->preds[i + 1];
+    }
+    to->pred_count--;
+    for (instr = to->first;
+         instr != NULL && instr->opcode == IR_PHI;
+         instr = instr->next) {
+        remove_ir_operand(instr, index);
+    }
+}
+
+void replace_ir_pred(ir_block *block, ir_block *old, ir_block *new) {
+    int i;
     
-    the_empty_environment = the_empty_list;
+    for (i = 0; i < block->pred_count; i++) {
+        if (block->preds[i] == old) {
+            block->preds[i] = new;
+        }
+    }
+}
 
-    the_global_environment = make_environment();
+void replace_ir_uses(ir_function *function, ir_instr *old,
+                     ir_instr *new) {
+    ir_block *block;
+    ir_instr *instr;
+    int i;
+    
+    for (block = function->entry; block != NULL; block = block->next) {
+        for (instr = block->first; instr != NULL; instr = instr->next) {
+            for (i = 0; i < instr->operand_count; i++) {
+                if (instr->operands[i] == old) {
+                    instr->operands[i] = new;
+                }
+            }
+        }
+    }
 }
 
-/***************************** READ ******************************/
+/* Lowering */
 
-char is_delimiter(int c) {
-    return isspace(c) || c == EOF ||
-           c == '('   || c == ')' ||
-           c == '"'   || c == ';';
+typedef struct ir_variable {
+    object *name;
+    ir_instr *value;        /* or the cell holding it */
+    char is_cell;
+    struct ir_variable *next;
+} ir_variable;
+
+typedef struct ir_builder {
+    ir_function *function;
+    ir_block *block;        /* NULL once the block has ended */
+} ir_builder;
+
+ir_variable *bind_ir_variable(object *name, ir_instr *value, char is_cell,
+                              ir_variable *vars) {
+    ir_variable *var;
+    
+    var = check_alloc(malloc(sizeof(ir_variable)));
+    var->name = name;
+    var->value = value;
+    var->is_cell = is_cell;
+    var->next = vars;
+    return var;
 }
 
-char is_initial(int c) {
-    return isalpha(c) || c == '*' || c == '/' || c == '>' ||
-             c == '<' || c == '=' || c == '?' || c == '!';
+ir_variable *find_ir_variable(object *name, ir_variable *vars) {
+    while (vars != NULL && vars->name != name) {
+        vars = vars->next;
+    }
+    return vars;
 }
 
-int peek(FILE *in) {
-    int c;
+ir_instr *emit_ir(ir_builder *b, ir_opcode opcode, int operand_count) {
+    ir_instr *instr;
+    
+    instr = make_ir_instr(opcode, operand_count);
+    append_ir_instr(b->block, instr);
+    return instr;
+}
 
-    c = getc(in);
-    ungetc(c, in);
-    return c;
+ir_instr *emit_ir_const(ir_builder *b, object *value) {
+    ir_instr *instr;
+    
+    instr = emit_ir(b, IR_CONST, 0);
+    instr->value = value;
+    return instr;
 }
 
-void eat_whitespace(FILE *in) {
-    int c;
+ir_instr *emit_ir_jump(ir_builder *b, ir_block *target) {
+    ir_instr *instr;
     
-    while ((c = getc(in)) != EOF) {
-        if (isspace(c)) {
-            continue;
-        }
-        else if (c == ';') { /* comments are whitespace also */
-            while (((c = getc(in)) != EOF) && (c != '\n'));
-            continue;
-        }
-        ungetc(c, in);
-        break;
-    }
+    instr = emit_ir(b, IR_JUMP, 0);
+    instr->targets[0] = target;
+    add_ir_edge(b->block, target);
+    return instr;
 }
 
-void eat_expected_string(FILE *in, char *str) {
-    int c;
+ir_instr *make_ir_phi(ir_block *block) {
+    ir_instr *phi;
+    
+    phi = make_ir_instr(IR_PHI, 0);
+    insert_ir_instr_after(block, NULL, phi);
+    return phi;
+}
 
-    while (*str != '\0') {
-        c = getc(in);
-        if (c != *str) {
-            fprintf(stderr, "unexpected character '%c'\n", c);
-            exit(1);
-        }
-        str++;
+/* ends the block with a return of value when in tail position */
+ir_instr *ir_result(ir_builder *b, ir_instr *value, char is_tail) {
+    ir_instr *instr;
+    
+    if (!is_tail) {
+        return value;
     }
+    instr = emit_ir(b, IR_RETURN, 1);
+    instr->operands[0] = value;
+    b->block = NULL;
+    return NULL;
 }
 
-void peek_expected_delimiter(FILE *in) {
-    if (!is_delimiter(peek(in))) {
-        fprintf(stderr, "character not followed by delimiter\n");
-        exit(1);
+/* the value of a global name that the function may assume, or NULL */
+object *assumable_global_value(ir_function *function, object *var) {
+    object *binding;
+    
+    binding = find_binding(var, function->env, the_empty_environment);
+    return (binding == NULL) ? NULL : binding_value(binding);
+}
+
+void assume_global(ir_function *function, object *var, object *value) {
+    if (assq(var, function->assumed) == NULL) {
+        function->assumed = cons(cons(var, value), function->assumed);
     }
 }
 
-object *read_character(FILE *in) {
-    int c;
+void collect_ir_definitions(object *exp, object **defined);
 
-    c = getc(in);
-    switch (c) {
-        case EOF:
-            fprintf(stderr, "incomplete character literal\n");
-            exit(1);
-        case 's':
-            if (peek(in) == 'p') {
-                eat_expected_string(in, "pace");
-                peek_expected_delimiter(in);
-                return make_character(' ');
-            }
-            break;
-        case 'n':
-            if (peek(in) == 'e') {
-                eat_expected_string(in, "ewline");
-                peek_expected_delimiter(in);
-                return make_character('\n');
-            }
-            break;
+void collect_ir_definitions_in_sequence(object *seq, object **defined) {
+    while (is_pair(seq)) {
+        collect_ir_definitions(car(seq), defined);
+        seq = cdr(seq);
     }
-    peek_expected_delimiter(in);
-    return make_character(c);
 }
 
-object *read_pair(FILE *in) {
-    int c;
-    object *car_obj;
-    object *cdr_obj;
-    
-    eat_whitespace(in);
-    
-    c = getc(in);
-    if (c == ')') { /* read the empty list */
-        return the_empty_list;
+/* the variables defined at the level of a lambda body, as scan_exp
+ * finds them */
+void collect_ir_definitions(object *exp, object **defined) {
+    if (!is_pair(exp) || is_quoted(exp) || is_lambda(exp)) {
+        return;
+    }
+    else if (is_let(exp)) {
+        collect_ir_definitions(let_to_application(exp), defined);
     }
-    ungetc(c, in);
+    else if (is_lazy(exp)) {
+        collect_ir_definitions(lazy_to_application(exp), defined);
+    }
+    else if (is_record_definition(exp)) {
+        collect_ir_definitions(record_definition_to_begin(exp), defined);
+    }
+    else if (is_cond(exp)) {
+        collect_ir_definitions(cond_to_if(exp), defined);
+    }
+    else if (is_definition(exp)) {
+        *defined = adjoin_variable(definition_variable(exp), *defined);
+        collect_ir_definitions(definition_value(exp), defined);
+    }
+    else if (is_assignment(exp)) {
+        collect_ir_definitions(assignment_value(exp), defined);
+    }
+    else {
+        collect_ir_definitions_in_sequence(cdr(exp), defined);
+        if (!is_if(exp) && !is_begin(exp) && !is_and(exp) && !is_or(exp)) {
+            collect_ir_definitions(car(exp), defined);
+        }
+    }
+}
 
-    car_obj = read(in);
+/* the number of parameters, or -1 with a rest parameter */
+int ir_parameter_count(object *parameters) {
+    int count = 0;
+    
+    while (is_pair(parameters)) {
+        count++;
+        parameters = cdr(parameters);
+    }
+    return is_the_empty_list(parameters) ? count : -1;
+}
 
-    eat_whitespace(in);
+char is_ir_parameter(object *var, object *parameters) {
+    while (is_pair(parameters)) {
+        if (car(parameters) == var) {
+            return 1;
+        }
+        parameters = cdr(parameters);
+    }
+    return parameters == var;
+}
+
+/* binds the parameters of a lambda to the values passed and its
+ * internal definitions to new cells */
+ir_variable *bind_ir_frame(ir_builder *b, object *parameters,
+                           object *info, ir_instr **values,
+                           ir_variable *vars) {
+    object *defined;
+    object *params;
+    object *var;
+    ir_instr *value;
+    ir_instr *cell;
+    char is_cell;
+    int i = 0;
     
-    c = getc(in);    
-    if (c == '.') { /* read improper list */
-        c = peek(in);
-        if (!is_delimiter(c)) {
-            fprintf(stderr, "dot not followed by delimiter\n");
-            exit(1);
+    defined = the_empty_list;
+    collect_ir_definitions(lambda_info_body(info), &defined);
+    params = parameters;
+    while (!is_the_empty_list(params)) {
+        if (is_pair(params)) {
+            var = car(params);
+            params = cdr(params);
         }
-        cdr_obj = read(in);
-        eat_whitespace(in);
-        c = getc(in);
-        if (c != ')') {
-            fprintf(stderr,
-                    "where was the trailing right paren?\n");
-            exit(1);
+        else {
+            var = params;
+            params = the_empty_list;
+        }
+        value = values[i++];
+        is_cell = is_member(var, lambda_info_assigned(info)) ||
+                  is_member(var, defined);
+        if (is_cell) {
+            cell = emit_ir(b, IR_CELL, 1);
+            cell->value = var;
+            cell->operands[0] = value;
+            value = cell;
         }
-        return cons(car_obj, cdr_obj);
+        vars = bind_ir_variable(var, value, is_cell, vars);
     }
-    else { /* read list */
-        ungetc(c, in);
-        cdr_obj = read_pair(in);        
-        return cons(car_obj, cdr_obj);
+    while (!is_the_empty_list(defined)) {
+        if (!is_ir_parameter(car(defined), parameters)) {
+            value = emit_ir_const(b, unassigned);
+            cell = emit_ir(b, IR_CELL, 1);
+            cell->value = car(defined);
+            cell->operands[0] = value;
+            vars = bind_ir_variable(car(defined), cell, 1, vars);
+        }
+        defined = cdr(defined);
     }
+    return vars;
 }
 
-object *read(FILE *in) {
-    int c;
-    short sign = 1;
-    int i;
-    long num = 0;
-#define BUFFER_MAX 1000
-    char buffer[BUFFER_MAX];
+ir_instr *lower_ir(ir_builder *b, object *exp, ir_variable *vars,
+                   char is_tail);
 
-    eat_whitespace(in);
+ir_function *lower_ir_function(object *name, object *parameters,
+                               object *info, object *captured,
+                               ir_variable *outer, object *env);
 
-    c = getc(in);    
+ir_instr *lower_ir_sequence(ir_builder *b, object *seq, ir_variable *vars,
+                            char is_tail) {
+    ir_instr *value;
+    
+    value = NULL;
+    while (is_pair(seq)) {
+        value = lower_ir(b, car(seq), vars,
+                         is_tail && is_the_empty_list(cdr(seq)));
+        seq = cdr(seq);
+    }
+    return value;
+}
 
-    if (c == '#') { /* read a boolean or character */
-        c = getc(in);
-        switch (c) {
-            case 't':
-                return true;
-            case 'f':
-                return false;
-            case '\\':
-                return read_character(in);
-            default:
-                fprintf(stderr,
-                        "unknown boolean or character literal\n");
-                exit(1);
-        }
+ir_instr *lower_ir_variable(ir_builder *b, object *exp, ir_variable *vars) {
+    ir_variable *var;
+    ir_instr *instr;
+    
+    var = find_ir_variable(exp, vars);
+    if (var == NULL) {
+        instr = emit_ir(b, IR_GLOBAL, 0);
+        instr->value = exp;
+        return instr;
     }
-    else if (isdigit(c) || (c == '-' && (isdigit(peek(in))))) {
-        /* read a fixnum */
-        if (c == '-') {
-            sign = -1;
+    if (var->is_cell) {
+        instr = emit_ir(b, IR_CELL_REF, 1);
+        instr->value = exp;
+        instr->operands[0] = var->value;
+        return instr;
+    }
+    return var->value;
+}
+
+ir_instr *lower_ir_assignment(ir_builder *b, object *var, object *exp,
+                              ir_variable *vars) {
+    ir_variable *local;
+    ir_instr *value;
+    ir_instr *instr;
+    
+    value = lower_ir(b, exp, vars, 0);
+    local = find_ir_variable(var, vars);
+    if (local == NULL) {
+        instr = emit_ir(b, IR_SET_GLOBAL, 1);
+        instr->value = var;
+        instr->operands[0] = value;
+    }
+    else {
+        instr = emit_ir(b, IR_CELL_SET, 2);
+        instr->operands[0] = local->value;
+        instr->operands[1] = value;
+    }
+    return emit_ir_const(b, ok_symbol);
+}
+
+ir_instr *lower_ir_if(ir_builder *b, object *exp, ir_variable *vars,
+                      char is_tail) {
+    ir_instr *predicate;
+    ir_instr *branch;
+    ir_instr *phi;
+    ir_instr *consequent;
+    ir_instr *alternative;
+    ir_block *consequent_end;
+    ir_block *alternative_end;
+    ir_block *join;
+    
+    predicate = lower_ir(b, if_predicate(exp), vars, 0);
+    branch = emit_ir(b, IR_BRANCH, 1);
+    branch->operands[0] = predicate;
+    branch->targets[0] = make_ir_block(b->function);
+    branch->targets[1] = make_ir_block(b->function);
+    add_ir_edge(b->block, branch->targets[0]);
+    add_ir_edge(b->block, branch->targets[1]);
+    
+    b->block = branch->targets[0];
+    consequent = lower_ir(b, if_consequent(exp), vars, is_tail);
+    consequent_end = b->block;
+    b->block = branch->targets[1];
+    alternative = lower_ir(b, if_alternative(exp), vars, is_tail);
+    alternative_end = b->block;
+    if (is_tail) {
+        return NULL;
+    }
+    join = make_ir_block(b->function);
+    b->block = consequent_end;
+    emit_ir_jump(b, join);
+    b->block = alternative_end;
+    emit_ir_jump(b, join);
+    phi = make_ir_phi(join);
+    add_ir_operand(phi, consequent);
+    add_ir_operand(phi, alternative);
+    b->block = join;
+    return phi;
+}
+
+/* Each test but the last leaves for exit when it decides the value:
+ * when false in an and, when true in an or. */
+ir_instr *lower_ir_and_or(ir_builder *b, object *tests, ir_variable *vars,
+                          char is_tail, char is_and) {
+    ir_instr *value;
+    ir_instr *branch;
+    ir_instr *phi;
+    ir_block *join;
+    ir_block *exit;
+    ir_block *next;
+    
+    if (is_the_empty_list(tests)) {
+        return ir_result(b, emit_ir_const(b, is_and ? true : false),
+                         is_tail);
+    }
+    join = is_tail ? NULL : make_ir_block(b->function);
+    phi = is_tail ? NULL : make_ir_phi(join);
+    while (!is_last_exp(tests)) {
+        value = lower_ir(b, first_exp(tests), vars, 0);
+        next = make_ir_block(b->function);
+        if (is_tail) {
+            exit = make_ir_block(b->function);
         }
         else {
-            ungetc(c, in);
-        }
-        while (isdigit(c = getc(in))) {
-            num = (num * 10) + (c - '0');
-        }
-        num *= sign;
-        if (is_delimiter(c)) {
-            ungetc(c, in);
-            return make_fixnum(num);
+            exit = join;
+            add_ir_operand(phi, value);
         }
-        else {
-            fprintf(stderr, "number not followed by delimiter\n");
-            exit(1);
+        branch = emit_ir(b, IR_BRANCH, 1);
+        branch->operands[0] = value;
+        branch->targets[is_and ? 0 : 1] = next;
+        branch->targets[is_and ? 1 : 0] = exit;
+        add_ir_edge(b->block, exit);
+        add_ir_edge(b->block, next);
+        if (is_tail) {
+            b->block = exit;
+            ir_result(b, value, 1);
         }
+        b->block = next;
+        tests = rest_exps(tests);
     }
-    else if (is_initial(c) ||
-             ((c == '+' || c == '-') &&
-              is_delimiter(peek(in)))) { /* read a symbol */
-        i = 0;
-        while (is_initial(c) || isdigit(c) ||
-               c == '+' || c == '-') {
-            /* subtract 1 to save space for '\0' terminator */
-            if (i < BUFFER_MAX - 1) {
-                buffer[i++] = c;
-            }
-            else {
-                fprintf(stderr, "symbol too long. "
-                        "Maximum length is %d\n", BUFFER_MAX);
-                exit(1);
-            }
-            c = getc(in);
-        }
-        if (is_delimiter(c)) {
-            buffer[i] = '\0';
-            ungetc(c, in);
-            return make_symbol(buffer);
-        }
-        else {
-            fprintf(stderr, "symbol not followed by delimiter. "
-                            "Found '%c'\n", c);
-            exit(1);
-        }
+    value = lower_ir(b, first_exp(tests), vars, is_tail);
+    if (is_tail) {
+        return NULL;
     }
-    else if (c == '"') { /* read a string */
-        i = 0;
-        while ((c = getc(in)) != '"') {
-            if (c == '\\') {
-                c = getc(in);
-                if (c == 'n') {
-                    c = '\n';
-                }
-            }
-            if (c == EOF) {
-                fprintf(stderr, "non-terminated string literal\n");
-                exit(1);
-            }
-            /* subtract 1 to save space for '\0' terminator */
-            if (i < BUFFER_MAX - 1) {
-                buffer[i++] = c;
-            }
-            else {
-                fprintf(stderr, 
-                        "string too long. Maximum length is %d\n",
-                        BUFFER_MAX);
-                exit(1);
-            }
+    emit_ir_jump(b, join);
+    add_ir_operand(phi, value);
+    b->block = join;
+    return phi;
+}
+
+ir_instr *lower_ir_lambda(ir_builder *b, object *exp, ir_variable *vars) {
+    object *info;
+    object *free;
+    object *captured;
+    ir_instr *instr;
+    ir_variable *var;
+    int i;
+    
+    info = lambda_info(exp);
+    captured = the_empty_list;
+    for (free = lambda_info_free(info); is_pair(free); free = cdr(free)) {
+        if (find_ir_variable(car(free), vars) != NULL) {
+            captured = cons(car(free), captured);
         }
-        buffer[i] = '\0';
-        return make_string(buffer);
-    }
-    else if (c == '(') { /* read the empty list or pair */
-        return read_pair(in);
     }
-    else if (c == '\'') { /* read quoted expression */
-        return cons(quote_symbol, cons(read(in), the_empty_list));
+    instr = emit_ir(b, IR_CLOSURE, 0);
+    instr->function = lower_ir_function(NULL, lambda_parameters(exp), info,
+                                        captured, vars,
+                                        b->function->env);
+    for (i = 0; is_pair(captured); captured = cdr(captured), i++) {
+        var = find_ir_variable(car(captured), vars);
+        add_ir_operand(instr, var->value);
     }
-    else if (c == EOF) {
-        return NULL;
+    return instr;
+}
+
+/* a lambda applied on the spot binds its frame in the current
+ * function, like eval does */
+ir_instr *lower_ir_direct_application(ir_builder *b, object *exp,
+                                      ir_variable *vars, char is_tail) {
+    object *lambda;
+    object *info;
+    object *exps;
+    ir_instr **values;
+    int count;
+    int i;
+    
+    lambda = operator(exp);
+    info = lambda_info(lambda);
+    count = 0;
+    for (exps = operands(exp); is_pair(exps); exps = cdr(exps)) {
+        count++;
     }
-    else {
-        fprintf(stderr, "bad input. Unexpected '%c'\n", c);
-        exit(1);
+    values = check_alloc(malloc((count + 1) * sizeof(ir_instr *)));
+    for (exps = operands(exp), i = 0; is_pair(exps); exps = cdr(exps)) {
+        values[i++] = lower_ir(b, car(exps), vars, 0);
     }
-    fprintf(stderr, "read illegal state\n");
-    exit(1);
+    vars = bind_ir_frame(b, lambda_parameters(lambda), info, values, vars);
+    free(values);
+    return lower_ir(b, lambda_info_body(info), vars, is_tail);
 }
 
-/*************************** EVALUATE ****************************/
-
-char is_self_evaluating(object *exp) {
-    return is_boolean(exp)   ||
-           is_fixnum(exp)    ||
-           is_character(exp) ||
-           is_string(exp);
+char is_ir_primitive_call(ir_builder *b, object *exp, ir_variable *vars) {
+    object *value;
+    
+    if (!is_symbol(operator(exp)) ||
+        find_ir_variable(operator(exp), vars) != NULL) {
+        return 0;
+    }
+    value = assumable_global_value(b->function, operator(exp));
+    return value != NULL && is_primitive_proc(value) &&
+           value->data.primitive_proc.fn != eval_proc &&
+           value->data.primitive_proc.fn != apply_proc;
+}
+
+ir_instr *lower_ir_application(ir_builder *b, object *exp,
+                               ir_variable *vars, char is_tail) {
+    object *exps;
+    object *value;
+    ir_instr *instr;
+    ir_instr *procedure;
+    int count;
+    int i;
+    
+    count = 0;
+    for (exps = operands(exp); is_pair(exps); exps = cdr(exps)) {
+        count++;
+    }
+    if (is_lambda(operator(exp)) &&
+        count == ir_parameter_count(lambda_parameters(operator(exp)))) {
+        return lower_ir_direct_application(b, exp, vars, is_tail);
+    }
+    if (is_ir_primitive_call(b, exp, vars)) {
+        value = assumable_global_value(b->function, operator(exp));
+        assume_global(b->function, operator(exp), value);
+        procedure = NULL;
+        instr = make_ir_instr(IR_PRIM, count);
+        instr->value = operator(exp);
+        instr->fn = value->data.primitive_proc.fn;
+        i = 0;
+    }
+    else {
+        procedure = lower_ir(b, operator(exp), vars, 0);
+        instr = make_ir_instr(is_tail ? IR_TAIL_CALL : IR_CALL, count + 1);
+        instr->operands[0] = procedure;
+        i = 1;
+    }
+    for (exps = operands(exp); is_pair(exps); exps = cdr(exps)) {
+        instr->operands[i++] = lower_ir(b, car(exps), vars, 0);
+    }
+    append_ir_instr(b->block, instr);
+    if (instr->opcode == IR_TAIL_CALL) {
+        b->block = NULL;
+        return NULL;
+    }
+    return ir_result(b, instr, is_tail);
 }
 
-char is_variable(object *expression) {
-    return is_symbol(expression);
+ir_instr *lower_ir(ir_builder *b, object *exp, ir_variable *vars,
+                   char is_tail) {
+    if (is_self_evaluating(exp) || is_the_empty_list(exp)) {
+        return ir_result(b, emit_ir_const(b, exp), is_tail);
+    }
+    else if (is_variable(exp)) {
+        return ir_result(b, lower_ir_variable(b, exp, vars), is_tail);
+    }
+    else if (is_quoted(exp)) {
+        return ir_result(b, emit_ir_const(b, text_of_quotation(exp)),
+                         is_tail);
+    }
+    else if (is_assignment(exp)) {
+        return ir_result(b,
+                         lower_ir_assignment(b, assignment_variable(exp),
+                                             assignment_value(exp), vars),
+                         is_tail);
+    }
+    else if (is_definition(exp)) {
+        return ir_result(b,
+                         lower_ir_assignment(b, definition_variable(exp),
+                                             definition_value(exp), vars),
+                         is_tail);
+    }
+    else if (is_if(exp)) {
+        return lower_ir_if(b, exp, vars, is_tail);
+    }
+    else if (is_lambda(exp)) {
+        return ir_result(b, lower_ir_lambda(b, exp, vars), is_tail);
+    }
+    else if (is_begin(exp)) {
+        return lower_ir_sequence(b, begin_actions(exp), vars, is_tail);
+    }
+    else if (is_cond(exp)) {
+        return lower_ir(b, cond_to_if(exp), vars, is_tail);
+    }
+    else if (is_let(exp)) {
+        return lower_ir(b, let_to_application(exp), vars, is_tail);
+    }
+    else if (is_lazy(exp)) {
+        return lower_ir(b, lazy_to_application(exp), vars, is_tail);
+    }
+    else if (is_record_definition(exp)) {
+        return lower_ir(b, record_definition_to_begin(exp), vars, is_tail);
+    }
+    else if (is_and(exp)) {
+        return lower_ir_and_or(b, and_tests(exp), vars, is_tail, 1);
+    }
+    else if (is_or(exp)) {
+        return lower_ir_and_or(b, or_tests(exp), vars, is_tail, 0);
+    }
+    else {
+        return lower_ir_application(b, exp, vars, is_tail);
+    }
 }
 
-char is_tagged_list(object *expression, object *tag) {
-    object *the_car;
-
-    if (is_pair(expression)) {
-        the_car = car(expression);
-        return is_symbol(the_car) && (the_car == tag);
+ir_function *lower_ir_function(object *name, object *parameters,
+                               object *info, object *captured,
+                               ir_variable *outer, object *env) {
+    ir_builder b;
+    ir_variable *vars;
+    ir_instr **values;
+    ir_instr *instr;
+    object *params;
+    int i;
+    
+    b.function = make_ir_function(name, parameters, env);
+    b.function->info = info;
+    b.function->captured = captured;
+    b.block = make_ir_block(b.function);
+    vars = NULL;
+    for (i = 0; is_pair(captured); captured = cdr(captured), i++) {
+        instr = emit_ir(&b, IR_FREE, 0);
+        instr->index = i;
+        instr->value = car(captured);
+        vars = bind_ir_variable(car(captured), instr,
+                                find_ir_variable(car(captured),
+                                                 outer)->is_cell,
+                                vars);
+    }
+    values = check_alloc(malloc((b.function->parameter_count + 1) *
+                                sizeof(ir_instr *)));
+    params = parameters;
+    for (i = 0; i <= b.function->parameter_count; i++) {
+        if (i == b.function->parameter_count && !b.function->has_rest) {
+            break;
+        }
+        values[i] = emit_ir(&b, IR_PARAM, 0);
+        values[i]->index = i;
+        values[i]->value = is_pair(params) ? car(params) : params;
+        if (is_pair(params)) {
+            params = cdr(params);
+        }
+    }
+    vars = bind_ir_frame(&b, parameters, info, values, vars);
+    free(values);
+    lower_ir(&b, lambda_info_body(info), vars, 1);
+    return b.function;
+}
+
+/* Optimization */
+
+#define IR_CAN_CSE  1 /* same operands give the same result */
+#define IR_CAN_DROP 2 /* no effect and cannot fail */
+#define IR_CAN_FOLD 4 /* computable from constant operands */
+
+#define IR_ANY_ARITY -1
+
+typedef struct ir_primitive {
+    object *(*fn)(object *arguments);
+    int flags;
+    int min_arity;
+    int max_arity;
+    char operand_type;      /* 'i' integers, 'c' characters, 'a' any */
+} ir_primitive;
+
+ir_primitive ir_primitives[] = {
+    {add_proc            , IR_CAN_CSE | IR_CAN_FOLD, 0, IR_ANY_ARITY, 'i'},
+    {sub_proc            , IR_CAN_CSE | IR_CAN_FOLD, 1, IR_ANY_ARITY, 'i'},
+    {mul_proc            , IR_CAN_CSE | IR_CAN_FOLD, 0, IR_ANY_ARITY, 'i'},
+    {quotient_proc       , IR_CAN_CSE | IR_CAN_FOLD, 2, 2, 'i'},
+    {remainder_proc      , IR_CAN_CSE | IR_CAN_FOLD, 2, 2, 'i'},
+    {is_number_equal_proc, IR_CAN_CSE | IR_CAN_FOLD, 1, IR_ANY_ARITY, 'i'},
+    {is_less_than_proc   , IR_CAN_CSE | IR_CAN_FOLD, 1, IR_ANY_ARITY, 'i'},
+    {is_greater_than_proc, IR_CAN_CSE | IR_CAN_FOLD, 1, IR_ANY_ARITY, 'i'},
+    {char_to_integer_proc, IR_CAN_CSE | IR_CAN_FOLD, 1, 1, 'c'},
+    {is_null_proc        , IR_CAN_CSE | IR_CAN_DROP | IR_CAN_FOLD, 1, 1, 'a'},
+    {is_boolean_proc     , IR_CAN_CSE | IR_CAN_DROP | IR_CAN_FOLD, 1, 1, 'a'},
+    {is_symbol_proc      , IR_CAN_CSE | IR_CAN_DROP | IR_CAN_FOLD, 1, 1, 'a'},
+    {is_integer_proc     , IR_CAN_CSE | IR_CAN_DROP | IR_CAN_FOLD, 1, 1, 'a'},
+    {is_fixnum_proc      , IR_CAN_CSE | IR_CAN_DROP | IR_CAN_FOLD, 1, 1, 'a'},
+    {is_char_proc        , IR_CAN_CSE | IR_CAN_DROP | IR_CAN_FOLD, 1, 1, 'a'},
+    {is_string_proc      , IR_CAN_CSE | IR_CAN_DROP | IR_CAN_FOLD, 1, 1, 'a'},
+    {is_pair_proc        , IR_CAN_CSE | IR_CAN_DROP | IR_CAN_FOLD, 1, 1, 'a'},
+    {is_procedure_proc   , IR_CAN_CSE | IR_CAN_DROP | IR_CAN_FOLD, 1, 1, 'a'},
+    {is_eof_object_proc  , IR_CAN_CSE | IR_CAN_DROP | IR_CAN_FOLD, 1, 1, 'a'},
+    {is_eq_proc          , IR_CAN_CSE | IR_CAN_DROP | IR_CAN_FOLD, 2, 2, 'a'},
+    {cons_proc           , IR_CAN_DROP, 2, 2, 'a'},
+    {list_proc           , IR_CAN_DROP, 0, IR_ANY_ARITY, 'a'},
+    {NULL}
+};
+
+/* the flags of a primitive operation that holds for its operand
+ * count, so it could not fail for want of arguments */
+int ir_primitive_flags(ir_instr *instr) {
+    ir_primitive *entry;
+    
+    for (entry = ir_primitives; entry->fn != NULL; entry++) {
+        if (entry->fn == instr->fn) {
+            if (instr->operand_count >= entry->min_arity &&
+                (entry->max_arity == IR_ANY_ARITY ||
+                 instr->operand_count <= entry->max_arity)) {
+                return entry->flags;
+            }
+            return 0;
+        }
     }
     return 0;
 }
 
-char is_quoted(object *expression) {
-    return is_tagged_list(expression, quote_symbol);
+/* constant operands that the primitive accepts */
+char are_ir_operands_foldable(ir_instr *instr) {
+    ir_primitive *entry;
+    object *value;
+    int i;
+    
+    entry = ir_primitives;
+    while (entry->fn != instr->fn) {
+        entry++;
+    }
+    for (i = 0; i < instr->operand_count; i++) {
+        if (instr->operands[i]->opcode != IR_CONST) {
+            return 0;
+        }
+        value = instr->operands[i]->value;
+        if ((entry->operand_type == 'i' && !is_fixnum(value)) ||
+            (entry->operand_type == 'c' && !is_character(value))) {
+            return 0;
+        }
+    }
+    if (instr->fn == quotient_proc || instr->fn == remainder_proc) {
+        return instr->operands[1]->value->data.fixnum.value != 0;
+    }
+    return 1;
 }
 
-object *text_of_quotation(object *exp) {
-    return cadr(exp);
+object *fold_ir_primitive(ir_instr *instr) {
+    object *arguments;
+    int i;
+    
+    arguments = the_empty_list;
+    for (i = instr->operand_count - 1; i >= 0; i--) {
+        arguments = cons(instr->operands[i]->value, arguments);
+    }
+    return instr->fn(arguments);
 }
 
-char is_assignment(object *exp) {
-    return is_tagged_list(exp, set_symbol);
+int ir_instr_count(ir_function *function) {
+    ir_block *block;
+    ir_instr *instr;
+    int count = 0;
+    
+    for (block = function->entry; block != NULL; block = block->next) {
+        for (instr = block->first; instr != NULL; instr = instr->next) {
+            count++;
+        }
+    }
+    return count;
 }
 
-object *assignment_variable(object *exp) {
-    return car(cdr(exp));
+void mark_ir_instrs(ir_function *function, char is_marked) {
+    ir_block *block;
+    ir_instr *instr;
+    
+    for (block = function->entry; block != NULL; block = block->next) {
+        for (instr = block->first; instr != NULL; instr = instr->next) {
+            instr->is_marked = is_marked;
+        }
+    }
 }
 
-object *assignment_value(object *exp) {
-    return car(cdr(cdr(exp)));
-}
+/* Inlining. Calls through a global name bound to a small procedure
+ * made at top level are replaced by its body, lowered afresh. Only
+ * the calls there before the pass are considered, and a procedure is
+ * never inlined into itself. */
 
-char is_definition(object *exp) {
-    return is_tagged_list(exp, define_symbol);
-}
+#define IR_INLINE_LIMIT 16
 
-object *definition_variable(object *exp) {
-    if (is_symbol(cadr(exp))) {
-        return cadr(exp);
+ir_function *ir_inline_candidate(ir_function *function, ir_instr *call) {
+    object *procedure;
+    ir_function *callee;
+    
+    if (call->operands[0]->opcode != IR_GLOBAL) {
+        return NULL;
     }
-    else {
-        return caadr(exp);
+    procedure = assumable_global_value(function,
+                                       call->operands[0]->value);
+    if (procedure == NULL || !is_compound_proc(procedure) ||
+        procedure->data.compound_proc.info == function->info ||
+        procedure->data.compound_proc.env != function->env ||
+        ir_parameter_count(lambda_info_parameters(procedure->data.compound_proc.info)) !=
+            call->operand_count - 1) {
+        return NULL;
     }
-}
-
-object *make_lambda(object *parameters, object *body);
-
-object *definition_value(object *exp) {
-    if (is_symbol(cadr(exp))) {
-        return caddr(exp);
+    callee = lower_ir_function(call->operands[0]->value,
+                               lambda_info_parameters(procedure->data.compound_proc.info),
+                               procedure->data.compound_proc.info,
+                               the_empty_list, NULL, function->env);
+    return (ir_instr_count(callee) <= IR_INLINE_LIMIT) ? callee : NULL;
+}
+
+void inline_ir_call(ir_function *function, ir_instr *call,
+                    ir_function *callee) {
+    ir_block *block;
+    ir_block *rest;
+    ir_block *callee_block;
+    ir_block *last;
+    ir_instr *instr;
+    ir_instr *next;
+    ir_instr *phi;
+    ir_instr *value;
+    int i;
+    
+    block = call->block;
+    for (instr = callee->entry->first; instr != NULL; instr = next) {
+        next = instr->next;
+        if (instr->opcode == IR_PARAM) {
+            replace_ir_uses(callee, instr,
+                            call->operands[instr->index + 1]);
+            remove_ir_instr(instr);
+        }
     }
-    else {
-        return make_lambda(cdadr(exp), cddr(exp));
+    assume_global(function, call->operands[0]->value,
+                  assumable_global_value(function,
+                                         call->operands[0]->value));
+    while (!is_the_empty_list(callee->assumed)) {
+        assume_global(function, caar(callee->assumed),
+                      cdar(callee->assumed));
+        callee->assumed = cdr(callee->assumed);
+    }
+    
+    /* after an ordinary call the callee's returns go on to the rest
+     * of the block, which starts with a phi for the result */
+    if (call->opcode == IR_CALL) {
+        rest = make_ir_block(function);
+        while (call->next != NULL) {
+            instr = call->next;
+            remove_ir_instr(instr);
+            append_ir_instr(rest, instr);
+        }
+        for (i = 0; i < ir_successor_count(rest); i++) {
+            replace_ir_pred(rest->last->targets[i], block, rest);
+        }
+        phi = make_ir_phi(rest);
+        replace_ir_uses(function, call, phi);
+        for (callee_block = callee->entry;
+             callee_block != NULL;
+             callee_block = callee_block->next) {
+            instr = callee_block->last;
+            if (instr->opcode == IR_RETURN) {
+                value = instr->operands[0];
+            }
+            else if (instr->opcode == IR_TAIL_CALL) {
+                instr->opcode = IR_CALL;
+                value = instr;
+                instr = make_ir_instr(IR_JUMP, 0);
+                append_ir_instr(callee_block, instr);
+            }
+            else {
+                continue;
+            }
+            instr->opcode = IR_JUMP;
+            instr->operand_count = 0;
+            instr->targets[0] = rest;
+            add_ir_edge(callee_block, rest);
+            add_ir_operand(phi, value);
+        }
+    }
+    remove_ir_instr(call);
+    instr = make_ir_instr(IR_JUMP, 0);
+    instr->targets[0] = callee->entry;
+    append_ir_instr(block, instr);
+    add_ir_edge(block, callee->entry);
+    
+    last = function->entry;
+    while (last->next != NULL) {
+        last = last->next;
     }
+    last->next = callee->entry;
 }
 
-object *make_if(object *predicate, object *consequent,
-                object *alternative) {
-    return cons(if_symbol,
-                cons(predicate,
-                     cons(consequent,
-                          cons(alternative, the_empty_list))));
+char inline_ir(ir_function *function) {
+    ir_block *block;
+    ir_instr *instr;
+    ir_function *callee;
+    char is_changed = 0;
+    
+    mark_ir_instrs(function, 0);
+    block = function->entry;
+    while (block != NULL) {
+        for (instr = block->first; instr != NULL; instr = instr->next) {
+            if (!instr->is_marked &&
+                (instr->opcode == IR_CALL ||
+                 instr->opcode == IR_TAIL_CALL)) {
+                instr->is_marked = 1;
+                callee = ir_inline_candidate(function, instr);
+                if (callee != NULL) {
+                    mark_ir_instrs(callee, 1);
+                    inline_ir_call(function, instr, callee);
+                    is_changed = 1;
+                    break;
+                }
+            }
+        }
+        /* the block changed, so it is looked at again */
+        if (instr == NULL) {
+            block = block->next;
+        }
+    }
+    return is_changed;
 }
 
-char is_if(object *expression) {
-    return is_tagged_list(expression, if_symbol);
-}
+/* Copy and constant propagation. Copies and phis of a single value
+ * are replaced by the value, primitive operations on constants are
+ * computed, branches on constants become jumps, jumps to a branch
+ * on a phi that is constant for them go straight on, blocks no longer
+ * reached are dropped and a block only reached from one jump is
+ * merged into the jumping block. */
 
-object *if_predicate(object *exp) {
-    return cadr(exp);
+char propagate_ir_instr(ir_function *function, ir_instr *instr) {
+    ir_instr *same;
+    ir_block *taken;
+    ir_block *untaken;
+    int i;
+    
+    switch (instr->opcode) {
+        case IR_COPY:
+            replace_ir_uses(function, instr, instr->operands[0]);
+            remove_ir_instr(instr);
+            return 1;
+        case IR_PHI:
+            same = NULL;
+            for (i = 0; i < instr->operand_count; i++) {
+                if (instr->operands[i] != instr &&
+                    instr->operands[i] != same) {
+                    if (same != NULL) {
+                        return 0;
+                    }
+                    same = instr->operands[i];
+                }
+            }
+            if (same == NULL) {
+                return 0;
+            }
+            replace_ir_uses(function, instr, same);
+            remove_ir_instr(instr);
+            return 1;
+        case IR_PRIM:
+            if ((ir_primitive_flags(instr) & IR_CAN_FOLD) &&
+                are_ir_operands_foldable(instr)) {
+                instr->value = fold_ir_primitive(instr);
+                instr->opcode = IR_CONST;
+                instr->operand_count = 0;
+                return 1;
+            }
+            return 0;
+        case IR_BRANCH:
+            if (instr->operands[0]->opcode != IR_CONST) {
+                return 0;
+            }
+            i = is_false(instr->operands[0]->value) ? 1 : 0;
+            taken = instr->targets[i];
+            untaken = instr->targets[1 - i];
+            remove_ir_edge(instr->block, untaken);
+            instr->opcode = IR_JUMP;
+            instr->operand_count = 0;
+            instr->targets[0] = taken;
+            instr->targets[1] = NULL;
+            return 1;
+        default:
+            return 0;
+    }
 }
 
-object *if_consequent(object *exp) {
-    return caddr(exp);
+void mark_reachable_ir_blocks(ir_block *block) {
+    int i;
+    
+    if (block->is_marked) {
+        return;
+    }
+    block->is_marked = 1;
+    for (i = 0; i < ir_successor_count(block); i++) {
+        mark_reachable_ir_blocks(block->last->targets[i]);
+    }
 }
 
-object *if_alternative(object *exp) {
-    if (is_the_empty_list(cdddr(exp))) {
-        return false;
+char remove_unreachable_ir_blocks(ir_function *function) {
+    ir_block *block;
+    ir_block *prev;
+    char is_changed = 0;
+    int i;
+    
+    for (block = function->entry; block != NULL; block = block->next) {
+        block->is_marked = 0;
     }
-    else {
-        return cadddr(exp);
+    mark_reachable_ir_blocks(function->entry);
+    prev = function->entry;
+    for (block = prev->next; block != NULL; block = prev->next) {
+        if (block->is_marked) {
+            prev = block;
+            continue;
+        }
+        for (i = 0; i < ir_successor_count(block); i++) {
+            remove_ir_edge(block, block->last->targets[i]);
+        }
+        prev->next = block->next;
+        is_changed = 1;
     }
+    return is_changed;
 }
 
-object *make_lambda(object *parameters, object *body) {
-    return cons(lambda_symbol, cons(parameters, body));
+int ir_use_count(ir_function *function, ir_instr *value) {
+    ir_block *block;
+    ir_instr *instr;
+    int count = 0;
+    int i;
+    
+    for (block = function->entry; block != NULL; block = block->next) {
+        for (instr = block->first; instr != NULL; instr = instr->next) {
+            for (i = 0; i < instr->operand_count; i++) {
+                if (instr->operands[i] == value) {
+                    count++;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+/* A block that only branches on a phi used nowhere else is skipped
+ * by the predecessors that give the phi a constant, when where they
+ * go has no phis. */
+char thread_ir_jumps(ir_function *function) {
+    ir_block *block;
+    ir_block *pred;
+    ir_block *target;
+    ir_instr *phi;
+    char is_changed = 0;
+    int i;
+    
+    for (block = function->entry; block != NULL; block = block->next) {
+        phi = block->first;
+        if (phi->opcode != IR_PHI || phi->next != block->last ||
+            block->last->opcode != IR_BRANCH ||
+            block->last->operands[0] != phi ||
+            ir_use_count(function, phi) != 1) {
+            continue;
+        }
+        for (i = 0; i < block->pred_count; i++) {
+            pred = block->preds[i];
+            if (phi->operands[i]->opcode != IR_CONST ||
+                pred->last->opcode != IR_JUMP) {
+                continue;
+            }
+            target = block->last->targets[
+                         is_false(phi->operands[i]->value) ? 1 : 0];
+            if (target->first->opcode != IR_PHI) {
+                remove_ir_edge(pred, block);
+                pred->last->targets[0] = target;
+                add_ir_edge(pred, target);
+                is_changed = 1;
+                i--;
+            }
+        }
+    }
+    return is_changed;
 }
 
-char is_lambda(object *exp) {
-    return is_tagged_list(exp, lambda_symbol);
+char merge_ir_blocks(ir_function *function) {
+    ir_block *block;
+    ir_block *target;
+    ir_block *prev;
+    ir_instr *instr;
+    char is_changed = 0;
+    int i;
+    
+    for (block = function->entry; block != NULL; block = block->next) {
+        while (block->last->opcode == IR_JUMP &&
+               (target = block->last->targets[0]) != block &&
+               target != function->entry &&
+               target->pred_count == 1) {
+            while (target->first != NULL &&
+                   target->first->opcode == IR_PHI) {
+                instr = target->first;
+                replace_ir_uses(function, instr, instr->operands[0]);
+                remove_ir_instr(instr);
+            }
+            remove_ir_instr(block->last);
+            while (target->first != NULL) {
+                instr = target->first;
+                remove_ir_instr(instr);
+                append_ir_instr(block, instr);
+            }
+            for (i = 0; i < ir_successor_count(block); i++) {
+                replace_ir_pred(block->last->targets[i], target, block);
+            }
+            prev = function->entry;
+            while (prev->next != target) {
+                prev = prev->next;
+            }
+            prev->next = target->next;
+            is_changed = 1;
+        }
+    }
+    return is_changed;
 }
 
-object *lambda_parameters(object *exp) {
-    return cadr(exp);
+char propagate_ir(ir_function *function) {
+    ir_block *block;
+    ir_instr *instr;
+    ir_instr *next;
+    char is_changed;
+    char was_changed = 0;
+    
+    do {
+        is_changed = 0;
+        for (block = function->entry; block != NULL; block = block->next) {
+            for (instr = block->first; instr != NULL; instr = next) {
+                next = instr->next;
+                is_changed |= propagate_ir_instr(function, instr);
+            }
+        }
+        is_changed |= thread_ir_jumps(function);
+        is_changed |= remove_unreachable_ir_blocks(function);
+        is_changed |= merge_ir_blocks(function);
+        was_changed |= is_changed;
+    } while (is_changed);
+    return was_changed;
 }
 
-object *lambda_body(object *exp) {
-    return cddr(exp);
-}
+/* Common subexpression elimination. An instruction that computes
+ * what one in a dominating block, or earlier in its own block,
+ * already computed is replaced by it. Dominators are found with the
+ * iterative algorithm of Cooper, Harvey and Kennedy. */
 
-object *make_begin(object *seq) {
-    return cons(begin_symbol, seq);
-}
+ir_block **ir_postorder;
+int ir_postorder_count;
 
-char is_begin(object *exp) {
-    return is_tagged_list(exp, begin_symbol);
+void number_ir_postorder(ir_block *block) {
+    int i;
+    
+    block->is_marked = 1;
+    for (i = ir_successor_count(block) - 1; i >= 0; i--) {
+        if (!block->last->targets[i]->is_marked) {
+            number_ir_postorder(block->last->targets[i]);
+        }
+    }
+    block->order = ir_postorder_count;
+    ir_postorder[ir_postorder_count++] = block;
 }
 
-object *begin_actions(object *exp) {
-    return cdr(exp);
+ir_block *intersect_ir_dominators(ir_block *block1, ir_block *block2) {
+    while (block1 != block2) {
+        while (block1->order < block2->order) {
+            block1 = block1->idom;
+        }
+        while (block2->order < block1->order) {
+            block2 = block2->idom;
+        }
+    }
+    return block1;
 }
 
-char is_last_exp(object *seq) {
-    return is_the_empty_list(cdr(seq));
+void find_ir_dominators(ir_function *function) {
+    ir_block *block;
+    ir_block *idom;
+    int count;
+    int i;
+    int j;
+    char is_changed;
+    
+    count = 0;
+    for (block = function->entry; block != NULL; block = block->next) {
+        block->is_marked = 0;
+        block->idom = NULL;
+        count++;
+    }
+    free(ir_postorder);
+    ir_postorder = check_alloc(malloc(count * sizeof(ir_block *)));
+    ir_postorder_count = 0;
+    number_ir_postorder(function->entry);
+    function->entry->idom = function->entry;
+    do {
+        is_changed = 0;
+        for (i = ir_postorder_count - 2; i >= 0; i--) {
+            block = ir_postorder[i];
+            idom = NULL;
+            for (j = 0; j < block->pred_count; j++) {
+                if (block->preds[j]->idom != NULL) {
+                    idom = (idom == NULL) ?
+                               block->preds[j] :
+                               intersect_ir_dominators(block->preds[j],
+                                                       idom);
+                }
+            }
+            if (block->idom != idom) {
+                block->idom = idom;
+                is_changed = 1;
+            }
+        }
+    } while (is_changed);
 }
 
-object *first_exp(object *seq) {
-    return car(seq);
+char are_ir_instrs_equal(ir_instr *instr1, ir_instr *instr2) {
+    int i;
+    
+    if (instr1->opcode != instr2->opcode) {
+        return 0;
+    }
+    switch (instr1->opcode) {
+        case IR_CONST:
+            return instr1->value == instr2->value ||
+                   (is_fixnum(instr1->value) && is_fixnum(instr2->value) &&
+                    instr1->value->data.fixnum.value ==
+                        instr2->value->data.fixnum.value) ||
+                   (is_character(instr1->value) &&
+                    is_character(instr2->value) &&
+                    instr1->value->data.character.value ==
+                        instr2->value->data.character.value);
+        case IR_FREE:
+            return instr1->index == instr2->index;
+        case IR_PRIM:
+            if (instr1->fn != instr2->fn ||
+                instr1->operand_count != instr2->operand_count) {
+                return 0;
+            }
+            for (i = 0; i < instr1->operand_count; i++) {
+                if (instr1->operands[i] != instr2->operands[i]) {
+                    return 0;
+                }
+            }
+            return 1;
+        default:
+            return 0;
+    }
 }
 
-object *rest_exps(object *seq) {
-    return cdr(seq);
+char can_cse_ir_instr(ir_instr *instr) {
+    return instr->opcode == IR_CONST || instr->opcode == IR_FREE ||
+           (instr->opcode == IR_PRIM &&
+            (ir_primitive_flags(instr) & IR_CAN_CSE));
 }
 
-char is_cond(object *exp) {
-    return is_tagged_list(exp, cond_symbol);
+ir_instr *find_ir_equal(ir_instr *instr) {
+    ir_block *block;
+    ir_instr *other;
+    
+    for (other = instr->prev; other != NULL; other = other->prev) {
+        if (are_ir_instrs_equal(instr, other)) {
+            return other;
+        }
+    }
+    block = instr->block;
+    while (block->idom != block) {
+        block = block->idom;
+        for (other = block->first; other != NULL; other = other->next) {
+            if (are_ir_instrs_equal(instr, other)) {
+                return other;
+            }
+        }
+    }
+    return NULL;
 }
 
-object *cond_clauses(object *exp) {
-    return cdr(exp);
+char cse_ir(ir_function *function) {
+    ir_instr *instr;
+    ir_instr *next;
+    ir_instr *same;
+    char is_changed = 0;
+    int i;
+    
+    find_ir_dominators(function);
+    for (i = ir_postorder_count - 1; i >= 0; i--) {
+        for (instr = ir_postorder[i]->first; instr != NULL; instr = next) {
+            next = instr->next;
+            if (can_cse_ir_instr(instr) &&
+                (same = find_ir_equal(instr)) != NULL) {
+                replace_ir_uses(function, instr, same);
+                remove_ir_instr(instr);
+                is_changed = 1;
+            }
+        }
+    }
+    return is_changed;
+}
+
+/* Dead code elimination. Instructions with no effect whose values
+ * nothing live uses are removed. */
+
+char can_drop_ir_instr(ir_instr *instr) {
+    switch (instr->opcode) {
+        case IR_CONST:
+        case IR_FREE:
+        case IR_GLOBAL:
+        case IR_COPY:
+        case IR_PHI:
+        case IR_CLOSURE:
+            return 1;
+        case IR_PRIM:
+            return (ir_primitive_flags(instr) & IR_CAN_DROP) != 0;
+        default:
+            return 0;
+    }
 }
 
-object *cond_predicate(object *clause) {
-    return car(clause);
+void mark_live_ir_instr(ir_instr *instr) {
+    int i;
+    
+    if (instr->is_marked) {
+        return;
+    }
+    instr->is_marked = 1;
+    for (i = 0; i < instr->operand_count; i++) {
+        mark_live_ir_instr(instr->operands[i]);
+    }
 }
 
-object *cond_actions(object *clause) {
-    return cdr(clause);
+char dce_ir(ir_function *function) {
+    ir_block *block;
+    ir_instr *instr;
+    ir_instr *next;
+    char is_changed = 0;
+    
+    mark_ir_instrs(function, 0);
+    for (block = function->entry; block != NULL; block = block->next) {
+        for (instr = block->first; instr != NULL; instr = instr->next) {
+            if (!can_drop_ir_instr(instr)) {
+                mark_live_ir_instr(instr);
+            }
+        }
+    }
+    for (block = function->entry; block != NULL; block = block->next) {
+        for (instr = block->first; instr != NULL; instr = next) {
+            next = instr->next;
+            if (!instr->is_marked) {
+                remove_ir_instr(instr);
+                is_changed = 1;
+            }
+        }
+    }
+    return is_changed;
 }
 
-char is_cond_else_clause(object *clause) {
-    return cond_predicate(clause) == else_symbol;
-}
+/* Printing */
 
-object *sequence_to_exp(object *seq) {
-    if (is_the_empty_list(seq)) {
-        return seq;
-    }
-    else if (is_last_exp(seq)) {
-        return first_exp(seq);
-    }
-    else {
-        return make_begin(seq);
+void number_ir(ir_function *function) {
+    ir_block *block;
+    ir_instr *instr;
+    int values = 0;
+    int blocks = 0;
+    
+    for (block = function->entry; block != NULL; block = block->next) {
+        block->number = blocks++;
+        for (instr = block->first; instr != NULL; instr = instr->next) {
+            instr->number = has_ir_value(instr) ? values++ : -1;
+        }
     }
 }
 
-object *expand_clauses(object *clauses) {
-    object *first;
-    object *rest;
+void write_ir_function(FILE *out, ir_function *function) {
+    ir_block *block;
+    ir_instr *instr;
+    object *assumed;
+    int i;
     
-    if (is_the_empty_list(clauses)) {
-        return false;
+    number_ir(function);
+    fprintf(out, "function %d", function->id);
+    if (function->name != NULL) {
+        fprintf(out, " %s", function->name->data.symbol.value);
     }
-    else {
-        first = car(clauses);
-        rest  = cdr(clauses);
-        if (is_cond_else_clause(first)) {
-            if (is_the_empty_list(rest)) {
-                return sequence_to_exp(cond_actions(first));
+    fprintf(out, " ");
+    write(out, function->parameters);
+    fprintf(out, "\n");
+    if (!is_the_empty_list(function->assumed)) {
+        fprintf(out, "  assumes");
+        for (assumed = function->assumed;
+             !is_the_empty_list(assumed);
+             assumed = cdr(assumed)) {
+            fprintf(out, " %s", caar(assumed)->data.symbol.value);
+        }
+        fprintf(out, "\n");
+    }
+    for (block = function->entry; block != NULL; block = block->next) {
+        fprintf(out, "  b%d:\n", block->number);
+        for (instr = block->first; instr != NULL; instr = instr->next) {
+            fprintf(out, "    ");
+            if (instr->number >= 0) {
+                fprintf(out, "v%d = ", instr->number);
             }
-            else {
-                fprintf(stderr, "else clause isn't last cond->if");
-                exit(1);
+            fprintf(out, "%s", ir_opcode_names[instr->opcode]);
+            if (instr->opcode == IR_CONST && instr->value == unassigned) {
+                fprintf(out, " #<unassigned>");
+            }
+            else if (instr->opcode == IR_CONST) {
+                fprintf(out, " ");
+                write(out, instr->value);
+            }
+            else if (instr->opcode == IR_CLOSURE) {
+                fprintf(out, " %d", instr->function->id);
+            }
+            else if (instr->value != NULL) {
+                fprintf(out, " %s", instr->value->data.symbol.value);
+            }
+            for (i = 0; i < instr->operand_count; i++) {
+                if (instr->opcode == IR_PHI) {
+                    fprintf(out, " b%d:", block->preds[i]->number);
+                }
+                else {
+                    fprintf(out, " ");
+                }
+                fprintf(out, "v%d", instr->operands[i]->number);
             }
+            for (i = 0; i < 2 && instr->targets[i] != NULL; i++) {
+                fprintf(out, " b%d", instr->targets[i]->number);
+            }
+            fprintf(out, "\n");
         }
-        else {
-            return make_if(cond_predicate(first),
-                           sequence_to_exp(cond_actions(first)),
-                           expand_clauses(rest));
+    }
+}
+
+/* runs pass on the function and the functions of its closures,
+ * telling whether it changed any */
+char for_each_ir_function(ir_function *function,
+                          char (*pass)(ir_function *function)) {
+    ir_block *block;
+    ir_instr *instr;
+    char is_changed;
+    
+    is_changed = pass(function);
+    for (block = function->entry; block != NULL; block = block->next) {
+        for (instr = block->first; instr != NULL; instr = instr->next) {
+            if (instr->opcode == IR_CLOSURE) {
+                is_changed |= for_each_ir_function(instr->function, pass);
+            }
         }
     }
+    return is_changed;
+}
+
+int ir_function_count;
+
+char number_ir_function(ir_function *function) {
+    function->id = ir_function_count++;
+    return 0;
+}
+
+char write_ir_to_stderr(ir_function *function) {
+    write_ir_function(stderr, function);
+    return 0;
+}
+
+/* The passes threaded compilation runs, in order. They run on the
+ * function alone, as each closure in it is compiled on its own when
+ * first called. */
+typedef struct ir_pass {
+    char *name;
+    char (*run)(ir_function *function);
+} ir_pass;
+
+ir_pass ir_passes[] = {
+    {"inlining"   , inline_ir},
+    {"propagation", propagate_ir},
+    {"cse"        , cse_ir},
+    {"dce"        , dce_ir},
+    {NULL         , NULL}
+};
+
+void dump_ir_pass(ir_function *function, char *pass_name,
+                  char (*pass)(ir_function *function)) {
+    if (pass != NULL && !pass(function)) {
+        fprintf(stderr, "; %s: %s changed nothing\n",
+                function->name->data.symbol.value, pass_name);
+        return;
+    }
+    fprintf(stderr, "; %s after %s\n",
+            function->name->data.symbol.value, pass_name);
+    ir_function_count = 0;
+    for_each_ir_function(function, number_ir_function);
+    for_each_ir_function(function, write_ir_to_stderr);
+}
+
+void dump_procedure_ir(object *exp, object *name, object *env) {
+    ir_function *function;
+    ir_pass *pass;
+    
+    function = lower_ir_function(name, lambda_parameters(exp),
+                                 lambda_info(exp), the_empty_list, NULL,
+                                 env);
+    dump_ir_pass(function, "lowering", NULL);
+    for (pass = ir_passes; pass->name != NULL; pass++) {
+        dump_ir_pass(function, pass->name, pass->run);
+    }
 }
 
-object *cond_to_if(object *exp) {
-    return expand_clauses(cond_clauses(exp));
+/* With --threaded, compound procedures run from threaded code instead
+ * of having their bodies walked. The first call of a procedure lowers
+ * its lambda, optimizes it and translates the function into an array
+ * of words: for each operation the address of the code handling it,
+ * then its operands. Each handler ends by jumping straight to the
+ * next one, so each has its own indirect branch to predict. Without
+ * labels as values, as with -ansi, the words hold opcodes and a
+ * switch dispatches them.
+ *
+ * Every value of the function has a register in a window of a stack
+ * of registers, the arguments first where the caller left them. Phis
+ * become moves on the edges into their block. Calls to compiled
+ * procedures from compiled code take no argument list and tail calls
+ * between them reuse the window. Other tail calls are handed back to
+ * eval, so they stay proper.
+ *
+ * The code is only used for closures of the outermost environment it
+ * was made for and capturing the same names, and is made again when
+ * a binding it assumed changes. */
+
+#if defined(__GNUC__) && !defined(__STRICT_ANSI__)
+#define USE_COMPUTED_GOTO
+#endif
+
+char use_threaded_code = 0;
+
+typedef enum {
+    OP_CONST, OP_MOVE, OP_FREE, OP_GLOBAL, OP_SET_GLOBAL,
+    OP_CELL, OP_CELL_REF, OP_CELL_SET, OP_CLOSURE,
+    OP_ADD, OP_SUB, OP_NUMBER_EQUAL, OP_LESS_THAN, OP_GREATER_THAN,
+    OP_CAR, OP_CDR, OP_CONS, OP_IS_NULL, OP_IS_PAIR,
+    OP_PRIM, OP_CALL, OP_TAIL_CALL, OP_RETURN, OP_JUMP, OP_BRANCH
+} threaded_opcode;
+
+typedef union code_word {
+    void *handler;
+    long operand;           /* opcode, register or count */
+    object *value;
+    object *(*fn)(object *arguments);
+    union code_word *target;
+} code_word;
+
+typedef struct threaded_code {
+    code_word *words;
+    int parameter_count;
+    int register_count;
+    object *env;            /* the outermost environment */
+    object *captured;       /* names in the closure's frame */
+    long version;           /* assumption_version when made */
+} threaded_code;
+
+/* the primitive operations with a handler of their own */
+typedef struct threaded_primitive {
+    object *(*fn)(object *arguments);
+    int arity;
+    threaded_opcode opcode;
+} threaded_primitive;
+
+threaded_primitive threaded_primitives[] = {
+    {add_proc            , 2, OP_ADD},
+    {sub_proc            , 2, OP_SUB},
+    {is_number_equal_proc, 2, OP_NUMBER_EQUAL},
+    {is_less_than_proc   , 2, OP_LESS_THAN},
+    {is_greater_than_proc, 2, OP_GREATER_THAN},
+    {car_proc            , 1, OP_CAR},
+    {cdr_proc            , 1, OP_CDR},
+    {cons_proc           , 2, OP_CONS},
+    {is_null_proc        , 1, OP_IS_NULL},
+    {is_pair_proc        , 1, OP_IS_PAIR},
+    {NULL}
+};
+
+#define REGISTER_STACK_SIZE (1 << 20)
+
+object **register_top;
+object **register_limit;
+void **threaded_handlers;
+
+object *make_code(threaded_code *code) {
+    object *obj;
+    
+    obj = alloc_object();
+    obj->type = CODE;
+    obj->data.code.code = code;
+    return obj;
 }
 
-object *make_application(object *operator, object *operands) {
-    return cons(operator, operands);
+void check_registers(object **top) {
+    if (top > register_limit) {
+        fprintf(stderr_stream, "register stack overflow\n");
+        end_with_error();
+    }
 }
 
-char is_application(object *exp) {
-    return is_pair(exp);
+/* Translation */
+
+code_word *code_words = NULL;
+int code_length;
+int code_capacity = 0;
+
+typedef struct code_fixup {
+    int position;
+    ir_block *block;        /* the target, or NULL to use offset */
+    int offset;
+} code_fixup;
+
+code_fixup *code_fixups = NULL;
+int fixup_count;
+int fixup_capacity = 0;
+
+void *grow_code_array(void *array, int *capacity, size_t size) {
+    *capacity = (*capacity == 0) ? 256 : *capacity * 2;
+    return check_alloc(realloc(array, *capacity * size));
 }
 
-object *operator(object *exp) {
-    return car(exp);
+code_word *emit_code_word(void) {
+    if (code_length == code_capacity) {
+        code_words = grow_code_array(code_words, &code_capacity,
+                                     sizeof(code_word));
+    }
+    return &code_words[code_length++];
 }
 
-object *operands(object *exp) {
-    return cdr(exp);
+void emit_code_op(threaded_opcode opcode) {
+#ifdef USE_COMPUTED_GOTO
+    emit_code_word()->handler = threaded_handlers[opcode];
+#else
+    emit_code_word()->operand = opcode;
+#endif
 }
 
-char is_no_operands(object *ops) {
-    return is_the_empty_list(ops);
+void emit_code_operand(long operand) {
+    emit_code_word()->operand = operand;
 }
 
-object *first_operand(object *ops) {
-    return car(ops);
+void emit_code_value(object *value) {
+    emit_code_word()->value = value;
 }
 
-object *rest_operands(object *ops) {
-    return cdr(ops);
+void emit_code_register(ir_instr *instr) {
+    emit_code_operand(instr->number);
 }
 
-char is_let(object *exp) {
-    return is_tagged_list(exp, let_symbol);
+void add_code_fixup(int position, ir_block *block, int offset) {
+    if (fixup_count == fixup_capacity) {
+        code_fixups = grow_code_array(code_fixups, &fixup_capacity,
+                                      sizeof(code_fixup));
+    }
+    code_fixups[fixup_count].position = position;
+    code_fixups[fixup_count].block = block;
+    code_fixups[fixup_count].offset = offset;
+    fixup_count++;
 }
 
-object *let_bindings(object *exp) {
-    return cadr(exp);
+void emit_code_target(ir_block *block) {
+    add_code_fixup(code_length, block, 0);
+    emit_code_operand(0);
 }
 
-object *let_body(object *exp) {
-    return cddr(exp);
+/* the arguments of a call or primitive, after their count */
+void emit_code_operands(ir_instr *instr, int first) {
+    int i;
+    
+    emit_code_operand(instr->operand_count - first);
+    for (i = first; i < instr->operand_count; i++) {
+        emit_code_register(instr->operands[i]);
+    }
 }
 
-object *binding_parameter(object *binding) {
-    return car(binding);
+/* the parameters take the first registers, so arguments need no
+ * moving */
+int number_ir_registers(ir_function *function) {
+    ir_block *block;
+    ir_instr *instr;
+    int count;
+    
+    count = function->parameter_count;
+    for (block = function->entry; block != NULL; block = block->next) {
+        for (instr = block->first; instr != NULL; instr = instr->next) {
+            if (instr->opcode == IR_PARAM) {
+                instr->number = instr->index;
+            }
+            else if (has_ir_value(instr)) {
+                instr->number = count++;
+            }
+        }
+    }
+    return count;
 }
 
-object *binding_argument(object *binding) {
-    return cadr(binding);
+void translate_ir_prim(ir_instr *instr) {
+    threaded_primitive *entry;
+    
+    for (entry = threaded_primitives; entry->fn != NULL; entry++) {
+        if (entry->fn == instr->fn &&
+            entry->arity == instr->operand_count) {
+            emit_code_op(entry->opcode);
+            emit_code_register(instr);
+            emit_code_register(instr->operands[0]);
+            if (entry->arity == 2) {
+                emit_code_register(instr->operands[1]);
+            }
+            return;
+        }
+    }
+    emit_code_op(OP_PRIM);
+    emit_code_register(instr);
+    emit_code_word()->fn = instr->fn;
+    emit_code_operands(instr, 0);
+}
+
+void translate_ir_instr(ir_instr *instr) {
+    switch (instr->opcode) {
+        case IR_FREE:
+            emit_code_op(OP_FREE);
+            emit_code_register(instr);
+            emit_code_operand(instr->index);
+            break;
+        case IR_CONST:
+            emit_code_op(OP_CONST);
+            emit_code_register(instr);
+            emit_code_value(instr->value);
+            break;
+        case IR_GLOBAL:
+            emit_code_op(OP_GLOBAL);
+            emit_code_register(instr);
+            emit_code_value(instr->value);
+            emit_code_value(NULL); /* the binding, once found */
+            break;
+        case IR_SET_GLOBAL:
+            emit_code_op(OP_SET_GLOBAL);
+            emit_code_register(instr->operands[0]);
+            emit_code_value(instr->value);
+            emit_code_value(NULL);
+            break;
+        case IR_COPY:
+            emit_code_op(OP_MOVE);
+            emit_code_register(instr);
+            emit_code_register(instr->operands[0]);
+            break;
+        case IR_PRIM:
+            translate_ir_prim(instr);
+            break;
+        case IR_CALL:
+            emit_code_op(OP_CALL);
+            emit_code_register(instr);
+            emit_code_register(instr->operands[0]);
+            emit_code_operands(instr, 1);
+            break;
+        case IR_CLOSURE:
+            emit_code_op(OP_CLOSURE);
+            emit_code_register(instr);
+            emit_code_value(instr->function->info);
+            emit_code_value(instr->function->captured);
+            emit_code_operands(instr, 0);
+            break;
+        case IR_CELL:
+            emit_code_op(OP_CELL);
+            emit_code_register(instr);
+            emit_code_register(instr->operands[0]);
+            break;
+        case IR_CELL_REF:
+            emit_code_op(OP_CELL_REF);
+            emit_code_register(instr);
+            emit_code_register(instr->operands[0]);
+            emit_code_value(instr->value);
+            break;
+        case IR_CELL_SET:
+            emit_code_op(OP_CELL_SET);
+            emit_code_register(instr->operands[0]);
+            emit_code_register(instr->operands[1]);
+            break;
+        case IR_RETURN:
+            emit_code_op(OP_RETURN);
+            emit_code_register(instr->operands[0]);
+            break;
+        case IR_TAIL_CALL:
+            emit_code_op(OP_TAIL_CALL);
+            emit_code_register(instr->operands[0]);
+            emit_code_operands(instr, 1);
+            break;
+        default: /* parameters are in place, phis are set by edges */
+            break;
+    }
 }
 
-object *bindings_parameters(object *bindings) {
-    return is_the_empty_list(bindings) ?
-               the_empty_list :
-               cons(binding_parameter(car(bindings)),
-                    bindings_parameters(cdr(bindings)));
+/* The moves into the phis of to for the edge from from. Moves in
+ * order are enough as the graph has no loops, so no phi is an
+ * operand of another phi of the same block. */
+void translate_ir_edge(ir_block *from, ir_block *to) {
+    ir_instr *phi;
+    int index;
+    
+    index = 0;
+    while (to->preds[index] != from) {
+        index++;
+    }
+    for (phi = to->first; phi->opcode == IR_PHI; phi = phi->next) {
+        if (phi->number != phi->operands[index]->number) {
+            emit_code_op(OP_MOVE);
+            emit_code_register(phi);
+            emit_code_register(phi->operands[index]);
+        }
+    }
 }
 
-object *bindings_arguments(object *bindings) {
-    return is_the_empty_list(bindings) ?
-               the_empty_list :
-               cons(binding_argument(car(bindings)),
-                    bindings_arguments(cdr(bindings)));
+void translate_ir_jump(ir_block *from, ir_block *to) {
+    translate_ir_edge(from, to);
+    if (to != from->next) {
+        emit_code_op(OP_JUMP);
+        emit_code_target(to);
+    }
 }
 
-object *let_parameters(object *exp) {
-    return bindings_parameters(let_bindings(exp));
+char has_ir_phis(ir_block *block) {
+    return block->first->opcode == IR_PHI;
 }
 
-object *let_arguments(object *exp) {
-    return bindings_arguments(let_bindings(exp));
+/* a branch to blocks with phis goes through a stub for each edge */
+void translate_ir_branch(ir_block *block, ir_instr *branch) {
+    int position;
+    
+    emit_code_op(OP_BRANCH);
+    emit_code_register(branch->operands[0]);
+    if (!has_ir_phis(branch->targets[0]) &&
+        !has_ir_phis(branch->targets[1])) {
+        emit_code_target(branch->targets[0]);
+        emit_code_target(branch->targets[1]);
+        return;
+    }
+    position = code_length;
+    emit_code_operand(0);
+    emit_code_operand(0);
+    add_code_fixup(position, NULL, code_length);
+    translate_ir_edge(block, branch->targets[0]);
+    emit_code_op(OP_JUMP);
+    emit_code_target(branch->targets[0]);
+    add_code_fixup(position + 1, NULL, code_length);
+    translate_ir_jump(block, branch->targets[1]);
+}
+
+threaded_code *translate_ir_function(ir_function *function) {
+    threaded_code *code;
+    ir_block *block;
+    ir_instr *instr;
+    int i;
+    
+    code = check_alloc(malloc(sizeof(threaded_code)));
+    code->parameter_count = function->parameter_count;
+    code->register_count = number_ir_registers(function);
+    code->env = function->env;
+    code->captured = function->captured;
+    code->version = assumption_version;
+    code_length = 0;
+    fixup_count = 0;
+    for (block = function->entry; block != NULL; block = block->next) {
+        block->offset = code_length;
+        for (instr = block->first; instr != NULL; instr = instr->next) {
+            if (instr->opcode == IR_JUMP) {
+                translate_ir_jump(block, instr->targets[0]);
+            }
+            else if (instr->opcode == IR_BRANCH) {
+                translate_ir_branch(block, instr);
+            }
+            else {
+                translate_ir_instr(instr);
+            }
+        }
+    }
+    code->words = check_alloc(malloc(code_length * sizeof(code_word)));
+    memcpy(code->words, code_words, code_length * sizeof(code_word));
+    for (i = 0; i < fixup_count; i++) {
+        code->words[code_fixups[i].position].target =
+            code->words + ((code_fixups[i].block == NULL) ?
+                               code_fixups[i].offset :
+                               code_fixups[i].block->offset);
+    }
+    return code;
 }
 
-object *let_to_application(object *exp) {
-    return make_application(
-               make_lambda(let_parameters(exp),
-                           let_body(exp)),
-               let_arguments(exp));
+/* Lowers a procedure as its closure sees it: the names in its frame
+ * are what it captured, boxed ones being cells. */
+threaded_code *compile_procedure(object *procedure, object *outermost) {
+    ir_function *function;
+    ir_pass *pass;
+    ir_variable *outer;
+    object *env;
+    object *captured;
+    object *vars;
+    object *vals;
+    object *assumed;
+    
+    env = procedure->data.compound_proc.env;
+    captured = the_empty_list;
+    outer = NULL;
+    if (env != outermost) {
+        captured = frame_variables(first_frame(env));
+        for (vars = captured, vals = frame_values(first_frame(env));
+             !is_the_empty_list(vars);
+             vars = cdr(vars), vals = cdr(vals)) {
+            outer = bind_ir_variable(car(vars), NULL, is_box(car(vals)),
+                                     outer);
+        }
+    }
+    function = lower_ir_function(NULL,
+                                 lambda_info_parameters(procedure->data.compound_proc.info),
+                                 procedure->data.compound_proc.info,
+                                 captured, outer, outermost);
+    if (function->has_rest) {
+        return NULL;
+    }
+    for (pass = ir_passes; pass->name != NULL; pass++) {
+        pass->run(function);
+    }
+    for (assumed = function->assumed;
+         !is_the_empty_list(assumed);
+         assumed = cdr(assumed)) {
+        caar(assumed)->data.symbol.is_assumed = 1;
+    }
+    return translate_ir_function(function);
 }
 
-char is_and(object *exp) {
-    return is_tagged_list(exp, and_symbol);
+char is_same_capture(threaded_code *code, object *env) {
+    object *vars;
+    object *captured;
+    
+    if (env == code->env) {
+        return is_the_empty_list(code->captured);
+    }
+    vars = frame_variables(first_frame(env));
+    captured = code->captured;
+    while (is_pair(vars) && is_pair(captured) &&
+           car(vars) == car(captured)) {
+        vars = cdr(vars);
+        captured = cdr(captured);
+    }
+    return is_the_empty_list(vars) && is_the_empty_list(captured);
 }
 
-object *and_tests(object *exp) {
-    return cdr(exp);
+/* the code to run the procedure with, or NULL to walk its body */
+threaded_code *procedure_code(object *procedure) {
+    object *info;
+    object *env;
+    object *outermost;
+    object *slot;
+    threaded_code *code;
+    
+    info = procedure->data.compound_proc.info;
+    env = procedure->data.compound_proc.env;
+    outermost = is_the_empty_list(enclosing_environment(env)) ?
+                    env : enclosing_environment(env);
+    slot = lambda_info_code(info);
+    if (slot != false) {
+        code = slot->data.code.code;
+        if (code == NULL || code->env != outermost ||
+            !is_same_capture(code, env)) {
+            return NULL;
+        }
+        if (code->version == assumption_version) {
+            return code;
+        }
+    }
+    code = compile_procedure(procedure, outermost);
+    set_lambda_info_code(info, make_code(code));
+    return code;
 }
 
-char is_or(object *exp) {
-    return is_tagged_list(exp, or_symbol);
+/* Running */
+
+object *apply_procedure(object *procedure, object *arguments);
+
+object *call_primitive_from_code(object *(*fn)(object *arguments),
+                                 object **regs, code_word *operands) {
+    object *arguments;
+    object *result;
+    region_mark mark;
+    int i;
+    
+    mark = current_region_mark();
+    arguments = the_empty_list;
+    for (i = operands[0].operand; i > 0; i--) {
+        arguments = (fn == list_proc) ?
+                        cons(regs[operands[i].operand], arguments) :
+                        region_cons(regs[operands[i].operand], arguments);
+    }
+    result = fn(arguments);
+    release_region(mark);
+    return result;
 }
 
-object *or_tests(object *exp) {
-    return cdr(exp);
+object *list_of_registers(object **regs, code_word *operands) {
+    object *arguments;
+    int i;
+    
+    arguments = the_empty_list;
+    for (i = operands[0].operand; i > 0; i--) {
+        arguments = cons(regs[operands[i].operand], arguments);
+    }
+    return arguments;
 }
 
-object *apply_operator(object *arguments) {
-    return car(arguments);
+char is_special_primitive(object *procedure) {
+    return procedure->data.primitive_proc.fn == eval_proc ||
+           procedure->data.primitive_proc.fn == apply_proc;
 }
 
-object *prepare_apply_operands(object *arguments) {
-    if (is_the_empty_list(cdr(arguments))) {
-        return car(arguments);
+object *global_binding(code_word *words, object *env) {
+    if (words[1].value == NULL) {
+        words[1].value = find_binding(words[0].value, env,
+                                      the_empty_environment);
+        if (words[1].value == NULL) {
+            fprintf(stderr_stream, "unbound variable, %s\n",
+                    words[0].value->data.symbol.value);
+            end_with_error();
+        }
     }
-    else {
-        return cons(car(arguments),
-                    prepare_apply_operands(cdr(arguments)));
+    return words[1].value;
+}
+
+#ifdef USE_COMPUTED_GOTO
+#define HANDLER(opcode) opcode##_HANDLER
+#define NEXT() goto *(ip++)->handler
+#else
+#define HANDLER(opcode) case opcode
+#define NEXT() goto dispatch
+#endif
+
+#define REG(i) regs[ip[i].operand]
+
+/* Runs code with its arguments in the first registers at regs.
+ * Returns the result, or NULL with a tail call for the caller to
+ * make. Called with no code it hands out its handlers. */
+object *run_code(threaded_code *code, object *procedure, object **regs,
+                 int argc, object **tail_procedure,
+                 object **tail_arguments) {
+#ifdef USE_COMPUTED_GOTO
+    static void *handlers[] = {
+        &&OP_CONST_HANDLER, &&OP_MOVE_HANDLER, &&OP_FREE_HANDLER,
+        &&OP_GLOBAL_HANDLER, &&OP_SET_GLOBAL_HANDLER,
+        &&OP_CELL_HANDLER, &&OP_CELL_REF_HANDLER, &&OP_CELL_SET_HANDLER,
+        &&OP_CLOSURE_HANDLER,
+        &&OP_ADD_HANDLER, &&OP_SUB_HANDLER, &&OP_NUMBER_EQUAL_HANDLER,
+        &&OP_LESS_THAN_HANDLER, &&OP_GREATER_THAN_HANDLER,
+        &&OP_CAR_HANDLER, &&OP_CDR_HANDLER, &&OP_CONS_HANDLER,
+        &&OP_IS_NULL_HANDLER, &&OP_IS_PAIR_HANDLER,
+        &&OP_PRIM_HANDLER, &&OP_CALL_HANDLER, &&OP_TAIL_CALL_HANDLER,
+        &&OP_RETURN_HANDLER, &&OP_JUMP_HANDLER, &&OP_BRANCH_HANDLER
+    };
+#endif
+    code_word *ip;
+    object *value;
+    object *callee;
+    object *arguments;
+    threaded_code *callee_code;
+    int count;
+    int i;
+    
+#ifdef USE_COMPUTED_GOTO
+    if (code == NULL) {
+        threaded_handlers = handlers;
+        return NULL;
+    }
+#endif
+
+enter:
+    if (argc != code->parameter_count) {
+        fprintf(stderr_stream, "wrong number of arguments\n");
+        end_with_error();
+    }
+    register_top = regs + code->register_count;
+    check_registers(register_top);
+    ip = code->words;
+    NEXT();
+
+#ifndef USE_COMPUTED_GOTO
+dispatch:
+    switch ((ip++)->operand) {
+#endif
+    HANDLER(OP_CONST):
+        REG(0) = ip[1].value;
+        ip += 2;
+        NEXT();
+    HANDLER(OP_MOVE):
+        REG(0) = REG(1);
+        ip += 2;
+        NEXT();
+    HANDLER(OP_FREE):
+        value = frame_values(first_frame(procedure->data.compound_proc.env));
+        for (i = ip[1].operand; i > 0; i--) {
+            value = cdr(value);
+        }
+        REG(0) = car(value);
+        ip += 2;
+        NEXT();
+    HANDLER(OP_GLOBAL):
+        REG(0) = binding_value(global_binding(ip + 1, code->env));
+        ip += 3;
+        NEXT();
+    HANDLER(OP_SET_GLOBAL):
+        set_binding_value(global_binding(ip + 1, code->env), REG(0));
+        note_binding_change(ip[1].value);
+        ip += 3;
+        NEXT();
+    HANDLER(OP_CELL):
+        REG(0) = make_box(REG(1));
+        ip += 2;
+        NEXT();
+    HANDLER(OP_CELL_REF):
+        value = REG(1)->data.box.value;
+        if (value == unassigned) {
+            fprintf(stderr_stream, "unassigned variable, %s\n",
+                    ip[2].value->data.symbol.value);
+            end_with_error();
+        }
+        REG(0) = value;
+        ip += 3;
+        NEXT();
+    HANDLER(OP_CELL_SET):
+        REG(0)->data.box.value = REG(1);
+        ip += 2;
+        NEXT();
+    HANDLER(OP_CLOSURE):
+        count = ip[3].operand;
+        value = the_empty_list;
+        for (i = count; i > 0; i--) {
+            value = cons(REG(3 + i), value);
+        }
+        REG(0) = make_compound_proc(
+                     (count == 0) ?
+                         code->env :
+                         extend_environment(ip[2].value, value, code->env),
+                     ip[1].value);
+        ip += 4 + count;
+        NEXT();
+    HANDLER(OP_ADD):
+        REG(0) = add_integers(REG(1), REG(2));
+        ip += 3;
+        NEXT();
+    HANDLER(OP_SUB):
+        REG(0) = subtract_integers(REG(1), REG(2));
+        ip += 3;
+        NEXT();
+    HANDLER(OP_NUMBER_EQUAL):
+        REG(0) = (compare_integers(REG(1), REG(2)) == 0) ?
+                     true : false;
+        ip += 3;
+        NEXT();
+    HANDLER(OP_LESS_THAN):
+        REG(0) = (compare_integers(REG(1), REG(2)) < 0) ?
+                     true : false;
+        ip += 3;
+        NEXT();
+    HANDLER(OP_GREATER_THAN):
+        REG(0) = (compare_integers(REG(1), REG(2)) > 0) ?
+                     true : false;
+        ip += 3;
+        NEXT();
+    HANDLER(OP_CAR):
+        REG(0) = car(REG(1));
+        ip += 2;
+        NEXT();
+    HANDLER(OP_CDR):
+        REG(0) = cdr(REG(1));
+        ip += 2;
+        NEXT();
+    HANDLER(OP_CONS):
+        REG(0) = cons(REG(1), REG(2));
+        ip += 3;
+        NEXT();
+    HANDLER(OP_IS_NULL):
+        REG(0) = is_the_empty_list(REG(1)) ? true : false;
+        ip += 2;
+        NEXT();
+    HANDLER(OP_IS_PAIR):
+        REG(0) = is_pair(REG(1)) ? true : false;
+        ip += 2;
+        NEXT();
+    HANDLER(OP_PRIM):
+        REG(0) = call_primitive_from_code(ip[1].fn, regs, ip + 2);
+        ip += 3 + ip[2].operand;
+        NEXT();
+    HANDLER(OP_CALL):
+        callee = REG(1);
+        count = ip[2].operand;
+        if (is_compound_proc(callee) &&
+            (callee_code = procedure_code(callee)) != NULL) {
+            check_registers(register_top + count);
+            for (i = 0; i < count; i++) {
+                register_top[i] = REG(3 + i);
+            }
+            value = run_code(callee_code, callee, register_top, count,
+                             &callee, &arguments);
+            if (value == NULL) {
+                value = apply_procedure(callee, arguments);
+            }
+        }
+        else if (is_primitive_proc(callee) && !is_special_primitive(callee)) {
+            value = call_primitive_from_code(
+                        callee->data.primitive_proc.fn, regs, ip + 2);
+        }
+        else {
+            value = apply_procedure(callee, list_of_registers(regs, ip + 2));
+        }
+        REG(0) = value;
+        ip += 3 + count;
+        NEXT();
+    HANDLER(OP_TAIL_CALL):
+        callee = REG(0);
+        count = ip[1].operand;
+        if (is_compound_proc(callee) &&
+            (callee_code = procedure_code(callee)) != NULL) {
+            /* through the free registers, as the arguments may be in
+             * the parameters' */
+            check_registers(register_top + count);
+            for (i = 0; i < count; i++) {
+                register_top[i] = REG(2 + i);
+            }
+            for (i = 0; i < count; i++) {
+                regs[i] = register_top[i];
+            }
+            code = callee_code;
+            procedure = callee;
+            argc = count;
+            goto enter;
+        }
+        register_top = regs;
+        if (is_primitive_proc(callee) && !is_special_primitive(callee)) {
+            return call_primitive_from_code(
+                       callee->data.primitive_proc.fn, regs, ip + 1);
+        }
+        *tail_procedure = callee;
+        *tail_arguments = list_of_registers(regs, ip + 1);
+        return NULL;
+    HANDLER(OP_RETURN):
+        register_top = regs;
+        return REG(0);
+    HANDLER(OP_JUMP):
+        ip = ip[0].target;
+        NEXT();
+    HANDLER(OP_BRANCH):
+        ip = is_false(REG(0)) ? ip[2].target : ip[1].target;
+        NEXT();
+#ifndef USE_COMPUTED_GOTO
     }
+    fprintf(stderr_stream, "threaded code illegal state\n");
+    end_with_error();
+#endif
 }
 
-object *apply_operands(object *arguments) {
-    return prepare_apply_operands(cdr(arguments));
+#undef HANDLER
+#undef NEXT
+#undef REG
+
+object *run_code_on_list(threaded_code *code, object *procedure,
+                         object *arguments, object **tail_procedure,
+                         object **tail_arguments) {
+    object **regs;
+    int count;
+    
+    regs = register_top;
+    for (count = 0; !is_the_empty_list(arguments); count++) {
+        check_registers(regs + count + 1);
+        regs[count] = car(arguments);
+        arguments = cdr(arguments);
+    }
+    return run_code(code, procedure, regs, count,
+                    tail_procedure, tail_arguments);
 }
 
-object *eval_expression(object *arguments) {
-    return car(arguments);
+/* applies a procedure for compiled code or a primitive, which needs
+ * the result */
+object *apply_procedure(object *procedure, object *arguments) {
+    threaded_code *code;
+    object *info;
+    object *env;
+    object *result;
+    region_mark mark;
+    
+    while (1) {
+        if (is_primitive_proc(procedure) && 
+            procedure->data.primitive_proc.fn == eval_proc) {
+            return eval(eval_expression(arguments),
+                        eval_environment(arguments));
+        }
+        if (is_primitive_proc(procedure) && 
+            procedure->data.primitive_proc.fn == apply_proc) {
+            procedure = apply_operator(arguments);
+            arguments = apply_operands(arguments);
+        }
+        else if (is_primitive_proc(procedure)) {
+            return (procedure->data.primitive_proc.fn)(arguments);
+        }
+        else if (!is_compound_proc(procedure)) {
+            fprintf(stderr_stream, "unknown procedure type\n");
+            end_with_error();
+        }
+        else if (use_threaded_code &&
+                 (code = procedure_code(procedure)) != NULL) {
+            result = run_code_on_list(code, procedure, arguments,
+                                      &procedure, &arguments);
+            if (result != NULL) {
+                return result;
+            }
+        }
+        else {
+            info = procedure->data.compound_proc.info;
+            mark = current_region_mark();
+            env = extend_region_environment(
+                       lambda_info_frame_variables(info),
+                       bind_arguments(lambda_info_boxes(info), arguments),
+                       procedure->data.compound_proc.env);
+            result = eval(lambda_info_body(info), env);
+            release_region(mark);
+            return result;
+        }
+    }
 }
 
-object *eval_environment(object *arguments) {
-    return cadr(arguments);
+void init_threaded_code(void) {
+    register_top =
+        check_alloc(malloc(REGISTER_STACK_SIZE * sizeof(object *)));
+    register_limit = register_top + REGISTER_STACK_SIZE;
+#ifdef USE_COMPUTED_GOTO
+    run_code(NULL, NULL, NULL, 0, NULL, NULL);
+#endif
+}
+
+/* primitives only look at their argument list, except list which
+ * hands it back */
+char is_region_arguments_proc(object *procedure) {
+    return is_compound_proc(procedure) ||
+           (is_primitive_proc(procedure) &&
+            procedure->data.primitive_proc.fn != list_proc);
 }
 
 object *list_of_values(object *exps, object *env) {
@@ -1505,6 +10214,55 @@ object *list_of_values(object *exps, object *env) {
     }
 }
 
+object *list_of_values_in_region(object *exps, object *env) {
+    if (is_no_operands(exps)) {
+        return the_empty_list;
+    }
+    else {
+        return region_cons(eval(first_operand(exps), env),
+                           list_of_values_in_region(rest_operands(exps),
+                                                    env));
+    }
+}
+
+/* Pops everything the activation pushed on the region and pushes
+ * the arguments back. They are held on the C stack meanwhile, or when
+ * there are many, in a scratch array kept for the next time. */
+#define MAX_STACKED_ARGUMENTS 16
+
+object **repush_scratch = NULL;
+long repush_scratch_size = 0;
+
+object *repush_arguments(region_mark mark, object *arguments) {
+    object *stacked[MAX_STACKED_ARGUMENTS];
+    object **values;
+    long count;
+    object *rest;
+    
+    count = 0;
+    for (rest = arguments; !is_the_empty_list(rest); rest = cdr(rest)) {
+        count++;
+    }
+    values = stacked;
+    if (count > MAX_STACKED_ARGUMENTS) {
+        if (count > repush_scratch_size) {
+            repush_scratch_size = count;
+            repush_scratch = check_alloc(realloc(repush_scratch,
+                                 repush_scratch_size * sizeof(object *)));
+        }
+        values = repush_scratch;
+    }
+    count = 0;
+    for (rest = arguments; !is_the_empty_list(rest); rest = cdr(rest)) {
+        values[count++] = car(rest);
+    }
+    release_region(mark);
+    while (count > 0) {
+        rest = region_cons(values[--count], rest);
+    }
+    return rest;
+}
+
 object *eval_assignment(object *exp, object *env) {
     set_variable_value(assignment_variable(exp), 
                        eval(assignment_value(exp), env),
@@ -1513,16 +10271,26 @@ object *eval_assignment(object *exp, object *env) {
 }
 
 object *eval_definition(object *exp, object *env) {
+    if (is_lambda(definition_value(exp))) {
+        infer_lambda_types(definition_value(exp), definition_variable(exp));
+    }
+    if (dump_ir && is_lambda(definition_value(exp)) &&
+        is_the_empty_list(enclosing_environment(env))) {
+        dump_procedure_ir(definition_value(exp), definition_variable(exp),
+                          env);
+    }
     define_variable(definition_variable(exp), 
                     eval(definition_value(exp), env),
                     env);
     return ok_symbol;
 }
 
-object *eval(object *exp, object *env) {
+object *eval_in_region(object *exp, object *env, region_mark mark) {
     object *procedure;
     object *arguments;
     object *result;
+    object *info;
+    threaded_code *code;
 
 tailcall:
     if (is_self_evaluating(exp)) {
@@ -1547,9 +10315,8 @@ tailcall:
         goto tailcall;
     }
     else if (is_lambda(exp)) {
-        return make_compound_proc(lambda_parameters(exp),
-                                  lambda_body(exp),
-                                  env);
+        infer_lambda_types(exp, NULL);
+        return make_closure(exp, env);
     }
     else if (is_begin(exp)) {
         exp = begin_actions(exp);
@@ -1568,6 +10335,14 @@ tailcall:
         exp = let_to_application(exp);
         goto tailcall;
     }
+    else if (is_lazy(exp)) {
+        exp = lazy_to_application(exp);
+        goto tailcall;
+    }
+    else if (is_record_definition(exp)) {
+        exp = record_definition_to_begin(exp);
+        goto tailcall;
+    }
     else if (is_and(exp)) {
         exp = and_tests(exp);
         if (is_the_empty_list(exp)) {
@@ -1599,9 +10374,33 @@ tailcall:
         goto tailcall;
     }
     else if (is_application(exp)) {
-        procedure = eval(operator(exp), env);
-        arguments = list_of_values(operands(exp), env);
+        /* A lambda applied on the spot, as made by let, needs no
+         * closure. Its frame goes right on top of the current one. */
+        if (is_lambda(operator(exp))) {
+            infer_lambda_types(exp, NULL);
+            info = lambda_info(operator(exp));
+            arguments = list_of_values_in_region(operands(exp), env);
+            env = extend_region_environment(
+                       lambda_info_frame_variables(info),
+                       bind_arguments(lambda_info_boxes(info), arguments),
+                       env);
+            exp = lambda_info_body(info);
+            goto tailcall;
+        }
+        
+        procedure = eval_operator(exp, env);
+        if (exp->data.pair.annotation != NULL &&
+            is_primitive_proc(procedure) &&
+            procedure->data.primitive_proc.fn ==
+                exp->data.pair.annotation->data.call_cache.call->
+                    fixnum_operation) {
+            return eval_fixnum_application(procedure, operands(exp), env);
+        }
+        arguments = is_region_arguments_proc(procedure) ?
+                        list_of_values_in_region(operands(exp), env) :
+                        list_of_values(operands(exp), env);
 
+apply:
         /* handle eval specially for tail call requirement */
         if (is_primitive_proc(procedure) && 
             procedure->data.primitive_proc.fn == eval_proc) {
@@ -1621,139 +10420,1034 @@ tailcall:
             return (procedure->data.primitive_proc.fn)(arguments);
         }
         else if (is_compound_proc(procedure)) {
-            env = extend_environment( 
-                       procedure->data.compound_proc.parameters,
-                       arguments,
+            if (use_threaded_code &&
+                (code = procedure_code(procedure)) != NULL) {
+                result = run_code_on_list(code, procedure, arguments,
+                                          &procedure, &arguments);
+                if (result != NULL) {
+                    return result;
+                }
+                goto apply;
+            }
+            /* closures never point into frames, so the arguments are
+             * all that is still reachable of what this activation
+             * pushed on the region */
+            info = procedure->data.compound_proc.info;
+            arguments = repush_arguments(mark, arguments);
+            env = extend_region_environment( 
+                       lambda_info_frame_variables(info),
+                       bind_arguments(lambda_info_boxes(info), arguments),
                        procedure->data.compound_proc.env);
-            exp = make_begin(procedure->data.compound_proc.body);
+            exp = lambda_info_body(info);
             goto tailcall;
         }
-        else {
-            fprintf(stderr, "unknown procedure type\n");
-            exit(1);
+        else {
+            fprintf(stderr_stream, "unknown procedure type\n");
+            end_with_error();
+        }
+    }
+    else {
+        fprintf(stderr_stream, "cannot eval unknown expression type\n");
+        end_with_error();
+    }
+    fprintf(stderr_stream, "eval illegal state\n");
+    end_with_error();
+}
+
+object *eval(object *exp, object *env) {
+    region_mark mark;
+    object *result;
+    
+    mark = current_region_mark();
+    result = eval_in_region(exp, env, mark);
+    release_region(mark);
+    return result;
+}
+
+/**************************** PRINT ******************************/
+
+void write_fixnum(FILE *out, long value) {
+    char digits[24];
+    char *p;
+    unsigned long n;
+    
+    p = digits + sizeof(digits);
+    n = (value < 0) ? -(unsigned long)value : (unsigned long)value;
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while (n != 0);
+    if (value < 0) {
+        *--p = '-';
+    }
+    fwrite(p, 1, digits + sizeof(digits) - p, out);
+}
+
+/* Writes the runs of characters needing no escape with one fwrite. */
+void write_string(FILE *out, char *str) {
+    char *run;
+    
+    putc('"', out);
+    run = str;
+    for (;;) {
+        while (*str != '\0' && *str != '\n' &&
+               *str != '\\' && *str != '"') {
+            str++;
+        }
+        fwrite(run, 1, str - run, out);
+        switch (*str) {
+            case '\0':
+                putc('"', out);
+                return;
+            case '\n':
+                fputs("\\n", out);
+                break;
+            default:
+                putc('\\', out);
+                putc(*str, out);
         }
+        run = ++str;
+    }
+}
+
+/* the name of a record type without the angle brackets it is
+ * usually given, so <point> is written point */
+void write_record_name(FILE *out, object *name) {
+    char *str;
+    size_t length;
+
+    str = name->data.symbol.value;
+    length = strlen(str);
+    if (length > 2 && str[0] == '<' && str[length - 1] == '>') {
+        fwrite(str + 1, 1, length - 2, out);
     }
     else {
-        fprintf(stderr, "cannot eval unknown expression type\n");
-        exit(1);
+        fputs(str, out);
     }
-    fprintf(stderr, "eval illegal state\n");
-    exit(1);
 }
 
-/**************************** PRINT ******************************/
-
+/* Walks the spine of the list in a loop, so only nesting in the cars
+ * takes stack. */
 void write_pair(FILE *out, object *pair) {
-    object *car_obj;
     object *cdr_obj;
     
-    car_obj = car(pair);
-    cdr_obj = cdr(pair);
-    write(out, car_obj);
-    if (cdr_obj->type == PAIR) {
-        fprintf(out, " ");
-        write_pair(out, cdr_obj);
-    }
-    else if (cdr_obj->type == THE_EMPTY_LIST) {
-        return;
-    }
-    else {
-        fprintf(out, " . ");
-        write(out, cdr_obj);
+    for (;;) {
+        write(out, car(pair));
+        cdr_obj = cdr(pair);
+        if (cdr_obj->type == PAIR) {
+            putc(' ', out);
+            pair = cdr_obj;
+        }
+        else if (cdr_obj->type == THE_EMPTY_LIST) {
+            return;
+        }
+        else {
+            fputs(" . ", out);
+            write(out, cdr_obj);
+            return;
+        }
     }
 }
 
 void write(FILE *out, object *obj) {
     char c;
     char *str;
+    long i;
     
     switch (obj->type) {
         case THE_EMPTY_LIST:
-            fprintf(out, "()");
+            fputs("()", out);
             break;
         case BOOLEAN:
-            fprintf(out, "#%c", is_false(obj) ? 'f' : 't');
+            fputs(is_false(obj) ? "#f" : "#t", out);
             break;
         case SYMBOL:
-            fprintf(out, "%s", obj->data.symbol.value);
+            fputs(obj->data.symbol.value, out);
             break;
         case FIXNUM:
-            fprintf(out, "%ld", obj->data.fixnum.value);
+            write_fixnum(out, obj->data.fixnum.value);
+            break;
+        case BIGNUM:
+            str = integer_to_string(obj);
+            fputs(str, out);
+            free(str);
             break;
         case CHARACTER:
             c = obj->data.character.value;
-            fprintf(out, "#\\");
+            fputs("#\\", out);
             switch (c) {
                 case '\n':
-                    fprintf(out, "newline");
+                    fputs("newline", out);
                     break;
                 case ' ':
-                    fprintf(out, "space");
+                    fputs("space", out);
                     break;
                 default:
                     putc(c, out);
             }
             break;
         case STRING:
-            str = obj->data.string.value;
-            putchar('"');
-            while (*str != '\0') {
-                switch (*str) {
-                    case '\n':
-                        fprintf(out, "\\n");
-                        break;
-                    case '\\':
-                        fprintf(out, "\\\\");
-                        break;
-                    case '"':
-                        fprintf(out, "\\\"");
-                        break;
-                    default:
-                        putc(*str, out);
-                }
-                str++;
-            }
-            putchar('"');
+            write_string(out, obj->data.string.value);
             break;
         case PAIR:
-            fprintf(out, "(");
+            putc('(', out);
             write_pair(out, obj);
-            fprintf(out, ")");
+            putc(')', out);
+            break;
+        case BYTEVECTOR:
+            fputs("#u8(", out);
+            for (i = 0; i < obj->data.bytevector.length; i++) {
+                if (i > 0) {
+                    putc(' ', out);
+                }
+                write_fixnum(out, obj->data.bytevector.bytes[i]);
+            }
+            putc(')', out);
+            break;
+        case S64VECTOR:
+            fputs("#s64(", out);
+            for (i = 0; i < obj->data.s64vector.length; i++) {
+                if (i > 0) {
+                    putc(' ', out);
+                }
+                write_fixnum(out, obj->data.s64vector.elements[i]);
+            }
+            putc(')', out);
+            break;
+        case VECTOR:
+            fputs("#(", out);
+            for (i = 0; i < obj->data.vector.length; i++) {
+                if (i > 0) {
+                    putc(' ', out);
+                }
+                write(out, obj->data.vector.elements[i]);
+            }
+            putc(')', out);
             break;
         case PRIMITIVE_PROC:
-            fprintf(out, "#<primitive-procedure>");
+            fputs("#<primitive-procedure>", out);
             break;
         case COMPOUND_PROC:
-            fprintf(out, "#<compound-procedure>");
+            fputs("#<compound-procedure>", out);
             break;
         case INPUT_PORT:
-            fprintf(out, "#<input-port>");
+            fputs("#<input-port>", out);
             break;
         case OUTPUT_PORT:
-            fprintf(out, "#<output-port>");
+            fputs("#<output-port>", out);
+            break;
+        case HASH_TABLE:
+            fputs("#<hash-table>", out);
+            break;
+        case PROMISE:
+            fputs("#<promise>", out);
+            break;
+        case RECORD_TYPE:
+            fputs("#<record-type ", out);
+            write_record_name(out, obj->data.record_type.name);
+            putc('>', out);
+            break;
+        case RECORD:
+            fputs("#<record ", out);
+            write_record_name(out,
+                obj->data.record.type->data.record_type.name);
+            putc('>', out);
             break;
         case EOF_OBJECT:
-            fprintf(out, "#<eof>");
+            fputs("#<eof>", out);
             break;
         default:
-            fprintf(stderr, "cannot write unknown type\n");
-            exit(1);
+            fprintf(stderr_stream, "cannot write unknown type\n");
+            end_with_error();
+    }
+}
+
+/* Before write_fasl writes a datum it marks each pair and string in
+ * it with how often it is met, up to twice. Writing clears the marks
+ * of those met once, and marks those met twice again once they have
+ * been written. These and the symbols get an index, found by address
+ * in an open hash table, and their marks are cleared at the end. See
+ * read_fasl for the format. */
+#define FASL_ONCE    1
+#define FASL_SHARED  2
+#define FASL_WRITTEN 3
+typedef struct fasl_entry {
+    object *obj;
+    unsigned long index;
+} fasl_entry;
+
+#define FASL_BUFFER_SIZE 65536
+
+typedef struct fasl_writer {
+    FILE *out;
+    fasl_entry *entries;
+    unsigned long size;     /* a power of two */
+    unsigned long used;
+    object **symbols;
+    unsigned long symbol_count;
+    unsigned long symbol_size;
+    unsigned long shared_count;
+    unsigned long written;
+    unsigned char buffer[FASL_BUFFER_SIZE];
+    int buffered;
+    object *datum;          /* being written */
+} fasl_writer;
+
+fasl_entry *find_fasl_entry(fasl_writer *fasl, object *obj) {
+    unsigned long i;
+    
+    i = ((unsigned long)obj >> 4) * 2654435761UL;
+    while (1) {
+        i &= fasl->size - 1;
+        if (fasl->entries[i].obj == obj ||
+            fasl->entries[i].obj == NULL) {
+            return &fasl->entries[i];
+        }
+        i++;
+    }
+}
+
+void add_fasl_entry(fasl_writer *fasl, object *obj, unsigned long index) {
+    fasl_entry *old;
+    unsigned long old_size;
+    fasl_entry *entry;
+    unsigned long i;
+    
+    if (2 * (fasl->used + 1) > fasl->size) {
+        old = fasl->entries;
+        old_size = fasl->size;
+        fasl->size *= 2;
+        fasl->entries = check_alloc(calloc(fasl->size, sizeof(fasl_entry)));
+        for (i = 0; i < old_size; i++) {
+            if (old[i].obj != NULL) {
+                *find_fasl_entry(fasl, old[i].obj) = old[i];
+            }
+        }
+        free(old);
+    }
+    entry = find_fasl_entry(fasl, obj);
+    entry->obj = obj;
+    entry->index = index;
+    fasl->used++;
+}
+
+void add_fasl_symbol(fasl_writer *fasl, object *symbol) {
+    if (fasl->symbol_count == fasl->symbol_size) {
+        fasl->symbol_size *= 2;
+        fasl->symbols = check_alloc(realloc(fasl->symbols,
+                                fasl->symbol_size * sizeof(object *)));
+    }
+    add_fasl_entry(fasl, symbol, fasl->symbol_count);
+    fasl->symbols[fasl->symbol_count++] = symbol;
+}
+
+void free_fasl_writer(fasl_writer *fasl) {
+    free(fasl->entries);
+    free(fasl->symbols);
+    free(fasl);
+}
+
+/* Clears the marks scan_fasl left when it stopped at something it
+ * cannot write. Everything marked was reached through marked objects
+ * only, and cleared ones are not gone into again, so cycles end. */
+void clear_fasl_marks(object *obj) {
+    long i;
+    
+    while (obj->mark != 0) {
+        obj->mark = 0;
+        if (is_vector(obj)) {
+            for (i = 0; i < obj->data.vector.length; i++) {
+                clear_fasl_marks(obj->data.vector.elements[i]);
+            }
+            return;
+        }
+        if (!is_pair(obj)) {
+            return;
+        }
+        clear_fasl_marks(car(obj));
+        obj = cdr(obj);
+    }
+}
+
+/* marks what the datum holds before any of it is written, going
+ * down lists in a loop and into cars by recursion */
+void scan_fasl(fasl_writer *fasl, object *obj) {
+    long i;
+    
+    while (1) {
+        switch (obj->type) {
+            case THE_EMPTY_LIST:
+            case BOOLEAN:
+            case FIXNUM:
+            case BIGNUM:
+            case CHARACTER:
+                return;
+            case SYMBOL:
+                if (obj->mark == 0) {
+                    obj->mark = FASL_ONCE;
+                    add_fasl_symbol(fasl, obj);
+                }
+                return;
+            case STRING:
+            case PAIR:
+            case VECTOR:
+            case BYTEVECTOR:
+            case S64VECTOR:
+                if (obj->mark != 0) {
+                    if (obj->mark == FASL_ONCE) {
+                        obj->mark = FASL_SHARED;
+                        fasl->shared_count++;
+                    }
+                    return;
+                }
+                obj->mark = FASL_ONCE;
+                if (is_string(obj) || is_bytevector(obj) ||
+                    is_s64vector(obj)) {
+                    return;
+                }
+                if (is_vector(obj)) {
+                    for (i = 0; i < obj->data.vector.length; i++) {
+                        scan_fasl(fasl, obj->data.vector.elements[i]);
+                    }
+                    return;
+                }
+                scan_fasl(fasl, car(obj));
+                obj = cdr(obj);
+                break;
+            default:
+                clear_fasl_marks(fasl->datum);
+                free_fasl_writer(fasl);
+                fprintf(stderr_stream, "cannot write-fasl this type\n");
+                end_with_error();
+        }
+    }
+}
+
+void flush_fasl(fasl_writer *fasl) {
+    fwrite(fasl->buffer, 1, fasl->buffered, fasl->out);
+    fasl->buffered = 0;
+}
+
+void put_fasl_byte(fasl_writer *fasl, int c) {
+    if (fasl->buffered == FASL_BUFFER_SIZE) {
+        flush_fasl(fasl);
+    }
+    fasl->buffer[fasl->buffered++] = c;
+}
+
+void put_varint(fasl_writer *fasl, unsigned long value) {
+    while (value >= 0x80) {
+        put_fasl_byte(fasl, (value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    put_fasl_byte(fasl, value);
+}
+
+/* small negative numbers stay short too */
+void put_zigzag(fasl_writer *fasl, long value) {
+    put_varint(fasl, (value < 0) ? ((unsigned long)(-(value + 1)) << 1) | 1 :
+                                   (unsigned long)value << 1);
+}
+
+/* long runs go straight to the port */
+void put_fasl_bytes(fasl_writer *fasl, char *bytes, unsigned long length) {
+    if (length > FASL_BUFFER_SIZE - fasl->buffered) {
+        flush_fasl(fasl);
+        if (length >= FASL_BUFFER_SIZE) {
+            fwrite(bytes, 1, length, fasl->out);
+            return;
+        }
+    }
+    memcpy(fasl->buffer + fasl->buffered, bytes, length);
+    fasl->buffered += length;
+}
+
+void put_fasl_name(fasl_writer *fasl, char *str) {
+    size_t length;
+    
+    length = strlen(str);
+    put_varint(fasl, length);
+    put_fasl_bytes(fasl, str, length);
+}
+
+void put_fasl_datum(fasl_writer *fasl, object *obj) {
+    object *tail;
+    unsigned long length;
+    long i;
+    int j;
+    
+    while (1) {
+        if (obj->mark == FASL_WRITTEN) {
+            put_fasl_byte(fasl, FASL_REFERENCE);
+            put_varint(fasl, find_fasl_entry(fasl, obj)->index);
+            return;
+        }
+        if (obj->mark == FASL_SHARED) {
+            obj->mark = FASL_WRITTEN;
+            add_fasl_entry(fasl, obj, fasl->written++);
+            put_fasl_byte(fasl, FASL_DEFINE);
+        }
+        switch (obj->type) {
+            case THE_EMPTY_LIST:
+                put_fasl_byte(fasl, FASL_EMPTY_LIST);
+                return;
+            case BOOLEAN:
+                put_fasl_byte(fasl, is_false(obj) ? FASL_FALSE : FASL_TRUE);
+                return;
+            case FIXNUM:
+                put_fasl_byte(fasl, FASL_FIXNUM);
+                put_zigzag(fasl, obj->data.fixnum.value);
+                return;
+            case BIGNUM:
+                put_fasl_byte(fasl, FASL_BIGNUM);
+                put_fasl_byte(fasl, obj->data.bignum.is_negative);
+                put_varint(fasl, obj->data.bignum.length *
+                                 (BIGNUM_DIGIT_BITS / 8));
+                for (i = 0; i < obj->data.bignum.length; i++) {
+                    for (j = 0; j < BIGNUM_DIGIT_BITS; j += 8) {
+                        put_fasl_byte(fasl,
+                                      (obj->data.bignum.digits[i] >> j) &
+                                          0xff);
+                    }
+                }
+                return;
+            case CHARACTER:
+                put_fasl_byte(fasl, FASL_CHARACTER);
+                put_fasl_byte(fasl, obj->data.character.value);
+                return;
+            case STRING:
+                if (obj->mark == FASL_ONCE) {
+                    obj->mark = 0;
+                }
+                put_fasl_byte(fasl, FASL_STRING);
+                put_fasl_name(fasl, obj->data.string.value);
+                return;
+            case SYMBOL:
+                put_fasl_byte(fasl, FASL_SYMBOL);
+                put_varint(fasl, find_fasl_entry(fasl, obj)->index);
+                return;
+            case S64VECTOR:
+                if (obj->mark == FASL_ONCE) {
+                    obj->mark = 0;
+                }
+                put_fasl_byte(fasl, FASL_S64VECTOR);
+                put_varint(fasl, obj->data.s64vector.length);
+                for (i = 0; i < obj->data.s64vector.length; i++) {
+                    put_zigzag(fasl, obj->data.s64vector.elements[i]);
+                }
+                return;
+            case BYTEVECTOR:
+                if (obj->mark == FASL_ONCE) {
+                    obj->mark = 0;
+                }
+                put_fasl_byte(fasl, FASL_BYTEVECTOR);
+                put_varint(fasl, obj->data.bytevector.length);
+                put_fasl_bytes(fasl, (char *)obj->data.bytevector.bytes,
+                               obj->data.bytevector.length);
+                return;
+            case VECTOR:
+                if (obj->mark == FASL_ONCE) {
+                    obj->mark = 0;
+                }
+                put_fasl_byte(fasl, FASL_VECTOR);
+                put_varint(fasl, obj->data.vector.length);
+                for (i = 0; i < obj->data.vector.length; i++) {
+                    put_fasl_datum(fasl, obj->data.vector.elements[i]);
+                }
+                return;
+            default: /* PAIR, and the pairs after it met only once */
+                length = 1;
+                for (tail = cdr(obj);
+                     is_pair(tail) && tail->mark == FASL_ONCE;
+                     tail = cdr(tail)) {
+                    length++;
+                }
+                put_fasl_byte(fasl, FASL_LIST);
+                put_varint(fasl, length);
+                while (length-- > 0) { /* tail can be obj in a cycle */
+                    if (obj->mark == FASL_ONCE) {
+                        obj->mark = 0;
+                    }
+                    put_fasl_datum(fasl, car(obj));
+                    obj = cdr(obj);
+                }
+        }
+    }
+}
+
+void write_fasl(FILE *out, object *obj) {
+    fasl_writer *fasl;
+    unsigned long i;
+    
+    /* the buffer needs no clearing */
+    fasl = check_alloc(malloc(sizeof(fasl_writer)));
+    fasl->out = out;
+    fasl->size = 64;
+    fasl->used = 0;
+    fasl->entries = check_alloc(calloc(fasl->size, sizeof(fasl_entry)));
+    fasl->symbol_size = 16;
+    fasl->symbol_count = 0;
+    fasl->symbols = check_alloc(calloc(fasl->symbol_size,
+                                       sizeof(object *)));
+    fasl->shared_count = 0;
+    fasl->written = 0;
+    fasl->buffered = 0;
+    fasl->datum = obj;
+    scan_fasl(fasl, obj);
+    put_fasl_byte(fasl, 'F');
+    put_fasl_byte(fasl, 'A');
+    put_fasl_byte(fasl, 'S');
+    put_fasl_byte(fasl, 'L');
+    put_fasl_byte(fasl, FASL_VERSION);
+    put_varint(fasl, fasl->symbol_count);
+    for (i = 0; i < fasl->symbol_count; i++) {
+        put_fasl_name(fasl, fasl->symbols[i]->data.symbol.value);
+    }
+    put_varint(fasl, fasl->shared_count);
+    put_fasl_datum(fasl, obj);
+    flush_fasl(fasl);
+    
+    for (i = 0; i < fasl->size; i++) {
+        if (fasl->entries[i].obj != NULL) {
+            fasl->entries[i].obj->mark = 0;
+        }
     }
+    free_fasl_writer(fasl);
 }
 
 /***************************** REPL ******************************/
 
-int main(void) {
+void print_stats(void) {
+    fprintf(stderr, "load cache: %ld hits, %ld misses\n",
+            load_cache_hits, load_cache_misses);
+}
+
+#ifdef HAVE_EPOLL
+
+/* --serve answers many clients on a Unix domain socket from one
+ * global environment. A client's input is gathered until a line ends
+ * outside of any list, string or character. The forms on those lines
+ * are then read from a string port, which is standard input while
+ * they are evaluated, and the results are written after the client's
+ * earlier output. Sockets never block, so a client slow to send or
+ * to take its results holds up no other. An error in a client's
+ * forms ends only that client's connection, though running out of
+ * memory still ends the server. */
+#define SERVE_BUFFER_SIZE 65536
+#define SERVE_MAX_EVENTS  64
+
+#define SCAN_CODE             0
+#define SCAN_HASH             1 /* just after a # */
+#define SCAN_CHARACTER        2 /* just after #\ */
+#define SCAN_STRING           3
+#define SCAN_STRING_ESCAPE    4
+#define SCAN_COMMENT          5
+
+typedef struct client {
+    int fd;
+    char *input;
+    size_t input_length;
+    size_t input_size;
+    size_t scanned;         /* how much of the input scan_input has seen */
+    int depth;              /* of lists open there */
+    char state;             /* and what they are in */
+    char *output;
+    size_t output_length;
+    size_t output_size;
+    size_t output_sent;
+    char is_writable;       /* epoll is waiting for room to send */
+    char is_closing;        /* the client will send nothing more */
+} client;
+
+int serve_epoll;
+
+void set_nonblocking(int fd) {
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+        fprintf(stderr, "could not make socket non-blocking\n");
+        exit(1);
+    }
+}
+
+void watch_client(client *c, int operation) {
+    struct epoll_event event;
+    
+    event.events = (c->is_closing ? 0 : EPOLLIN) |
+                   (c->is_writable ? EPOLLOUT : 0);
+    event.data.ptr = c;
+    if (epoll_ctl(serve_epoll, operation, c->fd, &event) == -1) {
+        fprintf(stderr, "could not watch client\n");
+        exit(1);
+    }
+}
+
+void drop_client(client *c) {
+    epoll_ctl(serve_epoll, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->input);
+    free(c->output);
+    free(c);
+}
+
+/* sends what output it can, and drops the client once it is done
+ * with it or it has gone away */
+void send_output(client *c) {
+    ssize_t sent;
+    char was_writable;
+    
+    while (c->output_sent < c->output_length) {
+        sent = send(c->fd, c->output + c->output_sent,
+                    c->output_length - c->output_sent, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (sent == -1) {
+            drop_client(c);
+            return;
+        }
+        c->output_sent += sent;
+    }
+    if (c->output_sent == c->output_length) {
+        c->output_sent = 0;
+        c->output_length = 0;
+        if (c->is_closing) {
+            drop_client(c);
+            return;
+        }
+    }
+    was_writable = c->is_writable;
+    c->is_writable = c->output_length > 0;
+    if (c->is_writable != was_writable) {
+        watch_client(c, EPOLL_CTL_MOD);
+    }
+}
+
+void queue_output(client *c, char *text, size_t length) {
+    if (c->output_length + length > c->output_size) {
+        while (c->output_length + length > c->output_size) {
+            c->output_size *= 2;
+        }
+        c->output = check_alloc(realloc(c->output, c->output_size));
+    }
+    memcpy(c->output + c->output_length, text, length);
+    c->output_length += length;
+}
+
+/* Evaluates the forms in the first length characters of the input
+ * and takes them off it. An error is reported to the client after
+ * the results before it, and the client is then dropped, with
+ * whatever else it sent unread. */
+void serve_forms(client *c, size_t length) {
+    jmp_buf recovery;
+    region_mark mark;
+    object **saved_register_top;
+    reader *in;
+    reader *saved_stdin_reader;
+    FILE *out;
+    char *text;
+    size_t text_length;
+    object *exp;
+    
+    in = make_string_reader(c->input, length);
+    out = open_memstream(&text, &text_length);
+    if (out == NULL) {
+        fprintf(stderr, "could not open string port\n");
+        exit(1);
+    }
+    saved_stdin_reader = stdin_reader;
+    stdin_reader = in;
+    stdout_stream = out;
+    stderr_stream = out;
+    mark = current_region_mark();
+    saved_register_top = register_top;
+    if (setjmp(recovery) == 0) {
+        error_recovery = &recovery;
+        while ((exp = read(in)) != NULL) {
+            write(out, eval(exp, the_global_environment));
+            putc('\n', out);
+        }
+    }
+    else {
+        release_region(mark);
+        register_top = saved_register_top;
+        abandon_load_caches();
+        fflush(out);
+        if (text_length > 0 && text[text_length - 1] != '\n') {
+            putc('\n', out);
+        }
+        c->is_closing = 1;
+    }
+    error_recovery = NULL;
+    stdin_reader = saved_stdin_reader;
+    stdout_stream = stdout;
+    stderr_stream = stderr;
+    fclose(out);
+    close_reader(in);
+    free(in);
+    queue_output(c, text, text_length);
+    free(text);
+    if (c->is_closing) {
+        c->input_length = 0;
+    }
+    else {
+        c->input_length -= length;
+        memmove(c->input, c->input + length, c->input_length);
+    }
+    c->scanned = 0;
+}
+
+/* the length of the input up to the end of the first line that
+ * finishes its forms, or 0 if there is none yet */
+size_t scan_input(client *c) {
+    char ch;
+    
+    while (c->scanned < c->input_length) {
+        ch = c->input[c->scanned++];
+        switch (c->state) {
+            case SCAN_HASH:
+                if (ch == '\\') {
+                    c->state = SCAN_CHARACTER;
+                    continue;
+                }
+                c->state = SCAN_CODE;
+                break;
+            case SCAN_CHARACTER:
+                c->state = SCAN_CODE;
+                continue;
+            case SCAN_STRING:
+                if (ch == '\\') {
+                    c->state = SCAN_STRING_ESCAPE;
+                }
+                else if (ch == '"') {
+                    c->state = SCAN_CODE;
+                }
+                continue;
+            case SCAN_STRING_ESCAPE:
+                c->state = SCAN_STRING;
+                continue;
+            case SCAN_COMMENT:
+                if (ch != '\n') {
+                    continue;
+                }
+                c->state = SCAN_CODE;
+                break;
+        }
+        switch (ch) {
+            case '(':
+                c->depth++;
+                break;
+            case ')':
+                c->depth--;
+                break;
+            case '"':
+                c->state = SCAN_STRING;
+                break;
+            case ';':
+                c->state = SCAN_COMMENT;
+                break;
+            case '#':
+                c->state = SCAN_HASH;
+                break;
+            case '\n':
+                if (c->depth <= 0) {
+                    c->depth = 0;
+                    return c->scanned;
+                }
+                break;
+        }
+    }
+    return 0;
+}
+
+void serve_input(client *c) {
+    ssize_t received;
+    size_t length;
+    
+    if (c->input_size - c->input_length < SERVE_BUFFER_SIZE) {
+        c->input_size *= 2;
+        c->input = check_alloc(realloc(c->input, c->input_size));
+    }
+    received = recv(c->fd, c->input + c->input_length,
+                    c->input_size - c->input_length, 0);
+    if (received == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            drop_client(c);
+        }
+        return;
+    }
+    c->input_length += received;
+    while (!c->is_closing && (length = scan_input(c)) > 0) {
+        serve_forms(c, length);
+    }
+    /* forms cut off by the end of the input are left unread */
+    if (received == 0 && !c->is_closing && c->depth == 0 &&
+        c->state != SCAN_STRING && c->state != SCAN_STRING_ESCAPE) {
+        serve_forms(c, c->input_length);
+    }
+    if (received == 0 || c->is_closing) {
+        c->is_closing = 1;
+        watch_client(c, EPOLL_CTL_MOD);
+    }
+    send_output(c);
+}
+
+void accept_clients(int listener) {
+    int fd;
+    client *c;
+    
+    while ((fd = accept(listener, NULL, NULL)) != -1) {
+        set_nonblocking(fd);
+        c = check_alloc(malloc(sizeof(client)));
+        c->fd = fd;
+        c->input_size = 2 * SERVE_BUFFER_SIZE;
+        c->input = check_alloc(malloc(c->input_size));
+        c->input_length = 0;
+        c->scanned = 0;
+        c->depth = 0;
+        c->state = SCAN_CODE;
+        c->output_size = SERVE_BUFFER_SIZE;
+        c->output = check_alloc(malloc(c->output_size));
+        c->output_length = 0;
+        c->output_sent = 0;
+        c->is_writable = 0;
+        c->is_closing = 0;
+        watch_client(c, EPOLL_CTL_ADD);
+    }
+}
+
+void serve(char *path) {
+    struct sockaddr_un address;
+    struct stat status;
+    struct epoll_event event;
+    struct epoll_event events[SERVE_MAX_EVENTS];
+    int listener;
+    int count;
+    int i;
+    client *c;
+    
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "socket path too long \"%s\"\n", path);
+        exit(1);
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    /* a socket left by an earlier server is in the way */
+    if (stat(path, &status) == 0 && S_ISSOCK(status.st_mode)) {
+        unlink(path);
+    }
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == -1 ||
+        bind(listener, (struct sockaddr *)&address,
+             sizeof(address)) == -1 ||
+        listen(listener, SOMAXCONN) == -1) {
+        fprintf(stderr, "could not listen on \"%s\"\n", path);
+        exit(1);
+    }
+    set_nonblocking(listener);
+    serve_epoll = epoll_create(SERVE_MAX_EVENTS);
+    if (serve_epoll == -1) {
+        fprintf(stderr, "could not create epoll instance\n");
+        exit(1);
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(serve_epoll, EPOLL_CTL_ADD, listener, &event) == -1) {
+        fprintf(stderr, "could not watch \"%s\"\n", path);
+        exit(1);
+    }
+    while (1) {
+        count = epoll_wait(serve_epoll, events, SERVE_MAX_EVENTS, -1);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count == -1) {
+            fprintf(stderr, "could not wait for clients\n");
+            exit(1);
+        }
+        for (i = 0; i < count; i++) {
+            c = events[i].data.ptr;
+            if (c == NULL) {
+                accept_clients(listener);
+            }
+            else if (!c->is_closing &&
+                     (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                serve_input(c);
+            }
+            else {
+                send_output(c);
+            }
+        }
+    }
+}
+
+#endif
+
+int main(int argc, char **argv) {
     object *exp;
+    char *no_load_cache;
+    char *serve_path = NULL;
+    int i;
+    
+    atexit(abandon_load_caches);
+    no_load_cache = getenv("SCHEME_NO_LOAD_CACHE");
+    if (no_load_cache != NULL && *no_load_cache != '\0') {
+        use_load_cache = 0;
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--infer-types") == 0) {
+            infer_types = 1;
+        }
+        else if (strcmp(argv[i], "--report-types") == 0) {
+            infer_types = 1;
+            report_types = 1;
+        }
+        else if (strcmp(argv[i], "--dump-ir") == 0) {
+            dump_ir = 1;
+        }
+        else if (strcmp(argv[i], "--threaded") == 0) {
+            use_threaded_code = 1;
+        }
+        else if (strcmp(argv[i], "--no-load-cache") == 0) {
+            use_load_cache = 0;
+        }
+        else if (strcmp(argv[i], "--stats") == 0) {
+            atexit(print_stats);
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        }
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            exit(1);
+        }
+    }
 
-    printf("Welcome to Bootstrap Scheme. "
-           "Use ctrl-c to exit.\n");
+    if (serve_path == NULL) {
+        printf("Welcome to Bootstrap Scheme. "
+               "Use ctrl-c to exit.\n");
+    }
 
     init();
+    if (use_threaded_code) {
+        init_threaded_code();
+    }
+
+    if (serve_path != NULL) {
+#ifdef HAVE_EPOLL
+        serve(serve_path);
+#else
+        fprintf(stderr, "--serve needs epoll\n");
+        exit(1);
+#endif
+    }
 
     while (1) {
         printf("> ");
-        exp = read(stdin);
+        exp = read(stdin_reader);
         if (exp == NULL) {
             break;
         }
@@ -64,4 +64,28 @@
 (define (not x)
   (if x #f #t))
 
+(define (stream-tail s k)
+  (if (= k 0)
+      s
+      (stream-tail (stream-cdr s) (- k 1))))
+
+(define (stream-head s k)
+  (if (= k 0)
+      '()
+      (cons (stream-car s)
+            (stream-head (stream-cdr s) (- k 1)))))
+
+(define (stream-map proc s)
+  (if (stream-null? s)
+      the-empty-stream
+      (cons-stream (proc (stream-car s))
+                   (stream-map proc (stream-cdr s)))))
+
+(define (stream-filter pred s)
+  (cond ((stream-null? s) the-empty-stream)
+        ((pred (stream-car s))
+         (cons-stream (stream-car s)
+                      (stream-filter pred (stream-cdr s))))
+        (else (stream-filter pred (stream-cdr s)))))
+
 'stdlib-loaded
\ No newline at end of file
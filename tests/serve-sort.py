@@ -0,0 +1,44 @@
+# Runs scheme --serve and checks that sort! stopped by an error in
+# its comparison leaves the vector or list it was given as it was.
+# Usage: python3 tests/serve-sort.py ./scheme
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+def talk(path, text):
+    client = socket.socket(socket.AF_UNIX)
+    client.connect(path)
+    client.sendall(text.encode())
+    client.shutdown(socket.SHUT_WR)
+    reply = b''
+    while True:
+        data = client.recv(65536)
+        if not data:
+            return reply.decode()
+        reply += data
+
+directory = tempfile.mkdtemp()
+path = os.path.join(directory, 'sock')
+server = subprocess.Popen([sys.argv[1], '--serve', path])
+try:
+    while not os.path.exists(path):
+        time.sleep(0.05)
+    talk(path, '(define v (vector 5 3 8 1 9 2 7 4 6))\n'
+               '(define l (list 5 3 8 1 9 2 7 4 6))\n'
+               '(define (less a b)\n'
+               '  (if (= a 7) (error "seven") (< a b)))\n')
+    reply = talk(path, '(sort! v less)\n')
+    assert 'seven' in reply, reply
+    reply = talk(path, '(sort! l less)\n')
+    assert 'seven' in reply, reply
+    reply = talk(path, 'v\nl\n(sort! v <)\n')
+    assert reply.endswith('#(5 3 8 1 9 2 7 4 6)\n'
+                          '(5 3 8 1 9 2 7 4 6)\n'
+                          '#(1 2 3 4 5 6 7 8 9)\n'), reply
+    print('ok')
+finally:
+    server.kill()
+    server.wait()
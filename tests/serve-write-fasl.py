@@ -0,0 +1,45 @@
+# Runs scheme --serve and checks that a write-fasl stopped by a datum
+# it cannot write leaves the rest of that datum fit to write again.
+# Usage: python3 tests/serve-write-fasl.py ./scheme
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+def talk(path, text):
+    client = socket.socket(socket.AF_UNIX)
+    client.connect(path)
+    client.sendall(text.encode())
+    client.shutdown(socket.SHUT_WR)
+    reply = b''
+    while True:
+        data = client.recv(65536)
+        if not data:
+            return reply.decode()
+        reply += data
+
+directory = tempfile.mkdtemp()
+path = os.path.join(directory, 'sock')
+fasl = os.path.join(directory, 'data.fasl')
+server = subprocess.Popen([sys.argv[1], '--serve', path])
+try:
+    while not os.path.exists(path):
+        time.sleep(0.05)
+    talk(path, '(define s "shared")\n'
+               '(define good (list (quote a) s s (vector 1 s)))\n'
+               '(define data (list good car))\n')
+    reply = talk(path, '(define out (open-output-port "%s"))\n'
+                       '(write-fasl data out)\n' % fasl)
+    assert 'cannot write-fasl this type' in reply, reply
+    reply = talk(path, '(define out (open-output-port "%s"))\n'
+                       '(write-fasl good out)\n'
+                       '(close-output-port out)\n'
+                       '(read-fasl (open-input-port "%s"))\n'
+                       % (fasl, fasl))
+    assert reply.endswith('(a "shared" "shared" #(1 "shared"))\n'), reply
+    print('ok')
+finally:
+    server.kill()
+    server.wait()